@@ -14,7 +14,6 @@
 //#define DEBUG_STACK_SIZE 1
 
 #ifdef DEBUG_PROFILING
-#include <time.h>
 static long time_query = 0;
 static long time_total = 0;
 // number of times buffer hit during a query
@@ -42,6 +41,8 @@ static long count_buffer_total = 0;
 #include <string.h>
 #include <inttypes.h>
 #include <ctype.h>
+#include <math.h>
+#include <time.h>
 
 // runtime assert
 #define ASSERT(val) \
@@ -52,6 +53,118 @@ do {\
     }\
 } while(0)
 
+///////////////
+// Profiling //
+///////////////
+
+// bytes of column data read from disk so far, see read_column_from_file
+static size_t count_bytes_read = 0;
+
+// wall clock, in microseconds
+static inline long time_in_microseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
+
+///////////
+// Arena //
+///////////
+
+#ifndef ARENA_BLOCK_SIZE
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#endif
+
+// every allocation from arena is aligned to this
+#define ARENA_ALIGNMENT 16
+
+/**
+ * A block of memory owned by an arena, the memory handed out follows this header
+ */
+typedef struct struct_arena_block {
+    // block allocated before this one
+    struct struct_arena_block *prev;
+    // bytes of the block including the header, and how many of them are used
+    size_t size;
+    size_t top;
+} struct_arena_block;
+
+// header is padded so the memory after it stays aligned
+#define SIZE_ARENA_BLOCK_HEADER ((sizeof(struct_arena_block) + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT)
+
+/**
+ * Bump allocator
+ *
+ * Memory is handed out by moving the top of the newest block, and is only released all at once,
+ * by reset_struct_arena or free_struct_arena
+ */
+typedef struct {
+    // @nullable: the newest block
+    struct_arena_block *head;
+} struct_arena;
+
+static void init_struct_arena(struct_arena *arena) {
+    arena->head = NULL;
+}
+
+/**
+ * Allocate size bytes from arena, aligned to ARENA_ALIGNMENT
+ * Requests larger than ARENA_BLOCK_SIZE get a block of their own
+ */
+static void *arena_alloc(struct_arena *arena, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+
+    struct_arena_block *block = arena->head;
+
+    if (block == NULL || block->top + size > block->size) {
+        size_t size_data = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+
+        block = (struct_arena_block *) malloc(SIZE_ARENA_BLOCK_HEADER + size_data);
+        block->prev = arena->head;
+        block->size = SIZE_ARENA_BLOCK_HEADER + size_data;
+        block->top = SIZE_ARENA_BLOCK_HEADER;
+
+        arena->head = block;
+    }
+
+    void *ret = (char *) block + block->top;
+    block->top += size;
+    return ret;
+}
+
+/**
+ * Release everything allocated from arena, but keep its newest block for reuse
+ */
+static void reset_struct_arena(struct_arena *arena) {
+    if (arena->head == NULL) {
+        return;
+    }
+
+    struct_arena_block *block = arena->head->prev;
+    while (block != NULL) {
+        struct_arena_block *prev = block->prev;
+        free(block);
+        block = prev;
+    }
+
+    arena->head->prev = NULL;
+    arena->head->top = SIZE_ARENA_BLOCK_HEADER;
+}
+
+static void free_struct_arena(struct_arena *arena) {
+    reset_struct_arena(arena);
+    free(arena->head);
+    arena->head = NULL;
+}
+
+/**
+ * Allocate from arena if there is one, otherwise from malloc
+ */
+static void *arena_or_malloc(struct_arena *arena, size_t size) {
+    return arena != NULL ? arena_alloc(arena, size) : malloc(size);
+}
+
 /*
  _______
 /       \
@@ -75,18 +188,54 @@ ASSERT(('a' <= c->input[0] && c->input[0] <= 'z') || ('A' <= c->input[0] && c->i
 #define IS_ALPHABET_OR_NUMERIC(ch) ((ch) >= '0' && (ch) <= '9' || (ch) >= 'a' && (ch) <= 'z' || (ch) >= 'A' && (ch) <= 'Z')
 #define IS_NUMERIC(ch) ((ch) >= '0' && (ch) <= '9')
 
+// a query starts with SELECT or EXPLAIN
+#define IS_QUERY_START(ch) ((ch) == 'S' || (ch) == 'E')
+
 //////////
 // enum //
 //////////
 
 // this is the type of operations involved in the query predicates
-// =, <, >
+// =, <, >, BETWEEN, IN and OR groups
 typedef enum {
     EQUAL,
     LESS_THAN,
-    GREATER_THAN
+    GREATER_THAN,
+    BETWEEN,
+    IN,
+    OR
 } enum_operator;
 
+// aggregate functions allowed on the first line of the query
+// AGGREGATE_COLUMN is a plain column, it has to be one of the columns of GROUP BY
+typedef enum {
+    AGGREGATE_SUM,
+    AGGREGATE_COUNT,
+    AGGREGATE_MIN,
+    AGGREGATE_MAX,
+    AGGREGATE_AVG,
+    AGGREGATE_COLUMN
+} enum_aggregate;
+
+// name of each enum_aggregate as written before its column, except AGGREGATE_COLUMN
+static const char *const NAME_AGGREGATE[] = {"SUM(", "COUNT(", "MIN(", "MAX(", "AVG("};
+
+// arithmetic between the two columns inside an aggregate, SUM(A.c1 * B.c2)
+typedef enum {
+    ARITHMETIC_NONE,
+    ARITHMETIC_ADD,
+    ARITHMETIC_SUBTRACT,
+    ARITHMETIC_MULTIPLY
+} enum_arithmetic;
+
+// EXPLAIN before SELECT prints the plan instead of running the query,
+// EXPLAIN ANALYZE runs the query, then prints the plan with what each operator actually did
+typedef enum {
+    EXPLAIN_NONE,
+    EXPLAIN_PLAN,
+    EXPLAIN_ANALYZE
+} enum_explain;
+
 typedef enum {
     PARSE_OK = 0,
     PARSE_FAILED
@@ -113,11 +262,24 @@ typedef struct {
     int column;
 } struct_relation_column;
 
-// SELECT SUM(D.c0), SUM(D.c4), SUM(C.c1)
+// SUM(D.c0), COUNT(*), AVG(C.c1), SUM(A.c1 * B.c2)
+typedef struct {
+    enum_aggregate function;
+
+    // column to aggregate over
+    // for COUNT(*), relation is '*'
+    struct_relation_column rc;
+
+    // aggregate over (rc arithmetic rhs) instead, if arithmetic is not ARITHMETIC_NONE
+    enum_arithmetic arithmetic;
+    struct_relation_column rhs;
+} struct_aggregate;
+
+// SELECT SUM(D.c0), SUM(D.c4), MAX(C.c1)
 typedef struct {
-    struct_relation_column *sums;
+    struct_aggregate *sums;
     // size of above array
-    // number of SUM queries
+    // number of aggregates
     size_t length;
 } struct_first_line;
 
@@ -128,11 +290,14 @@ typedef struct {
     size_t length;
 } struct_second_line;
 
-// A.c1 = B.c0
+// A.c1 = B.c0, A.c1 < B.c0
 typedef struct {
     // length will be 2, lhs and rhs
     struct_relation_column lhs;
     struct_relation_column rhs;
+
+    // EQUAL, LESS_THAN or GREATER_THAN, lhs op rhs
+    enum_operator op;
 } struct_join;
 
 // WHERE A.c1 = B.c0 AND A.c3 = D.c0 AND C.c2 = D.c2
@@ -143,17 +308,40 @@ typedef struct {
 } struct_third_line;
 
 // D.c3 < -9496
-typedef struct {
+// D.c3 BETWEEN -10 AND 10
+// D.c3 IN (1, 5, 9)
+// (D.c3 < -9496 OR D.c1 = 5)
+typedef struct struct_predicate {
+    // for OR, this is the first column of the group, all columns of a group are on the same relation
     struct_relation_column lhs;
     enum_operator op;
+    // for BETWEEN, this is the lower bound
     int rhs;
+
+    // upper bound of BETWEEN, inclusive
+    int rhs_high;
+
+    // list of numbers of IN
+    int *values;
+    // size of above array
+    size_t num_values;
+
+    // predicates of OR group, any of them has to be met
+    struct struct_predicate *disjuncts;
+    // size of above array
+    size_t num_disjuncts;
 } struct_predicate;
 
-// AND C.c2 = 2247;
+// AND C.c2 = 2247 GROUP BY A.c1;
 typedef struct {
     struct_predicate *predicates;
     // number of predicates
     size_t length;
+
+    // columns of GROUP BY
+    struct_relation_column *groups;
+    // number of columns to group by, 0 if there is no GROUP BY
+    size_t num_groups;
 } struct_fourth_line;
 
 /*
@@ -163,6 +351,8 @@ WHERE A.c1 = B.c0 AND A.c3 = D.c0 AND C.c2 = D.c2
 AND D.c3 = -9496;
  */
 typedef struct {
+    enum_explain explain;
+
     struct_first_line first;
     struct_second_line second;
     struct_third_line third;
@@ -172,6 +362,9 @@ typedef struct {
 typedef struct {
     struct_query *queries;
     size_t length;
+
+    // every query parsed by parse_queries is allocated from here, and released together
+    struct_arena arena;
 } struct_queries;
 
 // this struct stores information during parsing
@@ -179,8 +372,18 @@ typedef struct {
     const char *input;
     char *stack;
     size_t size, top;
+
+    // @nullable: where the parsed structs are allocated, malloc is used if NULL
+    struct_arena *arena;
 } struct_parse_context;
 
+/*
+ * allocate memory for a parsed struct, see struct_parse_context.arena
+ */
+static void *context_alloc(struct_parse_context *c, size_t size) {
+    return arena_or_malloc(c->arena, size);
+}
+
 /*
  * pop the stack by moving the top index of the stack down
  * must memcpy the memory because they may be occupied by future stack push
@@ -264,12 +467,38 @@ static void free_struct_third_line(struct_third_line *tl) {
     tl->length = 0;
 }
 
+static void free_struct_predicate(struct_predicate *p) {
+    if (p->op == IN) {
+        free(p->values);
+        p->values = NULL;
+        p->num_values = 0;
+    }
+
+    if (p->op == OR) {
+        for (int i = 0; i < p->num_disjuncts; i++) {
+            free_struct_predicate(&p->disjuncts[i]);
+        }
+
+        free(p->disjuncts);
+        p->disjuncts = NULL;
+        p->num_disjuncts = 0;
+    }
+}
+
 static void free_struct_fourth_line(struct_fourth_line *fl) {
+    free(fl->groups);
+    fl->groups = NULL;
+    fl->num_groups = 0;
+
     // this line may be empty
     if (fl->length == 0) {
         return;
     }
 
+    for (int i = 0; i < fl->length; i++) {
+        free_struct_predicate(&fl->predicates[i]);
+    }
+
     free(fl->predicates);
     fl->predicates = NULL;
     fl->length = 0;
@@ -283,11 +512,8 @@ static void free_struct_query(struct_query *query) {
 }
 
 static void free_struct_queries(struct_queries *queries) {
-    for (int i = 0; i < queries->length; i++) {
-        free_struct_query(&queries->queries[i]);
-    }
-
-    free(queries->queries);
+    // everything of the queries is in the arena
+    free_struct_arena(&queries->arena);
     queries->queries = NULL;
     queries->length = 0;
 }
@@ -296,6 +522,7 @@ static void init_struct_parse_context(struct_parse_context *c, const char *input
     c->input = input;
     c->stack = NULL;
     c->size = c->top = 0;
+    c->arena = NULL;
 }
 
 static void free_struct_parse_context(struct_parse_context *c) {
@@ -376,16 +603,13 @@ int parse_relation_column(struct_parse_context *c, struct_relation_column *relat
             // string of number, no terminal
             const char *str = (char *) context_pop(c, len);
 
-            char *tmp_str = (char *) malloc(len + 1);
+            char tmp_str[16] = {'\0'};
+            ASSERT(len < sizeof(tmp_str));
             memcpy(tmp_str, str, len);
-            tmp_str[len] = '\0';
 
             // parse int
             relation_column->column = strtol(tmp_str, NULL, 0);
 
-            // clean up
-            free(tmp_str);
-
             // move head to this non numeric char
             c->input = tmp_p;
             break;
@@ -399,63 +623,107 @@ int parse_relation_column(struct_parse_context *c, struct_relation_column *relat
 }
 
 /*
- * Match relation and column
+ * Match aggregate function and its column
  * CFG:
- * SUM(relation.column)
+ * Function(Expression) | COUNT(*) | relation.column
+ * Function -> SUM | COUNT | MIN | MAX | AVG
+ * Expression -> relation.column | relation.columnWhitespaceArithmeticWhitespacerelation.column
+ * Arithmetic -> + | - | *
  */
-int parse_first_line_sum(struct_parse_context *c, struct_relation_column *relation_column) {
-    EXPECT(c, 'S');
+int parse_first_line_sum(struct_parse_context *c, struct_aggregate *aggregate) {
+    aggregate->arithmetic = ARITHMETIC_NONE;
+
+    // plain column, relation is always a single alphabet
+    if (c->input[1] == '.') {
+        aggregate->function = AGGREGATE_COLUMN;
+        return parse_relation_column(c, &aggregate->rc);
+    }
+
+    static const enum_aggregate FUNCTION_AGGREGATE[] = {
+            AGGREGATE_SUM, AGGREGATE_COUNT, AGGREGATE_MIN, AGGREGATE_MAX, AGGREGATE_AVG
+    };
+
+    int i = 0;
+    for (; i < sizeof(FUNCTION_AGGREGATE) / sizeof(FUNCTION_AGGREGATE[0]); i++) {
+        if (0 == strncmp(c->input, NAME_AGGREGATE[i], strlen(NAME_AGGREGATE[i]))) {
+            break;
+        }
+    }
+    ASSERT(i < sizeof(FUNCTION_AGGREGATE) / sizeof(FUNCTION_AGGREGATE[0]));
+
+    aggregate->function = FUNCTION_AGGREGATE[i];
 
     // move pointer to relation
-    c->input += strlen("SUM(");
+    c->input += strlen(NAME_AGGREGATE[i]);
+
+    if (aggregate->function == AGGREGATE_COUNT && c->input[0] == '*') {
+        aggregate->rc.relation = '*';
+        aggregate->rc.column = 0;
+        c->input++;
+    } else {
+        parse_relation_column(c, &aggregate->rc);
+        parse_whitespace(c);
 
-    parse_relation_column(c, relation_column);
+        // Relation.ColumnWhitespaceArithmeticWhitespaceRelation.Column
+        static const char SYMBOL_ARITHMETIC[] = {'+', '-', '*'};
+        static const enum_arithmetic ARITHMETIC[] = {ARITHMETIC_ADD, ARITHMETIC_SUBTRACT, ARITHMETIC_MULTIPLY};
+
+        for (int k = 0; k < sizeof(ARITHMETIC) / sizeof(ARITHMETIC[0]); k++) {
+            if (c->input[0] == SYMBOL_ARITHMETIC[k]) {
+                aggregate->arithmetic = ARITHMETIC[k];
+                c->input++;
+
+                parse_whitespace(c);
+                parse_relation_column(c, &aggregate->rhs);
+                parse_whitespace(c);
+                break;
+            }
+        }
+    }
 
     // move pointer, skip )
+    EXPECT(c, ')');
     c->input++;
 
     return PARSE_OK;
 }
 
 /*
- * List of sums
+ * List of aggregates
  * CFG:
  * Sums -> Sum | Sum,WhitespaceSums
  */
 int parse_first_line_sums(struct_parse_context *c, struct_first_line *v) {
-    // Should start with SUM
-    EXPECT(c, 'S');
+    // Should start with an aggregate function
+    EXPECT_ALPHABET(c);
 
-    struct_relation_column *rc = NULL;
+    // parsed on the C stack, because parsing pushes into context which may move
+    struct_aggregate rc;
 
     size_t head = c->top;
 
-    rc = (struct_relation_column *) malloc(sizeof(struct_relation_column));
-    parse_first_line_sum(c, rc);
+    parse_first_line_sum(c, &rc);
 
     // push into context
-    *(struct_relation_column *) context_push(c, sizeof(struct_relation_column)) = *rc;
-    free(rc);
+    *(struct_aggregate *) context_push(c, sizeof(struct_aggregate)) = rc;
 
     while (c->input[0] == ',') {
         c->input++;
         parse_whitespace(c);
 
-        rc = (struct_relation_column *) malloc(sizeof(struct_relation_column));
-        parse_first_line_sum(c, rc);
+        parse_first_line_sum(c, &rc);
 
         // push into context
-        *(struct_relation_column *) context_push(c, sizeof(struct_relation_column)) = *rc;
-        free(rc);
+        *(struct_aggregate *) context_push(c, sizeof(struct_aggregate)) = rc;
     }
 
     // pop
     size_t len = c->top - head;
-    const struct_relation_column *rcs = (struct_relation_column *) context_pop(c, len);
+    const struct_aggregate *rcs = (struct_aggregate *) context_pop(c, len);
 
-    v->sums = (struct_relation_column *) malloc(len);
+    v->sums = (struct_aggregate *) context_alloc(c, len);
     memcpy(v->sums, rcs, len);
-    v->length = len / sizeof(struct_relation_column);
+    v->length = len / sizeof(struct_aggregate);
 
     return PARSE_OK;
 }
@@ -527,7 +795,7 @@ int parse_second_line_relations(struct_parse_context *c, struct_second_line *v)
     const char *relations = (char *) context_pop(c, len);
 
     // len = number of alphabets
-    v->relations = (char *) malloc(len + 1);
+    v->relations = (char *) context_alloc(c, len + 1);
     memcpy(v->relations, relations, len);
 
     // add ending \0 to the string
@@ -562,10 +830,47 @@ void parse_third_line_where(struct_parse_context *c) {
     c->input += strlen("WHERE");
 }
 
+/*
+ * Match comparision operator
+ * =, >, <, BETWEEN or IN
+ */
+int parse_operator(struct_parse_context *c, enum_operator *op) {
+    if (0 == strncmp(c->input, "BETWEEN", strlen("BETWEEN"))) {
+        *op = BETWEEN;
+        c->input += strlen("BETWEEN");
+        return PARSE_OK;
+    }
+
+    if (0 == strncmp(c->input, "IN", strlen("IN"))) {
+        *op = IN;
+        c->input += strlen("IN");
+        return PARSE_OK;
+    }
+
+    switch (c->input[0]) {
+        case '=':
+            *op = EQUAL;
+            break;
+        case '>':
+            *op = GREATER_THAN;
+            break;
+        case '<':
+            *op = LESS_THAN;
+            break;
+        default:
+            ASSERT(0);
+            return PARSE_FAILED;
+    }
+
+    c->input++;
+
+    return PARSE_OK;
+}
+
 /*
  * Math JOIN
  * CFG:
- * Relation.ColumnWhitespace=WhitespaceRelation.Column
+ * Relation.ColumnWhitespaceJoinOperatorWhitespaceRelation.Column
  */
 int parse_third_line_join(struct_parse_context *c, struct_join *join) {
     EXPECT_ALPHABET(c);
@@ -574,9 +879,9 @@ int parse_third_line_join(struct_parse_context *c, struct_join *join) {
 
     parse_whitespace(c);
 
-    // skip = sign
-    EXPECT(c, '=');
-    c->input++;
+    // =, < or >
+    parse_operator(c, &join->op);
+    ASSERT(join->op == EQUAL || join->op == LESS_THAN || join->op == GREATER_THAN);
 
     parse_whitespace(c);
 
@@ -593,6 +898,18 @@ void parse_and(struct_parse_context *c) {
     c->input += strlen("AND");
 }
 
+/*
+ * Check if whitespaces followed by literal AND come next, without moving input
+ */
+int is_and_ahead(const struct_parse_context *c) {
+    const char *p = c->input;
+    while (p[0] == '\n' || p[0] == ' ') {
+        p++;
+    }
+
+    return p != c->input && 0 == strncmp(p, "AND ", strlen("AND "));
+}
+
 /*
  * Match list of JOINs
  * CFG:
@@ -601,17 +918,16 @@ void parse_and(struct_parse_context *c) {
 int parse_third_line_joins(struct_parse_context *c, struct_third_line *tl) {
     EXPECT_ALPHABET(c);
 
-    struct_join *join = NULL;
+    // parsed on the C stack, because parsing pushes into context which may move
+    struct_join join;
 
     size_t head = c->top;
 
     // first join
-    join = (struct_join *) malloc(sizeof(struct_join));
-    parse_third_line_join(c, join);
+    parse_third_line_join(c, &join);
 
     // push into context
-    *(struct_join *) context_push(c, sizeof(struct_join)) = *join;
-    free(join);
+    *(struct_join *) context_push(c, sizeof(struct_join)) = join;
 
     // will end because third line ends with \n
     while (c->input[0] == ' ') {
@@ -621,18 +937,16 @@ int parse_third_line_joins(struct_parse_context *c, struct_third_line *tl) {
         parse_whitespace(c);
 
         // following joins
-        join = (struct_join *) malloc(sizeof(struct_join));
-        parse_third_line_join(c, join);
+        parse_third_line_join(c, &join);
 
         // push into context
-        *(struct_join *) context_push(c, sizeof(struct_join)) = *join;
-        free(join);
+        *(struct_join *) context_push(c, sizeof(struct_join)) = join;
     }
 
     size_t len = c->top - head;
     const struct_join *joins = (struct_join *) context_pop(c, len);
 
-    tl->joins = (struct_join *) malloc(len);
+    tl->joins = (struct_join *) context_alloc(c, len);
     memcpy(tl->joins, joins, len);
     tl->length = len / sizeof(struct_join);
 
@@ -655,50 +969,74 @@ int parse_third_line(struct_parse_context *c, struct_third_line *v) {
 }
 
 /*
- * Match comparision operator
- * =, > or <
+ * Match an Integer
  */
-int parse_operator(struct_parse_context *c, enum_operator *op) {
-    switch (c->input[0]) {
-        case '=':
-            *op = EQUAL;
-            break;
-        case '>':
-            *op = GREATER_THAN;
-            break;
-        case '<':
-            *op = LESS_THAN;
-            break;
-        default:
-            ASSERT(0);
-            return PARSE_FAILED;
-    }
+int parse_number(struct_parse_context *c, int *num) {
+    char *tail = NULL;
+    *num = strtol(c->input, &tail, 0);
 
-    c->input++;
+    c->input = tail;
 
     return PARSE_OK;
 }
 
 /*
- * Match an Integer
+ * Match list of numbers of IN
+ * CFG:
+ * (Numbers)
+ * Numbers -> Number | Number,WhitespaceNumbers
  */
-int parse_number(struct_parse_context *c, int *num) {
-    char *tail = NULL;
-    *num = strtol(c->input, &tail, 0);
+int parse_fourth_line_values(struct_parse_context *c, struct_predicate *p) {
+    EXPECT(c, '(');
+    c->input++;
+    parse_whitespace(c);
 
-    c->input = tail;
+    size_t head = c->top;
+
+    int number = 0;
+    parse_number(c, &number);
+    *(int *) context_push(c, sizeof(int)) = number;
+    parse_whitespace(c);
+
+    while (c->input[0] == ',') {
+        c->input++;
+        parse_whitespace(c);
+
+        parse_number(c, &number);
+        *(int *) context_push(c, sizeof(int)) = number;
+        parse_whitespace(c);
+    }
+
+    // skip )
+    EXPECT(c, ')');
+    c->input++;
+
+    size_t len = c->top - head;
+    const int *values = (int *) context_pop(c, len);
+
+    p->values = (int *) context_alloc(c, len);
+    memcpy(p->values, values, len);
+    p->num_values = len / sizeof(int);
 
     return PARSE_OK;
 }
 
 /*
- * Match single predicate
+ * Match comparision of a column
  * CFG:
  * Relation.ColumnWhitespaceOperatorWhitespaceNumber
+ * | Relation.ColumnWhitespaceBETWEENWhitespaceNumberWhitespaceANDWhitespaceNumber
+ * | Relation.ColumnWhitespaceINWhitespace(Numbers)
  */
-int parse_fourth_line_predicate(struct_parse_context *c, struct_predicate *p) {
+int parse_fourth_line_comparison(struct_parse_context *c, struct_predicate *p) {
     EXPECT_ALPHABET(c);
 
+    p->rhs = p->rhs_high = 0;
+    p->values = NULL;
+    p->num_values = 0;
+    p->disjuncts = NULL;
+    p->num_disjuncts = 0;
+
     parse_relation_column(c, &p->lhs);
 
     // skip ws Op ws
@@ -706,102 +1044,248 @@ int parse_fourth_line_predicate(struct_parse_context *c, struct_predicate *p) {
     parse_operator(c, &p->op);
     parse_whitespace(c);
 
-    parse_number(c, &p->rhs);
+    switch (p->op) {
+        case BETWEEN:
+            parse_number(c, &p->rhs);
+            parse_whitespace(c);
+            parse_and(c);
+            parse_whitespace(c);
+            parse_number(c, &p->rhs_high);
+            break;
+        case IN:
+            parse_fourth_line_values(c, p);
+            break;
+        default:
+            parse_number(c, &p->rhs);
+            break;
+    }
+
+    return PARSE_OK;
+}
+
+/*
+ * Match OR group, all comparisons must be on the same relation
+ * CFG:
+ * (Comparisons)
+ * Comparisons -> Comparison | ComparisonWhitespaceORWhitespaceComparisons
+ */
+int parse_fourth_line_disjuncts(struct_parse_context *c, struct_predicate *p) {
+    EXPECT(c, '(');
+    c->input++;
+    parse_whitespace(c);
+
+    size_t head = c->top;
+
+    struct_predicate disjunct;
+    parse_fourth_line_comparison(c, &disjunct);
+    *(struct_predicate *) context_push(c, sizeof(struct_predicate)) = disjunct;
+    parse_whitespace(c);
+
+    while (c->input[0] != ')') {
+        ASSERT(0 == strncmp(c->input, "OR", strlen("OR")));
+        c->input += strlen("OR");
+        parse_whitespace(c);
+
+        parse_fourth_line_comparison(c, &disjunct);
+        *(struct_predicate *) context_push(c, sizeof(struct_predicate)) = disjunct;
+        parse_whitespace(c);
+    }
+
+    // skip )
+    c->input++;
+
+    size_t len = c->top - head;
+    const struct_predicate *disjuncts = (struct_predicate *) context_pop(c, len);
+
+    p->op = OR;
+    p->rhs = p->rhs_high = 0;
+    p->values = NULL;
+    p->num_values = 0;
+    p->disjuncts = (struct_predicate *) context_alloc(c, len);
+    memcpy(p->disjuncts, disjuncts, len);
+    p->num_disjuncts = len / sizeof(struct_predicate);
+
+    // OR group is pushed down to a single relation
+    p->lhs = p->disjuncts[0].lhs;
+    for (int i = 0; i < p->num_disjuncts; i++) {
+        ASSERT(p->disjuncts[i].lhs.relation == p->lhs.relation);
+    }
 
     return PARSE_OK;
 }
 
+/*
+ * Match single predicate
+ * CFG:
+ * Comparison | (Comparisons)
+ */
+int parse_fourth_line_predicate(struct_parse_context *c, struct_predicate *p) {
+    if (c->input[0] == '(') {
+        return parse_fourth_line_disjuncts(c, p);
+    }
+
+    return parse_fourth_line_comparison(c, p);
+}
+
 /*
  * Match one or more predicates
  * CFG:
  * Predicate | PredicateWhitespaceANDWhitespacePredicates
  */
 int parse_fourth_line_predicates(struct_parse_context *c, struct_fourth_line *fl) {
-    EXPECT_ALPHABET(c);
+    ASSERT(c->input[0] == '(' || ('A' <= c->input[0] && c->input[0] <= 'Z') || ('a' <= c->input[0] && c->input[0] <= 'z'));
 
-    struct_predicate *p = NULL;
+    // parsed on the C stack, because parsing pushes into context which may move
+    struct_predicate p;
 
     size_t head = c->top;
 
     // first predicate
-    p = (struct_predicate *) malloc(sizeof(struct_predicate));
-    parse_fourth_line_predicate(c, p);
+    parse_fourth_line_predicate(c, &p);
 
     // push into context
-    *(struct_predicate *) context_push(c, sizeof(struct_predicate)) = *p;
-    free(p);
+    *(struct_predicate *) context_push(c, sizeof(struct_predicate)) = p;
 
-    while (c->input[0] == ' ') {
+    // predicates may be followed by GROUP BY
+    while (is_and_ahead(c)) {
         parse_whitespace(c);
         parse_and(c);
         parse_whitespace(c);
 
         // following predicates
-        p = (struct_predicate *) malloc(sizeof(struct_predicate));
-        parse_fourth_line_predicate(c, p);
+        parse_fourth_line_predicate(c, &p);
 
         // push into context
-        *(struct_predicate *) context_push(c, sizeof(struct_predicate)) = *p;
-        free(p);
+        *(struct_predicate *) context_push(c, sizeof(struct_predicate)) = p;
     }
 
     size_t len = c->top - head;
     const struct_predicate *predicates = (struct_predicate *) context_pop(c, len);
 
-    fl->predicates = (struct_predicate *) malloc(len);
+    fl->predicates = (struct_predicate *) context_alloc(c, len);
     memcpy(fl->predicates, predicates, len);
     fl->length = len / sizeof(struct_predicate);
 
+    fl->groups = NULL;
+    fl->num_groups = 0;
+
     return PARSE_OK;
 }
 
 /*
- * Match fourth line of SQL query
+ * Match columns to group by
  * CFG:
- * ANDWhitespacePredicates; | ANDWhitespaces;
+ * GROUPWhitespaceBYWhitespaceColumns
+ * Columns -> Relation.Column | Relation.Column,WhitespaceColumns
  */
-int parse_fourth_line(struct_parse_context *c, struct_fourth_line *v) {
-    // AND or ; (empty)
-    ASSERT(c->input[0] == 'A' || c->input[0] == ';');
-
-    if (c->input[0] == ';') {
-        c->input++;
+int parse_fourth_line_group_by(struct_parse_context *c, struct_fourth_line *fl) {
+    ASSERT(0 == strncmp(c->input, "GROUP", strlen("GROUP")));
+    c->input += strlen("GROUP");
+    parse_whitespace(c);
 
-        v->predicates = NULL;
-        v->length = 0;
-        return PARSE_OK;
-    }
+    ASSERT(0 == strncmp(c->input, "BY", strlen("BY")));
+    c->input += strlen("BY");
+    parse_whitespace(c);
 
-    // AND
-    parse_and(c);
+    size_t head = c->top;
 
-    // whitespace
-    parse_whitespace(c);
+    struct_relation_column rc;
+    parse_relation_column(c, &rc);
+    *(struct_relation_column *) context_push(c, sizeof(struct_relation_column)) = rc;
 
-    // no predicates after AND
-    if (c->input[0] == ';') {
+    while (c->input[0] == ',') {
         c->input++;
-        v->length = 0;
-        v->predicates = NULL;
-        return PARSE_OK;
+        parse_whitespace(c);
+
+        parse_relation_column(c, &rc);
+        *(struct_relation_column *) context_push(c, sizeof(struct_relation_column)) = rc;
     }
 
-    // Predicates
-    int ret = parse_fourth_line_predicates(c, v);
+    size_t len = c->top - head;
+    const struct_relation_column *groups = (struct_relation_column *) context_pop(c, len);
 
-    // parse ';'
-    ASSERT(c->input[0] == ';');
-    c->input++;
+    fl->groups = (struct_relation_column *) context_alloc(c, len);
+    memcpy(fl->groups, groups, len);
+    fl->num_groups = len / sizeof(struct_relation_column);
+
+    return PARSE_OK;
+}
+
+/*
+ * Match fourth line of SQL query
+ * CFG:
+ * ANDWhitespacePredicatesGroupBy; | ANDWhitespacesGroupBy; | GroupBy;
+ * GroupBy -> None | WhitespaceGROUPWhitespaceBYWhitespaceColumns
+ */
+int parse_fourth_line(struct_parse_context *c, struct_fourth_line *v) {
+    // AND, GROUP BY or ; (empty)
+    ASSERT(c->input[0] == 'A' || c->input[0] == 'G' || c->input[0] == ';');
+
+    v->predicates = NULL;
+    v->length = 0;
+    v->groups = NULL;
+    v->num_groups = 0;
+
+    int ret = PARSE_OK;
+
+    if (0 == strncmp(c->input, "AND", strlen("AND"))) {
+        // AND
+        parse_and(c);
+
+        // whitespace
+        parse_whitespace(c);
+
+        // Predicates, unless there is no predicates after AND
+        if (c->input[0] != ';' && 0 != strncmp(c->input, "GROUP ", strlen("GROUP "))) {
+            ret = parse_fourth_line_predicates(c, v);
+            parse_whitespace(c);
+        }
+    }
+
+    if (0 == strncmp(c->input, "GROUP", strlen("GROUP"))) {
+        parse_fourth_line_group_by(c, v);
+        parse_whitespace(c);
+    }
+
+    // parse ';'
+    ASSERT(c->input[0] == ';');
+    c->input++;
 
     return ret;
 }
 
+/*
+ * Match the optional EXPLAIN or EXPLAIN ANALYZE before SELECT
+ * CFG:
+ * None | EXPLAINWhitespace | EXPLAINWhitespaceANALYZEWhitespace
+ */
+int parse_explain(struct_parse_context *c, enum_explain *explain) {
+    *explain = EXPLAIN_NONE;
+
+    if (0 == strncmp(c->input, "EXPLAIN", strlen("EXPLAIN"))) {
+        c->input += strlen("EXPLAIN");
+        *explain = EXPLAIN_PLAN;
+
+        parse_whitespace(c);
+    }
+
+    if (*explain == EXPLAIN_PLAN && 0 == strncmp(c->input, "ANALYZE", strlen("ANALYZE"))) {
+        c->input += strlen("ANALYZE");
+        *explain = EXPLAIN_ANALYZE;
+
+        parse_whitespace(c);
+    }
+
+    return PARSE_OK;
+}
+
 /*
  * Match one SQL query
  * CFG:
- * FirstLine Newline SecondLine Newline ThirdLine Newline FourthLine
+ * Explain FirstLine Newline SecondLine Newline ThirdLine Newline FourthLine
  */
 int parse_query(struct_parse_context *c, struct_query *v) {
+    parse_explain(c, &v->explain);
     parse_first_line(c, &v->first);
     parse_whitespace(c);
     parse_second_line(c, &v->second);
@@ -820,39 +1304,43 @@ int parse_query(struct_parse_context *c, struct_query *v) {
  * Query | QueryNewlinesQueries
  */
 int parse_queries(struct_parse_context *c, struct_queries *queries) {
-    // begin with SELECT
-    EXPECT(c, 'S');
+    // begin with SELECT or EXPLAIN
+    ASSERT(IS_QUERY_START(c->input[0]));
+
+    // every query is allocated from the arena of queries, and freed in one step by free_struct_queries
+    init_struct_arena(&queries->arena);
+    struct_arena *const arena_before = c->arena;
+    c->arena = &queries->arena;
 
-    struct_query *query = NULL;
+    // parsed on the C stack, because parsing pushes into context which may move
+    struct_query query;
 
     size_t head = c->top;
 
-    query = (struct_query *) malloc(sizeof(struct_query));
-    parse_query(c, query);
+    parse_query(c, &query);
 
     // push into context
-    *(struct_query *) context_push(c, sizeof(struct_query)) = *query;
-    free(query);
+    *(struct_query *) context_push(c, sizeof(struct_query)) = query;
 
     // THere are more queries
-    while (c->input[0] == 'S') {
+    while (IS_QUERY_START(c->input[0])) {
         parse_whitespace(c);
 
-        query = (struct_query *) malloc(sizeof(struct_query));
-        parse_query(c, query);
+        parse_query(c, &query);
 
         // push into context
-        *(struct_query *) context_push(c, sizeof(struct_query)) = *query;
-        free(query);
+        *(struct_query *) context_push(c, sizeof(struct_query)) = query;
     }
 
     size_t len = c->top - head;
     const struct_query *tmp_queries = (struct_query *) context_pop(c, len);
 
-    queries->queries = (struct_query *) malloc(len);
+    queries->queries = (struct_query *) context_alloc(c, len);
     memcpy(queries->queries, tmp_queries, len);
     queries->length = len / sizeof(struct_query);
 
+    c->arena = arena_before;
+
     return PARSE_OK;
 }
 
@@ -1032,10 +1520,25 @@ $$    $$/ $$    $$ |  $$  $$/ $$    $$ |$$ |$$    $$/ $$    $$ |
                                                        $$$$$$/
  */
 
+// number of equal width buckets in the histogram of each column
+#ifndef NUM_BUCKETS_HISTOGRAM
+#define NUM_BUCKETS_HISTOGRAM 32
+#endif
+
+// number of registers of the HyperLogLog sketch that estimates distinct numbers of a column, as bits
+#ifndef HYPERLOGLOG_BITS
+#define HYPERLOGLOG_BITS 10
+#endif
+
 typedef struct {
     int min;
     int max;
+
+    // estimated number of distinct numbers
     int unique;
+
+    // number of rows in each of NUM_BUCKETS_HISTOGRAM equal width buckets over [min, max]
+    int histogram[NUM_BUCKETS_HISTOGRAM];
 } struct_meta_column;
 
 /*
@@ -1104,6 +1607,19 @@ typedef struct {
     int *columns;
 } struct_column;
 
+/**
+ * Uniform sample of the rows of a relation, kept in memory to estimate on, see pick_sample_rows
+ */
+typedef struct {
+    int num_row;
+
+    // rows of the relation in the sample, ascending
+    int *rows;
+
+    // numbers of the rows, one column after another: numbers[column * num_row + i] is of rows[i]
+    int *numbers;
+} struct_sample;
+
 /**
  * A struct that describe a relation
  */
@@ -1121,6 +1637,8 @@ typedef struct {
      */
     struct_meta_column *meta;
 
+    struct_sample sample;
+
     // number of column and rows in the relation
     int num_col;
     int num_row;
@@ -1130,6 +1648,12 @@ typedef struct {
      * @nullable: if there is no predicate on this relation, or after filter, the relation is empty, then df will be NULL
      */
     struct_data_frame *df;
+
+    /**
+     * Per query arena that df is allocated from, owned by struct_files
+     * @nullable: df is allocated by malloc if NULL
+     */
+    struct_arena *arena;
 } struct_file;
 
 typedef struct {
@@ -1139,6 +1663,9 @@ typedef struct {
     struct_file *files;
     // length / number of relations
     size_t length;
+
+    // memory that only lives during one query, released by free_only_struct_data_frames
+    struct_arena arena;
 } struct_files;
 
 /*
@@ -1154,18 +1681,36 @@ typedef struct {
 // Init & Free //
 /////////////////
 
-void init_struct_data_frame_for_file(struct_file *file) {
-    file->df = (struct_data_frame *) malloc(sizeof(struct_data_frame));
+/**
+ * Create the data frame of the relation, with the given rows
+ *
+ * @param file
+ * @param index: @nullable if num_row is 0, from malloc, owned by the data frame from now on
+ * @param num_row
+ */
+void init_struct_data_frame_for_file_given_index(struct_file *file, int *index, int num_row) {
+    file->df = (struct_data_frame *) arena_or_malloc(file->arena, sizeof(struct_data_frame));
 
-    file->df->relations = (char *) malloc(2 * sizeof(char));
+    file->df->relations = (char *) arena_or_malloc(file->arena, 2 * sizeof(char));
     file->df->relations[0] = file->relation;
     file->df->relations[1] = '\0';
 
-    // init index with index[i] = i where i = 0...number of rows
-    // size = number of rows
-    file->df->index = (int *) malloc(file->num_row * sizeof(int));
-    file->df->num_row = file->num_row;
+    file->df->index = index;
+    file->df->num_row = num_row;
+}
+
+/**
+ * Create the data frame of the relation, with room for every row in its index, which is left for the caller to fill
+ */
+void init_struct_data_frame_for_file_unfilled(struct_file *file) {
+    // size = number of rows, not from arena because it is shrunk by realloc after filter
+    init_struct_data_frame_for_file_given_index(file, (int *) malloc(file->num_row * sizeof(int)), file->num_row);
+}
 
+void init_struct_data_frame_for_file(struct_file *file) {
+    init_struct_data_frame_for_file_unfilled(file);
+
+    // init index with index[i] = i where i = 0...number of rows
     for (int i = 0; i < file->df->num_row; i++) {
         file->df->index[i] = i;
     }
@@ -1204,12 +1749,31 @@ void free_struct_data_frame(struct_data_frame *df) {
     df->num_row = 0;
 }
 
+/**
+ * Free df of file, which is allocated by init_struct_data_frame_for_file
+ */
+void free_struct_data_frame_of_file(struct_file *file) {
+    if (file->df == NULL) {
+        return;
+    }
+
+    free(file->df->index);
+
+    if (file->arena == NULL) {
+        free(file->df->relations);
+        free(file->df);
+    }
+
+    file->df = NULL;
+}
+
 void free_only_struct_data_frames(struct_files *files) {
     for (int i = 0; i < files->length; i++) {
-        free_struct_data_frame(files->files[i].df);
-        free(files->files[i].df);
-        files->files[i].df = NULL;
+        free_struct_data_frame_of_file(&files->files[i]);
     }
+
+    // everything else of this query
+    reset_struct_arena(&files->arena);
 }
 
 void init_struct_column(struct_column *file) {
@@ -1225,38 +1789,70 @@ void free_struct_column(struct_column *file) {
     file->column = EMPTY;
 }
 
+void init_struct_sample(struct_sample *sample) {
+    sample->num_row = 0;
+    sample->rows = NULL;
+    sample->numbers = NULL;
+}
+
+void free_struct_sample(struct_sample *sample) {
+    free(sample->rows);
+    free(sample->numbers);
+    init_struct_sample(sample);
+}
+
 void init_struct_file(struct_file *file) {
     file->relation = '\0';
     file->num_col = 0;
     file->num_row = 0;
     file->df = NULL;
+    file->arena = NULL;
 
     init_struct_column(&file->column);
     file->meta = NULL;
+    init_struct_sample(&file->sample);
 }
 
+// see Plan caching
+void forget_plans(const char relation);
+
+// see Row set cache
+void forget_row_sets(const char relation);
+
+// see Join result cache
+void forget_join_results(const char relation);
+
+// see Feedback
+void forget_feedback(const char relation);
+
 void free_struct_file(struct_file *file) {
+    // plans and rows cached are of the data of this file
+    if (file->relation != '\0') {
+        forget_plans(file->relation);
+        forget_row_sets(file->relation);
+        forget_join_results(file->relation);
+        forget_feedback(file->relation);
+    }
     file->relation = '\0';
 
     file->num_col = 0;
     file->num_row = 0;
 
-    if (file->df != NULL) {
-        free_struct_data_frame(file->df);
-        free(file->df);
-        file->df = NULL;
-    }
+    free_struct_data_frame_of_file(file);
 
     free_struct_column(&file->column);
     free(file->meta);
+    free_struct_sample(&file->sample);
 }
 
 void init_struct_files(struct_files *files, int length) {
     files->files = (struct_file *) malloc(length * sizeof(struct_file));
     files->length = length;
+    init_struct_arena(&files->arena);
 
     for (int i = 0; i < length; i++) {
         init_struct_file(&files->files[i]);
+        files->files[i].arena = &files->arena;
     }
 }
 
@@ -1265,6 +1861,7 @@ void free_struct_files(struct_files *files) {
         free_struct_file(&files->files[i]);
     }
 
+    free_struct_arena(&files->arena);
     free(files->files);
     files->length = 0;
 }
@@ -1335,16 +1932,12 @@ void fwrite_buffered_flush(struct_fwrite_buffer *manual_buffer, FILE *stream) {
     manual_buffer->cur_size = 0;
 }
 
-const int *const select_column_from_file(struct_file *const file, const int column) {
-    // buffer hit
-    if (file->column.column == column) {
-        return file->column.columns;
-    }
-
-    assert(file->column.columns != NULL);
-
-    file->column.column = column;
-
+/**
+ * Read an entire column of the relation from disk
+ *
+ * @param columns: where to store the column, should have room for file->num_row numbers
+ */
+void read_column_from_file(const struct_file *const file, const int column, int *const columns) {
     char path_file[LENGTH_FILE_NAME] = {'\0'};
     get_name_file_column(file->relation, column, path_file);
 
@@ -1353,10 +1946,36 @@ const int *const select_column_from_file(struct_file *const file, const int colu
     size_t file_size = ftell(file_column);
     fseek(file_column, 0, SEEK_SET);
 
-    size_t size_read = fread(file->column.columns, 1, file_size, file_column);
+    size_t size_read = fread(columns, 1, file_size, file_column);
     assert(size_read == file_size);
+    count_bytes_read += size_read;
 
     fclose(file_column);
+}
+
+/**
+ * Read an entire column into the buffer of the file
+ * The returned column is only valid until another column of the same file is selected
+ */
+const int *const select_column_from_file(struct_file *const file, const int column) {
+#ifdef DEBUG_PROFILING
+    count_buffer_total_query++;
+    count_buffer_total++;
+#endif
+    // buffer hit
+    if (file->column.column == column) {
+#ifdef DEBUG_PROFILING
+        count_buffer_hit_query++;
+        count_buffer_hit_total++;
+#endif
+        return file->column.columns;
+    }
+
+    assert(file->column.columns != NULL);
+
+    file->column.column = column;
+
+    read_column_from_file(file, column, file->column.columns);
     return file->column.columns;
 }
 
@@ -1381,6 +2000,111 @@ int get_num_col(const char *const buffer, size_t size) {
     return count + 1;
 }
 
+/**
+ * Bucket of number in the histogram of the column
+ */
+static inline int bucket_of_histogram(const struct_meta_column *const meta, const int number) {
+    return (int) (((int64_t) number - meta->min) * NUM_BUCKETS_HISTOGRAM / ((int64_t) meta->max - meta->min + 1));
+}
+
+// one row out of this many is in the sample of a relation
+#ifndef SAMPLE_ONE_IN
+#define SAMPLE_ONE_IN 100
+#endif
+
+// a relation with no more rows than this is sampled whole, and a larger one has at least this many rows in its sample
+#ifndef SAMPLE_MIN_ROWS
+#define SAMPLE_MIN_ROWS 512
+#endif
+
+/**
+ * Pick the rows of the sample of the relation, its numbers are filled by compute_meta_column
+ *
+ * Each row is in the sample by a hash of its number, so the sample is uniform and the same on every load.
+ * One row out of SAMPLE_ONE_IN is picked, or more for a relation of fewer than SAMPLE_ONE_IN * SAMPLE_MIN_ROWS rows
+ */
+void pick_sample_rows(struct_file *const file) {
+    struct_sample *const sample = &file->sample;
+    free_struct_sample(sample);
+
+    // picked if the hash of the row is below it, out of 2^32
+    const double fraction = std::min(1.0, std::max(1.0 / SAMPLE_ONE_IN,
+                                                   (double) SAMPLE_MIN_ROWS / std::max(file->num_row, 1)));
+    const uint64_t threshold = (uint64_t) (fraction * 4294967296.0);
+
+    std::vector<int> rows;
+    for (int row = 0; row < file->num_row; row++) {
+        if (((uint64_t) (uint32_t) row * 0x9E3779B97F4A7C15ull) >> 32 < threshold) {
+            rows.push_back(row);
+        }
+    }
+
+    sample->num_row = rows.size();
+    sample->rows = (int *) malloc(std::max(sample->num_row, 1) * sizeof(int));
+    std::copy(rows.begin(), rows.end(), sample->rows);
+    sample->numbers = (int *) malloc(std::max(sample->num_row * file->num_col, 1) * sizeof(int));
+}
+
+/**
+ * Fill the histogram and the number of distinct numbers of a column, once its min and max are known,
+ * and the numbers of the column in the sample, see pick_sample_rows
+ *
+ * Distinct numbers are estimated with a HyperLogLog sketch, in one pass and constant memory
+ */
+void compute_meta_column(struct_file *const file, const int column) {
+    struct_meta_column *const meta = &file->meta[column];
+    memset(meta->histogram, 0, sizeof(meta->histogram));
+    meta->unique = 1;
+
+    if (file->num_row == 0) {
+        return;
+    }
+
+    const int num_registers = 1 << HYPERLOGLOG_BITS;
+    uint8_t registers[1 << HYPERLOGLOG_BITS] = {0};
+
+    const int *const numbers = select_column_from_file(file, column);
+
+    struct_sample *const sample = &file->sample;
+    for (int i = 0; i < sample->num_row; i++) {
+        sample->numbers[column * sample->num_row + i] = numbers[sample->rows[i]];
+    }
+
+    for (int i = 0; i < file->num_row; i++) {
+        meta->histogram[bucket_of_histogram(meta, numbers[i])]++;
+
+        // hash, see hash_group_key
+        uint64_t hash = (0x9E3779B97F4A7C15ull ^ (uint32_t) numbers[i]) * 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 32;
+        hash *= 0xC4CEB9FE1A85EC53ull;
+        hash ^= hash >> 29;
+
+        // first bits pick the register, it keeps the longest run of leading zeros of the rest
+        const int index = (int) (hash >> (64 - HYPERLOGLOG_BITS));
+        const uint64_t rest = (hash << HYPERLOGLOG_BITS) | ((uint64_t) 1 << (HYPERLOGLOG_BITS - 1));
+        const uint8_t rank = (uint8_t) (__builtin_clzll(rest) + 1);
+
+        registers[index] = std::max(registers[index], rank);
+    }
+
+    double sum = 0;
+    int num_zeros = 0;
+    for (int i = 0; i < num_registers; i++) {
+        sum += ldexp(1.0, -registers[i]);
+        num_zeros += registers[i] == 0;
+    }
+
+    double estimate = 0.7213 / (1 + 1.079 / num_registers) * num_registers * num_registers / sum;
+
+    // small range correction
+    if (estimate <= 2.5 * num_registers && num_zeros != 0) {
+        estimate = num_registers * log((double) num_registers / num_zeros);
+    }
+
+    const double max_unique = std::min((double) file->num_row, (double) meta->max - meta->min + 1);
+    meta->unique = (int) std::max(1.0, std::min(round(estimate), max_unique));
+}
+
 /**
  * Read csv file from disk and convert them into a more efficient format, then write back to disk
  *
@@ -1388,7 +2112,7 @@ int get_num_col(const char *const buffer, size_t size) {
  * Read contents from csv file, convert string of number into signed 32 bit representation and write (x.binary) back to disk
  *
  * Also, gather metadata about each file:
- * For each column: min value, max value, number of unique value
+ * For each column: min value, max value, number of unique value, and a histogram
  *
  * @param relation: name of the relation
  * @param file: path to the file on the disk
@@ -1529,9 +2253,6 @@ void load_csv_file(char relation, char *path_file_csv, struct_file *loaded_file)
     for (int i = 0; i < num_col; i++) {
         // write whats left inside output buffer to file
         fwrite_buffered_flush(&fwrite_buffers[i], files_column[i]);
-
-        // calculate unique number for each column
-        meta[i].unique = num_row < meta[i].max - meta[i].min ? num_row : meta[i].max - meta[i].min;
     }
 
     loaded_file->relation = relation;
@@ -1553,6 +2274,12 @@ void load_csv_file(char relation, char *path_file_csv, struct_file *loaded_file)
     free(fwrite_buffers);
 
     free(buffer);
+
+    // histogram, distinct numbers and the sample, now that min and max are known
+    pick_sample_rows(loaded_file);
+    for (int i = 0; i < num_col; i++) {
+        compute_meta_column(loaded_file, i);
+    }
 }
 
 /**
@@ -1586,6 +2313,16 @@ $$    $$/ $$    $$/   $$  $$/ $$ |$$ | $$ | $$ |$$ |/$$      |$$       |$$ |
           $$/
  */
 
+int findIndexOf(const char *const input, int length, char val) {
+    for (int i = 0; i < length; i++) {
+        if (input[i] == val) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
 const std::string vector_to_string(const std::vector<char> &v) {
     std::stringstream ss;
     for (const auto &each: v) {
@@ -1607,833 +2344,5210 @@ const std::string vector_to_string_sorted(const std::vector<char> &origin) {
     return ss.str();
 }
 
-#define INF_COST ((float)INT32_MAX + 1)
+// costs of large joins easily go beyond INT32_MAX, so only infinity means impossible
+#define INF_COST INFINITY
+
+/**
+ * A join plan in postfix: a relation pushes its rows, ORDER_JOIN joins the two plans on top.
+ *
+ * Left deep ((A join B) join C) => "AB*C*", bushy (A join B) join (C join D) => "AB*CD**"
+ */
 typedef std::vector<char> Order;
 
+#define ORDER_JOIN '*'
+
+/**
+ * Set of relations of a query, bit i is the i-th relation in FROM
+ */
+typedef uint32_t RelationSet;
+
 class BestPlan {
 public:
-    Order order;
     float cost;
 
+    // estimated number of rows after joining all relations of the plan
+    float cardinality;
+
+    // relations on the left side of the last join, the rest are on the right side. 0 for a single relation
+    RelationSet left;
+
     BestPlan() {
         cost = INF_COST;
+        cardinality = 0;
+        left = 0;
     }
 };
 
-typedef std::unordered_map<std::string, BestPlan> Best;
+/**
+ * Best plan of each connected set of relations, index is the RelationSet
+ */
+typedef std::vector<BestPlan> Best;
+
+/**
+ * Join graph of a query, relations are numbered by their position in FROM
+ *
+ * A node may also be several relations already joined together, see init_join_graph_of_units,
+ * it is named by its first relation
+ */
+class JoinGraph {
+public:
+    std::vector<char> relations;
+
+    // number of rows of each relation
+    std::vector<float> cardinalities;
 
-float cost_join(int i,
-                struct_files *const files,
-                struct_query *const query) {
+    // relations that share a join clause with each relation
+    std::vector<RelationSet> neighbors;
 
-    auto &clause = query->third.joins[i];
-    auto &file_A = files->files[clause.lhs.relation - 'A'];
-    auto &file_B = files->files[clause.rhs.relation - 'A'];
+    // the two relations of each join clause, and its selectivity
+    std::vector<RelationSet> clauses;
+    std::vector<float> selectivities;
 
-    int card_A = file_A.df == NULL ? file_A.num_row : file_A.df->num_row;
-    int card_B = file_B.df == NULL ? file_B.num_row : file_B.df->num_row;
-    int uni_A = file_A.meta[clause.lhs.column].unique;
-    int uni_B = file_B.meta[clause.rhs.column].unique;
+    // the join clause of the query each clause is, and its estimated selectivity before feedback, 0 if it is exact,
+    // see join_feedback_correction
+    std::vector<const struct_join *> joins;
+    std::vector<float> estimates;
+};
 
-    return (float) card_A * card_B * std::min(uni_A, uni_B) / uni_A / uni_B;
+// number of rows left in the relation after select/filter
+int filtered_cardinality(const struct_file *const file) {
+    return file->df != NULL ? file->df->num_row : file->num_row;
 }
 
 /**
- * Compute the cost joining two basic relation
+ * Estimate distinct numbers of a column left after select/filter, if the rows are picked at random
  *
- * 1. find the join clause
- * 2. compute the cost
+ * Each distinct number has num_row / unique rows, it is gone only if none of its rows are picked
  */
-float cost_two_relations(const char r,
-                         const char s,
-                         Best &best,
-                         struct_files *const files,
-                         struct_query *const query) {
-    // 1. find the join clause
-    // i is the index of that join clause we want
-    int i = 0;
-    for (; i < query->third.length; i++) {
-        auto &clause = query->third.joins[i];
+float filtered_unique(const struct_file *const file, const int column) {
+    const float unique = file->meta[column].unique;
+    const float num_row = std::max(file->num_row, 1);
+    const float fraction_left = filtered_cardinality(file) / num_row;
 
-        if ((clause.lhs.relation == r && clause.rhs.relation == s)
-            || (clause.lhs.relation == s && clause.rhs.relation == r)) {
-            break;
-        }
-    }
+    return std::max(unique * (1 - powf(1 - fraction_left, num_row / unique)), 1.0f);
+}
+
+/**
+ * Fraction of rows of the column whose numbers are in [low, high), from its histogram.
+ * Numbers are assumed uniform inside each bucket
+ */
+float fraction_in_range(const struct_meta_column *const meta, const float low, const float high) {
+    const float width_bucket = ((float) meta->max - meta->min + 1) / NUM_BUCKETS_HISTOGRAM;
+
+    float count = 0, total = 0;
+    for (int k = 0; k < NUM_BUCKETS_HISTOGRAM; k++) {
+        const float begin = meta->min + k * width_bucket;
+        const float overlap = std::min(high, begin + width_bucket) - std::max(low, begin);
 
-    if (i == query->third.length) {
-        // not possible to join
-        return INF_COST;
+        total += meta->histogram[k];
+        if (overlap > 0) {
+            count += meta->histogram[k] * overlap / width_bucket;
+        }
     }
 
-    // 2. compute the cost
-    return cost_join(i, files, query);
+    return total == 0 ? 0 : count / total;
 }
 
 /**
- * Compute the cost of [r] + prev and prev + [r], pick the least cost, and assign it to plan
+ * Estimate the fraction of pairs (a, b) with a < b, from histograms of the two columns
  *
- * @param prev_order: a join order we already have
- * @param r: new relation to add to prev join order
- * @param new_order: the result (new join order) we want to generate
- * @return
+ * For each bucket of b, its rows are compared with the middle of the bucket
  */
-float cost_general(const Order &prev_order,
-                   const char r,
-                   Order &new_order,
-                   Best &best,
-                   struct_files *const files,
-                   struct_query *const query) {
-    new_order.clear();
-
-    // join two naive relations
-    if (prev_order.size() == 1) {
-        auto cost = cost_two_relations(prev_order[0], r, best, files, query);
+float fraction_less_than(const struct_meta_column *const a, const struct_meta_column *const b) {
+    const float width_bucket = ((float) b->max - b->min + 1) / NUM_BUCKETS_HISTOGRAM;
 
-        // if cost is not inf
-        if (cost < (INF_COST + 1)) {
-            new_order.push_back(prev_order[0]);
-            new_order.push_back(r);
-        }
+    float sum = 0, total = 0;
+    for (int k = 0; k < NUM_BUCKETS_HISTOGRAM; k++) {
+        const float middle = b->min + (k + 0.5f) * width_bucket;
 
-        return cost;
+        sum += b->histogram[k] * fraction_in_range(a, -INF_COST, middle);
+        total += b->histogram[k];
     }
 
-    ///////////////////////////////
-    // check if join is possible //
-    ///////////////////////////////
-    std::unordered_set<char> set_prev(prev_order.begin(), prev_order.end());
-    int i;
+    return total == 0 ? 0 : sum / total;
+}
+
+/**
+ * Estimate the fraction of pairs (a, b) with a = b
+ *
+ * Histogram of a is walked bucket by bucket: within the range of a bucket, rows of a and b that fall in it
+ * join with each other through the distinct numbers of the side that has more of them (containment).
+ * Distinct numbers of each side are spread over its range, after filter, see filtered_meta_column.
+ */
+float fraction_equal(const struct_meta_column *const a, const struct_meta_column *const b) {
+    const float unique_a = a->unique;
+    const float unique_b = b->unique;
+    const float width_a = (float) a->max - a->min + 1;
+    const float width_b = (float) b->max - b->min + 1;
+    const float width_bucket = width_a / NUM_BUCKETS_HISTOGRAM;
+
+    float total_a = 0;
+    for (int k = 0; k < NUM_BUCKETS_HISTOGRAM; k++) {
+        total_a += a->histogram[k];
+    }
 
-    // there should be at least one join clause where contains r and the other side is in prev
-    const auto &third = query->third;
-    for (i = 0; i < third.length; i++) {
-        const auto &clause = third.joins[i];
+    if (total_a == 0) {
+        return 0;
+    }
 
-        // this clause has nothing to do with r
-        if (!(clause.lhs.relation == r || clause.rhs.relation == r)) {
+    float fraction = 0;
+    for (int k = 0; k < NUM_BUCKETS_HISTOGRAM; k++) {
+        if (a->histogram[k] == 0) {
             continue;
         }
 
-        // the other relation to search
-        char other_re = clause.lhs.relation == r ? clause.rhs.relation : clause.lhs.relation;
+        const float low = a->min + k * width_bucket;
+        const float high = low + width_bucket;
 
-        if (set_prev.find(other_re) != set_prev.end()) {
-            // we found the clause
-            break;
+        const float fraction_a = a->histogram[k] / total_a;
+        const float fraction_b = fraction_in_range(b, low, high);
+        if (fraction_b == 0) {
+            continue;
         }
-    }
-
-    // we didnt find the clause, so it's impossible to join
-    if (i == third.length) {
-        return INF_COST;
-    }
-
-    // now calculate the cost of [r] + prev and prev + [r]
-    const auto &clause = third.joins[i];
-
-    // we find out which two column to join
-    const auto &rc_r = clause.lhs.relation == r ? clause.lhs : clause.rhs;
-    const auto &rc_prev = clause.lhs.relation != r ? clause.lhs : clause.rhs;
-    const auto &file_r = files->files[rc_r.relation - 'A'];
-    const auto &file_prev = files->files[rc_prev.relation - 'A'];
 
-    // find out cost for prev best join
-    auto key_prev = vector_to_string_sorted(prev_order);
-    auto plan_prev = best[key_prev];
+        const float overlap_b = std::max(std::min(high, (float) b->max + 1) - std::max(low, (float) b->min), 0.0f);
+        const float unique_bucket_a = std::max(unique_a * width_bucket / width_a, 1.0f);
+        const float unique_bucket_b = std::max(unique_b * overlap_b / width_b, 1.0f);
 
-    // previous plan should be valid
-    ASSERT(plan_prev.cost < (INF_COST - 1));
+        fraction += fraction_a * fraction_b / std::max(unique_bucket_a, unique_bucket_b);
+    }
 
-    // cost of r
-    auto cost_r = file_r.df != NULL ? file_r.df->num_row : file_r.num_row;
+    return fraction;
+}
 
-    // todo:
-    auto cost_new = plan_prev.cost + cost_r; // + cost_join(i, files, query);
+//////////////
+// Sampling //
+//////////////
 
-    // add plan to new_order
-    new_order.insert(new_order.end(), prev_order.begin(), prev_order.end());
-    new_order.push_back(r);
+// fewest rows of a sample, or pairs of rows of two samples, that an estimate is drawn from
+#ifndef SAMPLE_MIN_ROWS_ESTIMATE
+#define SAMPLE_MIN_ROWS_ESTIMATE 64
+#endif
 
-    return cost_new;
+// number of row i of the sample of the relation, in the column
+static inline int number_of_sample(const struct_file *const file, const int column, const int i) {
+    return file->sample.numbers[column * file->sample.num_row + i];
 }
 
 /**
- * Compute the best join order of relations rels
+ * Positions in the sample of the rows left in the relation after select/filter
  *
- * @param rels: sorted relations among which we want to optimize their joins
- * @param best: a mapping stores current best join orders for each key
- * @param joins
- * @return
+ * @param file
+ * @param positions: the result, ascending
+ * @return if the rows left are known, they are not while estimating with only the number of them
  */
-BestPlan &compute_best(const std::vector<char> &rels,
-                       Best &best,
-                       struct_files *const files,
-                       struct_query *const query) {
-    auto str_rels = vector_to_string_sorted(rels);
+bool filtered_sample(const struct_file *const file, std::vector<int> &positions) {
+    positions.clear();
 
-    // if best[rels] already computed
-    if (best.find(str_rels) != best.end()) {
-        return best[str_rels];
+    const struct_data_frame *const df = file->df;
+    if (df != NULL && df->index == NULL && df->num_row != 0) {
+        return false;
     }
 
-    // only 1 relation
-    if (rels.size() == 1) {
-        char rel = rels[0];
-
-        best[str_rels] = BestPlan();
-        auto &plan = best[str_rels];
-
-        plan.order.push_back(rel);
-
-        auto &file = files->files[rel - 'A'];
-        plan.cost = file.df != NULL ? file.df->num_row : file.num_row;
-
-        return best[str_rels];
+    const struct_sample *const sample = &file->sample;
+    if (df == NULL) {
+        for (int i = 0; i < sample->num_row; i++) {
+            positions.push_back(i);
+        }
+        return true;
     }
 
-    // for each sub-set of rels, compute its cost
-    std::vector<char> new_order;
-    // check orders without r
-    for (int i = 0; i < rels.size(); i++) {
-        auto rels_minus_r = rels;
-        rels_minus_r.erase(rels_minus_r.begin() + i);
-
-        auto internal_order = compute_best(rels_minus_r, best, files, query);
-
-        if (internal_order.order.empty() || internal_order.cost >= (INF_COST - 1)) {
-            continue;
+    // the index of a relation is ascending, as the rows of the sample are, so each row of the smaller is searched
+    // in the other after the row found before it, with steps that double
+    const bool is_index_smaller = df->num_row < sample->num_row;
+    const int *const small = is_index_smaller ? df->index : sample->rows;
+    const int *const large = is_index_smaller ? sample->rows : df->index;
+    const int num_small = is_index_smaller ? df->num_row : sample->num_row;
+    const int num_large = is_index_smaller ? sample->num_row : df->num_row;
+
+    int low = 0;
+    for (int j = 0; j < num_small && low < num_large; j++) {
+        int step = 1;
+        while (low + step < num_large && large[low + step] < small[j]) {
+            step *= 2;
         }
 
-        // get the cost join r + internal_order and internal_order + r
-        auto cost = cost_general(internal_order.order, rels[i], new_order, best, files, query);
-
-        if (cost < best[str_rels].cost) {
-            best[str_rels].cost = cost;
-            best[str_rels].order = new_order;
+        low = std::lower_bound(large + low, large + std::min(low + step + 1, num_large), small[j]) - large;
+        if (low < num_large && large[low] == small[j]) {
+            positions.push_back(is_index_smaller ? low : j);
         }
     }
 
-    return best[str_rels];
+    return true;
 }
 
-bool join_clause_contains(struct_join *join, char r, char s) {
-    return ((join->lhs.relation == r && join->rhs.relation == s)
-            || (join->lhs.relation == s && join->rhs.relation == r));
+// if row i of the sample of the relation meets the predicate
+bool sample_satisfies(const struct_file *const file, const struct_predicate &predicate, const int i) {
+    if (predicate.op == OR) {
+        for (int k = 0; k < predicate.num_disjuncts; k++) {
+            if (sample_satisfies(file, predicate.disjuncts[k], i)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const int number = number_of_sample(file, predicate.lhs.column, i);
+    switch (predicate.op) {
+        case LESS_THAN:
+            return number < predicate.rhs;
+        case GREATER_THAN:
+            return number > predicate.rhs;
+        case BETWEEN:
+            return predicate.rhs <= number && number <= predicate.rhs_high;
+        case IN:
+            return std::find(predicate.values, predicate.values + predicate.num_values, number)
+                   != predicate.values + predicate.num_values;
+        default:
+            return number == predicate.rhs;
+    }
 }
 
 /**
- * Reorder struct_join to optimize the joining process
+ * Join the rows of the samples of the two relations on the join clause, and count the pairs
  *
- * Selinger’s algorithm
+ * The numbers of the smaller side are sorted, and each number of the other side is a binary search in them
  *
- * @param files
+ * @param clause
+ * @param sample_A: positions in the sample of the lhs relation, see filtered_sample
+ * @param sample_B: positions in the sample of the rhs relation
+ */
+long count_sample_join(const struct_join &clause, struct_files *const files,
+                       const std::vector<int> &sample_A, const std::vector<int> &sample_B) {
+    const auto *const file_A = &files->files[clause.lhs.relation - 'A'];
+    const auto *const file_B = &files->files[clause.rhs.relation - 'A'];
+
+    // sorted side is B, so A < B becomes B > A when the sides are swapped
+    const bool is_swapped = sample_A.size() < sample_B.size();
+    const auto *const file_sorted = is_swapped ? file_A : file_B;
+    const auto *const file_probe = is_swapped ? file_B : file_A;
+    const int column_sorted = is_swapped ? clause.lhs.column : clause.rhs.column;
+    const int column_probe = is_swapped ? clause.rhs.column : clause.lhs.column;
+
+    enum_operator op = clause.op;
+    if (is_swapped && op != EQUAL) {
+        op = op == LESS_THAN ? GREATER_THAN : LESS_THAN;
+    }
+
+    std::vector<int> numbers;
+    for (const int i: is_swapped ? sample_A : sample_B) {
+        numbers.push_back(number_of_sample(file_sorted, column_sorted, i));
+    }
+    std::sort(numbers.begin(), numbers.end());
+
+    long count = 0;
+    for (const int i: is_swapped ? sample_B : sample_A) {
+        const int number = number_of_sample(file_probe, column_probe, i);
+
+        switch (op) {
+            case LESS_THAN:
+                count += numbers.end() - std::upper_bound(numbers.begin(), numbers.end(), number);
+                break;
+            case GREATER_THAN:
+                count += std::lower_bound(numbers.begin(), numbers.end(), number) - numbers.begin();
+                break;
+            default: {
+                const auto range = std::equal_range(numbers.begin(), numbers.end(), number);
+                count += range.second - range.first;
+            }
+        }
+    }
+
+    return count;
+}
+
+/**
+ * Metadata of the column over the rows left in the relation after select/filter: its distinct numbers,
+ * see filtered_unique, and its histogram from the rows of the sample left, if there are enough of them.
+ * So a predicate on another column that is correlated with this one is seen in its histogram
+ *
+ * @param file
+ * @param column
+ * @param sample: positions in the sample of the rows left, see filtered_sample
+ * @param meta: the result
+ */
+void filtered_meta_column(const struct_file *const file, const int column, const std::vector<int> &sample,
+                          struct_meta_column *const meta) {
+    *meta = file->meta[column];
+    meta->unique = (int) filtered_unique(file, column);
+
+    if (sample.size() >= SAMPLE_MIN_ROWS_ESTIMATE) {
+        memset(meta->histogram, 0, sizeof(meta->histogram));
+        for (const int i: sample) {
+            meta->histogram[bucket_of_histogram(meta, number_of_sample(file, column, i))]++;
+        }
+    }
+}
+
+/**
+ * Estimate the fraction of pairs of rows from the two relations that satisfy the join clause
+ *
+ * The rows left of the samples of the two relations are joined: their fraction of pairs that join is the estimate,
+ * if enough pairs join, or if the samples have every row. Otherwise it is estimated from the histograms of the rows
+ * left, see filtered_meta_column
+ *
+ * @param clause
+ * @param files
+ * @param sample_A: positions in the sample of the rows left in the lhs relation, see filtered_sample
+ * @param sample_B: of the rhs relation
+ * @param is_known: if the rows left of both relations are known
+ * @param is_exact: @nullable, set if the samples have every row, so the estimate is exact
+ */
+float join_selectivity_given_samples(const struct_join &clause, struct_files *const files,
+                                     const std::vector<int> &sample_A, const std::vector<int> &sample_B,
+                                     const bool is_known, bool *const is_exact) {
+    const auto *const file_A = &files->files[clause.lhs.relation - 'A'];
+    const auto *const file_B = &files->files[clause.rhs.relation - 'A'];
+
+    if (is_exact != NULL) {
+        *is_exact = false;
+    }
+
+    if (is_known && !sample_A.empty() && !sample_B.empty()) {
+        const long count = count_sample_join(clause, files, sample_A, sample_B);
+        const bool is_whole = file_A->sample.num_row == file_A->num_row && file_B->sample.num_row == file_B->num_row;
+
+        if (is_exact != NULL) {
+            *is_exact = is_whole;
+        }
+        if (is_whole || count >= SAMPLE_MIN_ROWS_ESTIMATE) {
+            return count / ((float) sample_A.size() * sample_B.size());
+        }
+    }
+
+    struct_meta_column meta_A, meta_B;
+    filtered_meta_column(file_A, clause.lhs.column, sample_A, &meta_A);
+    filtered_meta_column(file_B, clause.rhs.column, sample_B, &meta_B);
+
+    switch (clause.op) {
+        case LESS_THAN:
+            return fraction_less_than(&meta_A, &meta_B);
+        case GREATER_THAN:
+            return fraction_less_than(&meta_B, &meta_A);
+        default:
+            return fraction_equal(&meta_A, &meta_B);
+    }
+}
+
+// see join_selectivity_given_samples
+float join_selectivity(const struct_join &clause, struct_files *const files) {
+    std::vector<int> sample_A, sample_B;
+    const bool is_known = filtered_sample(&files->files[clause.lhs.relation - 'A'], sample_A)
+                          & filtered_sample(&files->files[clause.rhs.relation - 'A'], sample_B);
+
+    return join_selectivity_given_samples(clause, files, sample_A, sample_B, is_known, NULL);
+}
+
+//////////////
+// Feedback //
+//////////////
+
+// fewest rows a kind of predicate is checked on before its observed selectivity is used, see predicate_selectivity
+#ifndef FEEDBACK_MIN_ROWS
+#define FEEDBACK_MIN_ROWS 1024
+#endif
+
+// estimates of a join clause are corrected by at most this factor, either way, see join_feedback_correction
+#ifndef FEEDBACK_MAX_CORRECTION
+#define FEEDBACK_MAX_CORRECTION 100.0f
+#endif
+
+/**
+ * Rows of a relation checked by predicates of one kind, and rows they kept, see predicate_feedback_key
+ */
+class PredicateFeedback {
+public:
+    long rows_in;
+    long rows_out;
+};
+
+/**
+ * How far off the estimates of a join clause were, over the joins done on the clause alone
+ */
+class JoinFeedback {
+public:
+    // of log(observed / estimated selectivity)
+    double sum_log_ratio;
+    int count;
+};
+
+/**
+ * Selectivities observed while executing queries, kept across queries and batches,
+ * so the estimates of later queries learn from them. A relation drops them when its data is freed
+ *
+ * key: relation - 'A', then see predicate_feedback_key
+ */
+static std::unordered_map<std::string, PredicateFeedback> predicate_feedback[26];
+
+// key: normalized join clause, see normalize_join_clause
+static std::unordered_map<std::string, JoinFeedback> join_feedback;
+
+// see Plan caching
+static const std::string normalize_join_clause(const struct_join &join);
+
+/**
+ * Kind of a predicate: its column, its operator, and the bucket of the histogram of each of its numbers.
+ * Numbers in the same bucket keep about as many rows. IN and OR have no kind
+ *
+ * A.c3 < 7 => "3,1,12" if 7 is in bucket 12 of A.c3
+ *
+ * @return empty if the predicate has no kind
+ */
+const std::string predicate_feedback_key(const struct_predicate &predicate, const struct_file *const file) {
+    if (predicate.op == IN || predicate.op == OR) {
+        return "";
+    }
+
+    // numbers below min are bucket -1, above max are bucket NUM_BUCKETS_HISTOGRAM
+    const auto *const meta = &file->meta[predicate.lhs.column];
+    const auto bucket = [meta](const int number) {
+        return number < meta->min ? -1 : number > meta->max ? NUM_BUCKETS_HISTOGRAM : bucket_of_histogram(meta, number);
+    };
+
+    std::stringstream ss;
+    ss << predicate.lhs.column << ',' << predicate.op << ',' << bucket(predicate.rhs);
+    if (predicate.op == BETWEEN) {
+        ss << ',' << bucket(predicate.rhs_high);
+    }
+
+    return ss.str();
+}
+
+// rows the predicate checked on the relation, and kept
+void record_predicate_feedback(const struct_predicate &predicate, const struct_file *const file,
+                               const long rows_in, const long rows_out) {
+    const auto key = predicate_feedback_key(predicate, file);
+    if (key.empty()) {
+        return;
+    }
+
+    auto &feedback = predicate_feedback[predicate.lhs.relation - 'A'][key];
+    feedback.rows_in += rows_in;
+    feedback.rows_out += rows_out;
+}
+
+/**
+ * Observed fraction of rows of the relation that predicates of the same kind as this one keep
+ *
+ * @return -1 if predicates of its kind are not checked on FEEDBACK_MIN_ROWS rows yet
+ */
+float observed_predicate_selectivity(const struct_predicate &predicate, const struct_file *const file) {
+    const auto key = predicate_feedback_key(predicate, file);
+    if (key.empty()) {
+        return -1;
+    }
+
+    const auto &feedbacks = predicate_feedback[predicate.lhs.relation - 'A'];
+    const auto it = feedbacks.find(key);
+    if (it == feedbacks.end() || it->second.rows_in < FEEDBACK_MIN_ROWS) {
+        return -1;
+    }
+
+    return (float) it->second.rows_out / it->second.rows_in;
+}
+
+// selectivity of the join clause observed on a join done on it alone, and its estimate before feedback
+void record_join_feedback(const struct_join &clause, const float observed, const float estimated) {
+    auto &feedback = join_feedback[normalize_join_clause(clause)];
+    feedback.sum_log_ratio += log(observed / estimated);
+    feedback.count++;
+}
+
+/**
+ * Factor that estimates of the join clause are off by, on average (geometric) over the joins done on it before
+ *
+ * @return 1 if the clause is not joined on alone before
+ */
+float join_feedback_correction(const struct_join &clause) {
+    const auto it = join_feedback.find(normalize_join_clause(clause));
+    if (it == join_feedback.end()) {
+        return 1;
+    }
+
+    const float correction = expf(it->second.sum_log_ratio / it->second.count);
+    return std::min(std::max(correction, 1 / FEEDBACK_MAX_CORRECTION), FEEDBACK_MAX_CORRECTION);
+}
+
+/**
+ * Drop the feedback of the relation, and of its join clauses, once its data is gone
+ *
+ * @param relation
+ */
+void forget_feedback(const char relation) {
+    predicate_feedback[relation - 'A'].clear();
+
+    // relations are the only capital letters of a normalized join clause
+    for (auto it = join_feedback.begin(); it != join_feedback.end();) {
+        it = it->first.find(relation) != std::string::npos ? join_feedback.erase(it) : std::next(it);
+    }
+}
+
+/**
+ * Estimate the fraction of rows of the relation that meet the predicate, from the histogram of its column,
+ * or as observed for predicates of its kind, see observed_predicate_selectivity
+ *
+ * For =, rows of the bucket of the number are spread over the distinct numbers of the bucket.
+ * Predicates of an OR group are assumed independent
+ */
+float predicate_selectivity(const struct_predicate &predicate, const struct_file *const file) {
+    const float observed = observed_predicate_selectivity(predicate, file);
+    if (observed >= 0) {
+        return observed;
+    }
+
+    const auto *const meta = &file->meta[predicate.lhs.column];
+
+    switch (predicate.op) {
+        case LESS_THAN:
+            return fraction_in_range(meta, -INF_COST, predicate.rhs);
+        case GREATER_THAN:
+            return fraction_in_range(meta, (float) predicate.rhs + 1, INF_COST);
+        case BETWEEN:
+            return fraction_in_range(meta, predicate.rhs, (float) predicate.rhs_high + 1);
+        case IN: {
+            float selectivity = 0;
+            for (int i = 0; i < predicate.num_values; i++) {
+                struct_predicate equal = predicate;
+                equal.op = EQUAL;
+                equal.rhs = predicate.values[i];
+
+                selectivity += predicate_selectivity(equal, file);
+            }
+            return std::min(selectivity, 1.0f);
+        }
+        case OR: {
+            float none = 1;
+            for (int i = 0; i < predicate.num_disjuncts; i++) {
+                none *= 1 - predicate_selectivity(predicate.disjuncts[i], file);
+            }
+            return 1 - none;
+        }
+        default: {
+            if (predicate.rhs < meta->min || predicate.rhs > meta->max) {
+                return 0;
+            }
+
+            const float width = (float) meta->max - meta->min + 1;
+            const float width_bucket = width / NUM_BUCKETS_HISTOGRAM;
+            const float low = meta->min + bucket_of_histogram(meta, predicate.rhs) * width_bucket;
+            const float unique_bucket = std::max(meta->unique * width_bucket / width, 1.0f);
+
+            return fraction_in_range(meta, low, low + width_bucket) / unique_bucket;
+        }
+    }
+}
+
+/**
+ * Rank of the predicate for order_predicates, its cost for each row dropped
+ *
+ * Cost of a predicate is the number of comparisons it makes on each row
+ */
+float predicate_rank(const struct_predicate &predicate, const struct_file *const file) {
+    const float cost = predicate.op == OR ? predicate.num_disjuncts : 1;
+    const float dropped = 1 - predicate_selectivity(predicate, file);
+
+    return dropped <= 0 ? INF_COST : cost / dropped;
+}
+
+/**
+ * Sort predicates of the fourth line by relation, then the cheapest for each row it drops first
+ *
+ * Ranks come from histograms, which take predicates as independent. While the sample of a relation has enough rows
+ * left, each next predicate of the relation is instead ranked by the rows of the sample that the predicates before it
+ * leave, see sample_satisfies. So a predicate that drops the same rows as one before it is put after the others
+ *
+ * @param files
+ * @param fl
+ */
+void order_predicates(struct_files *const files, struct_fourth_line *const fl) {
+    std::vector<float> ranks;
+    for (int i = 0; i < fl->length; i++) {
+        const auto &predicate = fl->predicates[i];
+        ranks.push_back(predicate_rank(predicate, &files->files[predicate.lhs.relation - 'A']));
+    }
+
+    std::vector<struct_predicate> predicates(fl->predicates, fl->predicates + fl->length);
+    std::vector<int> order(fl->length);
+    for (int i = 0; i < fl->length; i++) {
+        order[i] = i;
+    }
+
+    std::stable_sort(order.begin(), order.end(), [&](const int a, const int b) {
+        if (predicates[a].lhs.relation != predicates[b].lhs.relation) {
+            return predicates[a].lhs.relation < predicates[b].lhs.relation;
+        }
+        return ranks[a] < ranks[b];
+    });
+
+    for (int begin = 0, end = 0; begin < fl->length; begin = end) {
+        const char relation = predicates[order[begin]].lhs.relation;
+        while (end < fl->length && predicates[order[end]].lhs.relation == relation) {
+            end++;
+        }
+
+        const struct_file *const file = &files->files[relation - 'A'];
+
+        // rows of the sample left by the predicates ranked so far
+        std::vector<int> sample;
+        filtered_sample(file, sample);
+
+        for (int k = begin; k < end && sample.size() >= SAMPLE_MIN_ROWS_ESTIMATE; k++) {
+            int best = k;
+            float rank_best = INF_COST;
+
+            for (int j = k; j < end; j++) {
+                const auto &predicate = predicates[order[j]];
+
+                int num_kept = 0;
+                for (const int i: sample) {
+                    num_kept += sample_satisfies(file, predicate, i);
+                }
+
+                const float cost = predicate.op == OR ? predicate.num_disjuncts : 1;
+                const float dropped = 1 - (float) num_kept / sample.size();
+                const float rank = dropped <= 0 ? INF_COST : cost / dropped;
+                if (rank < rank_best) {
+                    best = j;
+                    rank_best = rank;
+                }
+            }
+
+            std::rotate(order.begin() + k, order.begin() + best, order.begin() + best + 1);
+
+            std::vector<int> kept;
+            for (const int i: sample) {
+                if (sample_satisfies(file, predicates[order[k]], i)) {
+                    kept.push_back(i);
+                }
+            }
+            sample.swap(kept);
+        }
+    }
+
+    for (int i = 0; i < fl->length; i++) {
+        fl->predicates[i] = predicates[order[i]];
+    }
+}
+
+/**
+ * Cost of joining two data frames, see sorted_nested_loop_join_data_frames
+ *
+ * The left side is sorted, each row of the right side is a binary search in it,
+ * and each row of the result is materialized, one number per relation
+ *
+ * @param card_left: number of rows of the left side
+ * @param width_left: number of relations in the left side
+ * @param card_right: number of rows of the right side
+ * @param width_right: number of relations in the right side
+ * @param card_out: estimated number of rows of the result
+ */
+float cost_join(const float card_left, const int width_left,
+                const float card_right, const int width_right,
+                const float card_out) {
+    const float depth_search = log2f(card_left + 2);
+
+    return card_left * depth_search + card_right * depth_search + card_out * (width_left + width_right);
+}
+
+/**
+ * Rows left in the sample of each relation of a query, see filtered_sample
+ */
+class QuerySamples {
+public:
+    // positions in the sample of each relation, by relation - 'A', empty for relations not in the query
+    std::vector<std::vector<int>> rows;
+
+    // if the rows left of each relation are known, by relation - 'A'
+    std::vector<bool> is_known;
+};
+
+/**
+ * Sample the relations of the query once, a second call keeps the samples already taken.
+ * So every graph built for the query, see init_join_graph_of_units, shares them
+ *
+ * @param samples: the result
+ * @param files
+ * @param query
+ */
+void init_query_samples(QuerySamples &samples, struct_files *const files, struct_query *const query) {
+    if (!samples.rows.empty()) {
+        return;
+    }
+
+    samples.rows.resize(files->length);
+    samples.is_known.assign(files->length, false);
+    for (int i = 0; i < query->second.length; i++) {
+        const int index = query->second.relations[i] - 'A';
+        samples.is_known[index] = filtered_sample(&files->files[index], samples.rows[index]);
+    }
+}
+
+/**
+ * Build the join graph among units, each unit is one or more relations of the query already joined together.
+ * Join clauses inside a unit are left out, they are already applied.
+ * Selectivities not exact are corrected by how far off estimates of their clauses were, see join_feedback_correction
+ *
+ * @param graph: the result
+ * @param files
+ * @param query
+ * @param samples: of the relations of the query, see init_query_samples
+ * @param units: relations of each unit
+ * @param cardinalities: number of rows of each unit
+ */
+void init_join_graph_of_units(JoinGraph &graph,
+                              struct_files *const files,
+                              struct_query *const query,
+                              const QuerySamples &samples,
+                              const std::vector<std::string> &units,
+                              const std::vector<float> &cardinalities) {
+    const int num_units = units.size();
+    ASSERT(num_units <= 26);
+
+    graph.relations.clear();
+    for (const auto &unit: units) {
+        graph.relations.push_back(unit[0]);
+    }
+    graph.cardinalities = cardinalities;
+    graph.neighbors.assign(num_units, 0);
+    graph.clauses.clear();
+    graph.selectivities.clear();
+    graph.joins.clear();
+    graph.estimates.clear();
+
+    for (int i = 0; i < query->third.length; i++) {
+        const auto &clause = query->third.joins[i];
+
+        int lhs = -1, rhs = -1;
+        for (int u = 0; u < num_units; u++) {
+            lhs = units[u].find(clause.lhs.relation) != std::string::npos ? u : lhs;
+            rhs = units[u].find(clause.rhs.relation) != std::string::npos ? u : rhs;
+        }
+        ASSERT(lhs != -1 && rhs != -1);
+
+        if (lhs == rhs) {
+            continue;
+        }
+
+        graph.neighbors[lhs] |= (RelationSet) 1 << rhs;
+        graph.neighbors[rhs] |= (RelationSet) 1 << lhs;
+
+        graph.clauses.push_back(((RelationSet) 1 << lhs) | ((RelationSet) 1 << rhs));
+        const int index_A = clause.lhs.relation - 'A', index_B = clause.rhs.relation - 'A';
+        bool is_exact;
+        const float selectivity = join_selectivity_given_samples(
+                clause, files, samples.rows[index_A], samples.rows[index_B],
+                samples.is_known[index_A] && samples.is_known[index_B], &is_exact);
+
+        graph.selectivities.push_back(
+                is_exact ? selectivity : std::min(selectivity * join_feedback_correction(clause), 1.0f));
+        graph.joins.push_back(&clause);
+        graph.estimates.push_back(is_exact ? 0 : selectivity);
+    }
+}
+
+// join graph among relations of the query, each relation has its rows left after select/filter
+void init_join_graph(JoinGraph &graph, struct_files *const files, struct_query *const query) {
+    std::vector<std::string> units;
+    std::vector<float> cardinalities;
+    for (int i = 0; i < query->second.length; i++) {
+        const char relation = query->second.relations[i];
+
+        units.push_back(std::string(1, relation));
+        cardinalities.push_back(filtered_cardinality(&files->files[relation - 'A']));
+    }
+
+    QuerySamples samples;
+    init_query_samples(samples, files, query);
+
+    init_join_graph_of_units(graph, files, query, samples, units, cardinalities);
+}
+
+// relations outside of set that share a join clause with it
+static inline RelationSet neighbors_of_set(const JoinGraph &graph, const RelationSet set) {
+    RelationSet neighbors = 0;
+    for (RelationSet rest = set; rest != 0; rest &= rest - 1) {
+        neighbors |= graph.neighbors[__builtin_ctz(rest)];
+    }
+
+    return neighbors & ~set;
+}
+
+// product of selectivities of join clauses between two sets of relations
+static inline float selectivity_between(const JoinGraph &graph, const RelationSet a, const RelationSet b) {
+    float selectivity = 1;
+    for (int i = 0; i < graph.clauses.size(); i++) {
+        if ((graph.clauses[i] & a) && (graph.clauses[i] & b)) {
+            selectivity *= graph.selectivities[i];
+        }
+    }
+
+    return selectivity;
+}
+
+/**
+ * Extend the connected set by its neighbors not in excluded, every connected superset found is added to subgraphs
+ */
+void enumerate_connected_subgraphs_from(const JoinGraph &graph,
+                                        const RelationSet set,
+                                        const RelationSet excluded,
+                                        std::vector<RelationSet> &subgraphs) {
+    const RelationSet neighbors = neighbors_of_set(graph, set) & ~excluded;
+
+    // every non-empty subset of neighbors
+    for (RelationSet subset = neighbors; subset != 0; subset = (subset - 1) & neighbors) {
+        subgraphs.push_back(set | subset);
+    }
+
+    for (RelationSet subset = neighbors; subset != 0; subset = (subset - 1) & neighbors) {
+        enumerate_connected_subgraphs_from(graph, set | subset, excluded | neighbors, subgraphs);
+    }
+}
+
+/**
+ * Enumerate every pair of connected sets of relations (S1, S2), where S1 and S2 do not overlap,
+ * and at least one join clause connects them. Each pair is produced once, in one of its two orientations.
+ *
+ * DPccp: starting from each relation, a connected set only grows with relations numbered higher than where it starts,
+ * so no set is produced twice. The complement S2 likewise only grows away from relations numbered below S1
+ *
+ * @param graph
+ * @param pairs: sorted by number of relations of S1 + S2, so both halves are planned before the pair
+ */
+void enumerate_join_pairs(const JoinGraph &graph, std::vector<std::pair<RelationSet, RelationSet>> &pairs) {
+    const int num_relations = graph.relations.size();
+
+    std::vector<RelationSet> subgraphs;
+    for (int i = num_relations - 1; i >= 0; i--) {
+        const RelationSet start = (RelationSet) 1 << i;
+        const RelationSet lower = (start << 1) - 1;
+
+        subgraphs.push_back(start);
+        enumerate_connected_subgraphs_from(graph, start, lower, subgraphs);
+    }
+
+    std::vector<RelationSet> complements;
+    for (const auto &subgraph: subgraphs) {
+        // relations numbered at or below the lowest one of subgraph
+        const RelationSet excluded = subgraph | (((subgraph & -subgraph) << 1) - 1);
+        const RelationSet neighbors = neighbors_of_set(graph, subgraph) & ~excluded;
+
+        complements.clear();
+        for (int i = num_relations - 1; i >= 0; i--) {
+            const RelationSet start = (RelationSet) 1 << i;
+            if (!(neighbors & start)) {
+                continue;
+            }
+
+            complements.push_back(start);
+            enumerate_connected_subgraphs_from(graph, start, excluded | (neighbors & ((start << 1) - 1)), complements);
+        }
+
+        for (const auto &complement: complements) {
+            pairs.push_back(std::make_pair(subgraph, complement));
+        }
+    }
+
+    std::stable_sort(pairs.begin(), pairs.end(),
+                     [](const std::pair<RelationSet, RelationSet> &a, const std::pair<RelationSet, RelationSet> &b) {
+                         return __builtin_popcount(a.first | a.second) < __builtin_popcount(b.first | b.second);
+                     });
+}
+
+/**
+ * Compute the best plan of every connected set of relations of the query
+ *
+ * Each pair of connected sets from enumerate_join_pairs is tried in both orientations,
+ * with the best plan of each half. So the plan may be bushy, like (A join B) join (C join D).
+ * Every join clause between the two halves is applied to the estimated number of rows,
+ * assuming they are independent
+ *
+ * @param graph
+ * @param best: the result, best plan of each RelationSet, see Best
+ */
+void compute_best(const JoinGraph &graph, Best &best) {
+    const int num_relations = graph.relations.size();
+
+    best.assign((size_t) 1 << num_relations, BestPlan());
+
+    // scan of each relation
+    for (int i = 0; i < num_relations; i++) {
+        auto &plan = best[(RelationSet) 1 << i];
+
+        plan.cardinality = graph.cardinalities[i];
+        plan.cost = plan.cardinality;
+    }
+
+    std::vector<std::pair<RelationSet, RelationSet>> pairs;
+    enumerate_join_pairs(graph, pairs);
+
+    for (const auto &pair: pairs) {
+        const float selectivity = selectivity_between(graph, pair.first, pair.second);
+
+        const auto &plan_first = best[pair.first];
+        const auto &plan_second = best[pair.second];
+        auto &plan = best[pair.first | pair.second];
+
+        const float cardinality = plan_first.cardinality * plan_second.cardinality * selectivity;
+
+        // (left, right) and (right, left)
+        for (int k = 0; k < 2; k++) {
+            const RelationSet left = k == 0 ? pair.first : pair.second;
+            const auto &plan_left = k == 0 ? plan_first : plan_second;
+            const auto &plan_right = k == 0 ? plan_second : plan_first;
+
+            const float cost = plan_left.cost + plan_right.cost
+                               + cost_join(plan_left.cardinality, __builtin_popcount(left),
+                                           plan_right.cardinality, __builtin_popcount(pair.first | pair.second) -
+                                                                   __builtin_popcount(left),
+                                           cardinality);
+
+            if (cost < plan.cost) {
+                plan.cost = cost;
+                plan.cardinality = cardinality;
+                plan.left = left;
+            }
+        }
+    }
+}
+
+// above this many relations, join order is picked by compute_greedy, since the memo of compute_best has 2^n plans
+#ifndef MAX_RELATIONS_DYNAMIC_PROGRAMMING
+#define MAX_RELATIONS_DYNAMIC_PROGRAMMING 12
+#endif
+
+/**
+ * Greedy operator ordering (GOO), for queries with too many relations for compute_best
+ *
+ * Each relation starts as a plan on its own. Among the pairs of plans connected by a join clause,
+ * the pair that produces the fewest estimated rows is joined, in the cheaper orientation,
+ * until one plan is left. It takes O(n^3) for n relations
+ *
+ * @param graph
+ * @param order: the result, empty if relations are not connected
+ * @return the final plan
+ */
+BestPlan compute_greedy(const JoinGraph &graph, Order &order) {
+    const int num_relations = graph.relations.size();
+
+    // plans not joined yet, with their relations and orders
+    std::vector<RelationSet> sets(num_relations);
+    std::vector<BestPlan> plans(num_relations);
+    std::vector<Order> orders(num_relations);
+
+    // scan of each relation
+    for (int i = 0; i < num_relations; i++) {
+        sets[i] = (RelationSet) 1 << i;
+        plans[i].cardinality = graph.cardinalities[i];
+        plans[i].cost = plans[i].cardinality;
+        orders[i].push_back(graph.relations[i]);
+    }
+
+    while (sets.size() > 1) {
+        int best_i = -1, best_j = -1;
+        float best_cardinality = INF_COST;
+
+        for (int i = 0; i < sets.size(); i++) {
+            const RelationSet neighbors = neighbors_of_set(graph, sets[i]);
+
+            for (int j = i + 1; j < sets.size(); j++) {
+                if (!(neighbors & sets[j])) {
+                    continue;
+                }
+
+                const float cardinality = plans[i].cardinality * plans[j].cardinality
+                                          * selectivity_between(graph, sets[i], sets[j]);
+                if (best_i == -1 || cardinality < best_cardinality) {
+                    best_i = i;
+                    best_j = j;
+                    best_cardinality = cardinality;
+                }
+            }
+        }
+
+        // the rest of plans have no join clause between them
+        if (best_i == -1) {
+            order.clear();
+            return BestPlan();
+        }
+
+        const int width_i = __builtin_popcount(sets[best_i]);
+        const int width_j = __builtin_popcount(sets[best_j]);
+        const float cost_ij = cost_join(plans[best_i].cardinality, width_i,
+                                        plans[best_j].cardinality, width_j, best_cardinality);
+        const float cost_ji = cost_join(plans[best_j].cardinality, width_j,
+                                        plans[best_i].cardinality, width_i, best_cardinality);
+
+        BestPlan plan;
+        plan.cardinality = best_cardinality;
+        plan.cost = plans[best_i].cost + plans[best_j].cost + std::min(cost_ij, cost_ji);
+        plan.left = cost_ij <= cost_ji ? sets[best_i] : sets[best_j];
+
+        Order joined = cost_ij <= cost_ji ? orders[best_i] : orders[best_j];
+        const Order &right = cost_ij <= cost_ji ? orders[best_j] : orders[best_i];
+        joined.insert(joined.end(), right.begin(), right.end());
+        joined.push_back(ORDER_JOIN);
+
+        sets[best_i] |= sets[best_j];
+        plans[best_i] = plan;
+        orders[best_i] = joined;
+
+        sets.erase(sets.begin() + best_j);
+        plans.erase(plans.begin() + best_j);
+        orders.erase(orders.begin() + best_j);
+    }
+
+    order = orders[0];
+    return plans[0];
+}
+
+/**
+ * Write the best plan of set as an Order
+ */
+void best_to_order(const JoinGraph &graph, const Best &best, const RelationSet set, Order &order) {
+    const RelationSet left = best[set].left;
+
+    if (left == 0) {
+        order.push_back(graph.relations[__builtin_ctz(set)]);
+        return;
+    }
+
+    best_to_order(graph, best, left, order);
+    best_to_order(graph, best, set & ~left, order);
+    order.push_back(ORDER_JOIN);
+}
+
+/**
+ * One element of an Order, with its estimates
+ */
+class PlanStep {
+public:
+    // relations joined by this step
+    RelationSet relations;
+
+    // index in the order of the two plans joined, -1 for a relation
+    int left;
+    int right;
+
+    float cardinality;
+    float cost;
+};
+
+/**
+ * Estimate number of rows and cost of each step of order, the same way as compute_best
+ *
+ * @param graph
+ * @param order
+ * @param steps: the result, one for each element of order
+ */
+void estimate_order(const JoinGraph &graph, const Order &order, std::vector<PlanStep> &steps) {
+    steps.assign(order.size(), PlanStep());
+
+    std::vector<int> stack;
+    for (int k = 0; k < order.size(); k++) {
+        auto &step = steps[k];
+
+        if (order[k] != ORDER_JOIN) {
+            const int i = findIndexOf(graph.relations.data(), graph.relations.size(), order[k]);
+            ASSERT(i != -1);
+
+            step.relations = (RelationSet) 1 << i;
+            step.left = step.right = -1;
+            step.cardinality = graph.cardinalities[i];
+            step.cost = step.cardinality;
+
+            stack.push_back(k);
+            continue;
+        }
+
+        ASSERT(stack.size() >= 2);
+        step.right = stack.back();
+        stack.pop_back();
+        step.left = stack.back();
+        stack.pop_back();
+
+        const auto &left = steps[step.left];
+        const auto &right = steps[step.right];
+
+        step.relations = left.relations | right.relations;
+        step.cardinality = left.cardinality * right.cardinality
+                           * selectivity_between(graph, left.relations, right.relations);
+        step.cost = left.cost + right.cost
+                    + cost_join(left.cardinality, __builtin_popcount(left.relations),
+                                right.cardinality, __builtin_popcount(right.relations),
+                                step.cardinality);
+
+        stack.push_back(k);
+    }
+}
+
+bool join_clause_contains(struct_join *join, char r, char s) {
+    return ((join->lhs.relation == r && join->rhs.relation == s)
+            || (join->lhs.relation == s && join->rhs.relation == r));
+}
+
+// A.c1 < B.c0 => B.c0 > A.c1
+void flip_join(struct_join *join) {
+    std::swap(join->lhs, join->rhs);
+
+    if (join->op == LESS_THAN) {
+        join->op = GREATER_THAN;
+    } else if (join->op == GREATER_THAN) {
+        join->op = LESS_THAN;
+    }
+}
+
+//////////////////
+// Plan caching //
+//////////////////
+
+// re-run the optimizer on a cached shape if any relation's filtered cardinality changed by more than this factor,
+// or the feedback correction of any of its join clauses did
+#ifndef PLAN_CACHE_RECOST_RATIO
+#define PLAN_CACHE_RECOST_RATIO 4.0f
+#endif
+
+// query shapes the cache holds plans of, the least recently used plan is evicted past it
+#ifndef PLAN_CACHE_MAX_ENTRIES
+#define PLAN_CACHE_MAX_ENTRIES 1024
+#endif
+
+/**
+ * A join order computed for a query shape, and the cardinalities it was computed with
+ */
+class CachedPlan {
+public:
+    Order order;
+
+    // join graph the plan was costed on, its joins are of the query that computed it, see clauses
+    JoinGraph graph;
+
+    // normalized clause of each join clause of graph, see normalize_join_clause
+    std::vector<std::string> clauses;
+
+    // filtered number of rows of each relation when the plan was computed, key is relation - 'A'
+    std::vector<int> cardinalities;
+
+    // feedback correction of each join clause when the plan was computed, key is the normalized clause,
+    // see join_feedback_correction
+    std::unordered_map<std::string, float> corrections;
+
+    // value of plan_cache_clock when it was last used
+    long last_used;
+};
+
+/**
+ * key: normalized query shape, see normalize_query_shape
+ * value: plan computed for that shape
+ */
+static std::unordered_map<std::string, CachedPlan> plan_cache;
+static long plan_cache_clock = 0;
+
+/**
+ * Drop the cached plans of every shape that joins the relation, once its data is gone
+ *
+ * @param relation
+ */
+void forget_plans(const char relation) {
+    for (auto it = plan_cache.begin(); it != plan_cache.end();) {
+        // relations of a shape come before the first '|', see normalize_join_subgraph
+        const auto &key = it->first;
+        const auto end = std::find(key.begin(), key.end(), '|');
+        if (std::find(key.begin(), end, relation) != end) {
+            it = plan_cache.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
+
+// name of each enum_operator
+static const char *const NAME_OPERATOR[] = {"=", "<", ">", "BETWEEN", "IN", "OR"};
+
+// A.c1 = B.c0 and B.c0 = A.c1 are the same join, always put the smaller side first
+// B.c0 > A.c1 => "A1<B0"
+static const std::string normalize_join_clause(const struct_join &join) {
+    struct_join normalized = join;
+
+    const auto &lhs = join.lhs;
+    const auto &rhs = join.rhs;
+    if (rhs.relation < lhs.relation || (rhs.relation == lhs.relation && rhs.column < lhs.column)) {
+        flip_join(&normalized);
+    }
+
+    std::stringstream ss;
+    ss << normalized.lhs.relation << normalized.lhs.column
+       << NAME_OPERATOR[normalized.op]
+       << normalized.rhs.relation << normalized.rhs.column;
+    return ss.str();
+}
+
+// A.c3 < 7 => "A3<", (A.c3 < 7 OR A.c1 IN (1, 2)) => "(A3<,A1IN)"
+static const std::string predicate_shape(const struct_predicate &predicate) {
+    std::stringstream ss;
+
+    if (predicate.op == OR) {
+        std::vector<std::string> disjuncts;
+        for (int i = 0; i < predicate.num_disjuncts; i++) {
+            disjuncts.push_back(predicate_shape(predicate.disjuncts[i]));
+        }
+        std::sort(disjuncts.begin(), disjuncts.end());
+
+        ss << '(';
+        for (int i = 0; i < disjuncts.size(); i++) {
+            ss << (i == 0 ? "" : ",") << disjuncts[i];
+        }
+        ss << ')';
+
+        return ss.str();
+    }
+
+    ss << predicate.lhs.relation << predicate.lhs.column << NAME_OPERATOR[predicate.op];
+    return ss.str();
+}
+
+/**
+ * Normalized join graph among some relations of a query: the relations and the join clauses between them
+ *
+ * FROM C, A, B WHERE B.c0 = A.c1 AND A.c3 = C.c0, relations BA => "AB|A1=B0"
+ */
+const std::string normalize_join_subgraph(const struct_query *const query, const std::vector<char> &relations) {
+    std::vector<std::string> joins;
+    for (int i = 0; i < query->third.length; i++) {
+        const auto &join = query->third.joins[i];
+
+        if (std::find(relations.begin(), relations.end(), join.lhs.relation) != relations.end()
+            && std::find(relations.begin(), relations.end(), join.rhs.relation) != relations.end()) {
+            joins.push_back(normalize_join_clause(join));
+        }
+    }
+    std::sort(joins.begin(), joins.end());
+
+    std::stringstream ss;
+    ss << vector_to_string_sorted(relations) << '|';
+    for (int i = 0; i < joins.size(); i++) {
+        ss << (i == 0 ? "" : ",") << joins[i];
+    }
+
+    return ss.str();
+}
+
+/**
+ * Normalized join graph of a query: its relations and its join clauses
+ *
+ * FROM C, A, B WHERE B.c0 = A.c1 AND A.c3 = C.c0 => "ABC|A1=B0,A3=C0"
+ */
+const std::string normalize_join_graph(const struct_query *const query) {
+    return normalize_join_subgraph(
+            query, std::vector<char>(query->second.relations, query->second.relations + query->second.length));
+}
+
+/**
+ * Normalized shape of a query: its join graph, see normalize_join_graph, and the columns it has predicates on.
+ * Constants of predicates are left out, so queries only differ in constants share the same shape
+ *
+ * FROM C, A, B WHERE B.c0 = A.c1 AND A.c3 = C.c0 AND B.c2 < 7 => "ABC|A1=B0,A3=C0|B2<"
+ */
+const std::string normalize_query_shape(const struct_query *const query) {
+    std::vector<std::string> predicates;
+    for (int i = 0; i < query->fourth.length; i++) {
+        predicates.push_back(predicate_shape(query->fourth.predicates[i]));
+    }
+    std::sort(predicates.begin(), predicates.end());
+    predicates.erase(std::unique(predicates.begin(), predicates.end()), predicates.end());
+
+    std::stringstream ss;
+    ss << normalize_join_graph(query) << '|';
+    for (int i = 0; i < predicates.size(); i++) {
+        ss << (i == 0 ? "" : ",") << predicates[i];
+    }
+
+    return ss.str();
+}
+
+/**
+ * Check if cardinalities of the relations, or the feedback corrections of the join clauses, changed so much
+ * since the plan was computed, that it should be re-costed
+ */
+bool should_recost_plan(const CachedPlan &plan, struct_files *const files, struct_query *const query) {
+    for (int i = 0; i < query->second.length; i++) {
+        int index = query->second.relations[i] - 'A';
+
+        float before = plan.cardinalities[index];
+        float now = filtered_cardinality(&files->files[index]);
+
+        float larger = std::max(before, now);
+        float smaller = std::max(std::min(before, now), 1.0f);
+
+        if (larger / smaller > PLAN_CACHE_RECOST_RATIO) {
+            return true;
+        }
+    }
+
+    for (int i = 0; i < query->third.length; i++) {
+        const auto &join = query->third.joins[i];
+
+        const auto it = plan.corrections.find(normalize_join_clause(join));
+        const float before = it == plan.corrections.end() ? 1 : it->second;
+        const float now = join_feedback_correction(join);
+
+        if (std::max(before, now) / std::min(before, now) > PLAN_CACHE_RECOST_RATIO) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Plan joining every relation of the graph, with compute_best, or compute_greedy if there are too many relations
+ *
+ * @param graph
+ * @param order: the result
+ */
+void plan_join_graph(const JoinGraph &graph, Order &order) {
+    order.clear();
+
+    if (graph.relations.size() <= MAX_RELATIONS_DYNAMIC_PROGRAMMING) {
+        Best best;
+        compute_best(graph, best);
+
+        const RelationSet all = ((RelationSet) 1 << graph.relations.size()) - 1;
+
+        // relations should be connected by join clauses
+        ASSERT(best[all].cost != INF_COST);
+
+        best_to_order(graph, best, all, order);
+    } else {
+        compute_greedy(graph, order);
+
+        // relations should be connected by join clauses
+        ASSERT(!order.empty());
+    }
+}
+
+/**
+ * Compute the plan to join relations of the query, see Order
+ *
+ * Selinger’s algorithm over connected pairs of relations (DPccp), see compute_best.
+ * Queries with more than MAX_RELATIONS_DYNAMIC_PROGRAMMING relations are planned greedily, see compute_greedy
+ *
+ * Plans are cached by the shape of the query, see normalize_query_shape, at most PLAN_CACHE_MAX_ENTRIES of them.
+ * A cached plan is reused unless the filtered cardinalities, or what was learned about its join clauses since,
+ * see join_feedback_correction, moved too far from what it was costed with.
+ * Its join graph is reused too, with the cardinalities of the query, so the relations are not sampled again
+ *
+ * @param files
+ * @param query
+ * @param graph: the result, join graph the plan is costed on, see init_join_graph
+ */
+const Order optimize_joins(struct_files *const files, struct_query *const query, JoinGraph &graph) {
+    const auto key = normalize_query_shape(query);
+
+    auto cached = plan_cache.find(key);
+    if (cached != plan_cache.end() && !should_recost_plan(cached->second, files, query)) {
+        auto &plan = cached->second;
+        plan.last_used = ++plan_cache_clock;
+
+        graph = plan.graph;
+        for (int i = 0; i < graph.relations.size(); i++) {
+            graph.cardinalities[i] = filtered_cardinality(&files->files[graph.relations[i] - 'A']);
+        }
+
+        std::vector<std::string> clauses;
+        for (int i = 0; i < query->third.length; i++) {
+            clauses.push_back(normalize_join_clause(query->third.joins[i]));
+        }
+        for (int c = 0; c < graph.joins.size(); c++) {
+            const int i = std::find(clauses.begin(), clauses.end(), plan.clauses[c]) - clauses.begin();
+            ASSERT(i < query->third.length);
+            graph.joins[c] = &query->third.joins[i];
+        }
+
+        return plan.order;
+    }
+
+    init_join_graph(graph, files, query);
+
+    // a new shape takes the place of the least recently used one when the cache is full
+    if (cached == plan_cache.end() && plan_cache.size() >= PLAN_CACHE_MAX_ENTRIES) {
+        auto oldest = plan_cache.begin();
+        for (auto it = plan_cache.begin(); it != plan_cache.end(); it++) {
+            if (it->second.last_used < oldest->second.last_used) {
+                oldest = it;
+            }
+        }
+        plan_cache.erase(oldest);
+    }
+
+    // remember this plan for queries of the same shape
+    auto &plan = plan_cache[key];
+    plan.last_used = ++plan_cache_clock;
+    plan_join_graph(graph, plan.order);
+
+    plan.cardinalities.assign(26, 0);
+    for (int i = 0; i < files->length; i++) {
+        plan.cardinalities[i] = filtered_cardinality(&files->files[i]);
+    }
+
+    plan.corrections.clear();
+    for (int i = 0; i < query->third.length; i++) {
+        const auto &join = query->third.joins[i];
+        plan.corrections[normalize_join_clause(join)] = join_feedback_correction(join);
+    }
+
+    plan.graph = graph;
+    plan.clauses.clear();
+    for (const auto join: graph.joins) {
+        plan.clauses.push_back(normalize_join_clause(*join));
+    }
+
+    return plan.order;
+}
+
+/*
+ ________                                            __      __                            ________                      __
+/        |                                          /  |    /  |                          /        |                    /  |
+$$$$$$$$/  __    __   ______    _______  __    __  _$$ |_   $$/   ______   _______        $$$$$$$$/  _______    ______  $$/  _______    ______
+$$ |__    /  \  /  | /      \  /       |/  |  /  |/ $$   |  /  | /      \ /       \       $$ |__    /       \  /      \ /  |/       \  /      \
+$$    |   $$  \/$$/ /$$$$$$  |/$$$$$$$/ $$ |  $$ |$$$$$$/   $$ |/$$$$$$  |$$$$$$$  |      $$    |   $$$$$$$  |/$$$$$$  |$$ |$$$$$$$  |/$$$$$$  |
+$$$$$/     $$  $$<  $$    $$ |$$ |      $$ |  $$ |  $$ | __ $$ |$$ |  $$ |$$ |  $$ |      $$$$$/    $$ |  $$ |$$ |  $$ |$$ |$$ |  $$ |$$    $$ |
+$$ |_____  /$$$$  \ $$$$$$$$/ $$ \_____ $$ \__$$ |  $$ |/  |$$ |$$ \__$$ |$$ |  $$ |      $$ |_____ $$ |  $$ |$$ \__$$ |$$ |$$ |  $$ |$$$$$$$$/
+$$       |/$$/ $$  |$$       |$$       |$$    $$/   $$  $$/ $$ |$$    $$/ $$ |  $$ |      $$       |$$ |  $$ |$$    $$ |$$ |$$ |  $$ |$$       |
+$$$$$$$$/ $$/   $$/  $$$$$$$/  $$$$$$$/  $$$$$$/     $$$$/  $$/  $$$$$$/  $$/   $$/       $$$$$$$$/ $$/   $$/  $$$$$$$ |$$/ $$/   $$/  $$$$$$$/
+                                                                                                              /  \__$$ |
+                                                                                                              $$    $$/
+                                                                                                               $$$$$$/
+ */
+
+/**
+ * This struct is used to store number and the index of row they are in
+ */
+typedef struct {
+    // the number at column
+    int number;
+    // the index or row in dataframe.index
+    int row;
+} struct_number_row;
+
+int cmp_struct_number_row_qsort(const void *p1, const void *p2) {
+    const struct_number_row *a = (const struct_number_row *) p1;
+    const struct_number_row *b = (const struct_number_row *) p2;
+
+    if (a->number != b->number) {
+        if (a->number < b->number) {
+            return -1;
+        } else {
+            return 1;
+        }
+    }
+
+    if (a->row < b->row) {
+        return -1;
+    } else if (a->row > b->row) {
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/**
+ * Index of the first element in buffer sorted by number, whose number is >= number, or > number if strict
+ */
+static inline int bound_number_row(const struct_number_row *const buffer, int length, int number, int strict) {
+    int begin = 0;
+    while (length > 0) {
+        int half = length / 2;
+
+        if (buffer[begin + half].number < number || (strict && buffer[begin + half].number == number)) {
+            begin += half + 1;
+            length -= half + 1;
+        } else {
+            length = half;
+        }
+    }
+
+    return begin;
+}
+
+/**
+ * Narrow [*begin, *end) of buffer sorted by number of lhs, to the rows where (lhs op number) holds
+ */
+static inline void narrow_range_of_join(const struct_number_row *const buffer,
+                                        int length,
+                                        enum_operator op,
+                                        int number,
+                                        int *begin,
+                                        int *end) {
+    switch (op) {
+        case EQUAL:
+            *begin = std::max(*begin, bound_number_row(buffer, length, number, 0));
+            *end = std::min(*end, bound_number_row(buffer, length, number, 1));
+            break;
+        case LESS_THAN:
+            *end = std::min(*end, bound_number_row(buffer, length, number, 0));
+            break;
+        case GREATER_THAN:
+            *begin = std::max(*begin, bound_number_row(buffer, length, number, 1));
+            break;
+        default:
+            ASSERT(0);
+    }
+}
+
+// lhs op rhs of a join clause
+static inline int satisfy_join(int lhs, enum_operator op, int rhs) {
+    return op == EQUAL ? lhs == rhs : (op == LESS_THAN ? lhs < rhs : lhs > rhs);
+}
+
+// IN lists whose numbers span less than this are stored as bitmap, otherwise as hash set
+#ifndef VALUE_SET_MAX_BITMAP_RANGE
+#define VALUE_SET_MAX_BITMAP_RANGE (1 << 20)
+#endif
+
+/**
+ * Set of numbers of an IN predicate
+ */
+typedef struct {
+    int min;
+    int max;
+
+    // one bit for each number in [min, max]
+    // @nullable: NULL if the range is too large, then hash is used
+    uint64_t *bitmap;
+
+    // @nullable: NULL if bitmap is used
+    std::unordered_set<int> *hash;
+} struct_value_set;
+
+void init_struct_value_set(struct_value_set *set, const struct_predicate *const predicate) {
+    ASSERT(predicate->op == IN && predicate->num_values > 0);
+
+    set->min = INT32_MAX;
+    set->max = INT32_MIN;
+    set->bitmap = NULL;
+    set->hash = NULL;
+
+    for (int i = 0; i < predicate->num_values; i++) {
+        set->min = std::min(set->min, predicate->values[i]);
+        set->max = std::max(set->max, predicate->values[i]);
+    }
+
+    int64_t range = (int64_t) set->max - set->min + 1;
+
+    // a long list also gets a bitmap if it costs a few bytes for each number
+    if (range > VALUE_SET_MAX_BITMAP_RANGE && range > 32 * (int64_t) predicate->num_values) {
+        set->hash = new std::unordered_set<int>(predicate->values, predicate->values + predicate->num_values);
+        return;
+    }
+
+    set->bitmap = (uint64_t *) calloc((range + 63) / 64, sizeof(uint64_t));
+    for (int i = 0; i < predicate->num_values; i++) {
+        uint32_t bit = (uint32_t) predicate->values[i] - (uint32_t) set->min;
+        set->bitmap[bit >> 6] |= (uint64_t) 1 << (bit & 63);
+    }
+}
+
+void free_struct_value_set(struct_value_set *set) {
+    free(set->bitmap);
+    delete set->hash;
+    set->bitmap = NULL;
+    set->hash = NULL;
+}
+
+static inline int value_set_contains(const struct_value_set *const set, const int number) {
+    if (set->bitmap == NULL) {
+        return set->hash->find(number) != set->hash->end();
+    }
+
+    // numbers below min wrap around to a large offset
+    uint32_t bit = (uint32_t) number - (uint32_t) set->min;
+
+    return bit <= (uint32_t) set->max - (uint32_t) set->min && ((set->bitmap[bit >> 6] >> (bit & 63)) & 1);
+}
+
+/*
+ * Run statement for each row in index, with number being the number in columns at that row
+ * The operator is decided before entering the loop, so the loop itself has no branches
+ */
+#define FOR_EACH_NUMBER(columns, index, num_row, statement) \
+do {\
+    for (int fast = 0; fast < (num_row); fast++) {\
+        const int row = (index)[fast];\
+        const int number = (columns)[row];\
+        statement;\
+    }\
+} while(0)
+
+// number in [low, high], in one comparison
+#define IS_BETWEEN(number, low, high) ((uint32_t) (number) - (uint32_t) (low) <= (uint32_t) (high) - (uint32_t) (low))
+
+/**
+ * Keep rows in index that meet the predicate, in one pass
+ *
+ * @param columns: the column of the predicate
+ * @param index: index of rows to check, rows kept are compacted to the front
+ * @param num_row: size of index
+ * @param predicate
+ * @param set: numbers of IN, built once by the caller, @nullable for other operators
+ * @return number of rows kept
+ */
+int select_rows_given_predicate(const int *const columns,
+                                int *const index,
+                                const int num_row,
+                                const struct_predicate *const predicate,
+                                const struct_value_set *const set) {
+    int slow = 0;
+    const int rhs = predicate->rhs;
+    const int rhs_high = predicate->rhs_high;
+
+    switch (predicate->op) {
+        case EQUAL:
+            FOR_EACH_NUMBER(columns, index, num_row, { index[slow] = row; slow += number == rhs; });
+            break;
+        case LESS_THAN:
+            FOR_EACH_NUMBER(columns, index, num_row, { index[slow] = row; slow += number < rhs; });
+            break;
+        case GREATER_THAN:
+            FOR_EACH_NUMBER(columns, index, num_row, { index[slow] = row; slow += number > rhs; });
+            break;
+        case BETWEEN:
+            if (rhs > rhs_high) {
+                break;
+            }
+            FOR_EACH_NUMBER(columns, index, num_row, { index[slow] = row; slow += IS_BETWEEN(number, rhs, rhs_high); });
+            break;
+        case IN:
+            FOR_EACH_NUMBER(columns, index, num_row, { index[slow] = row; slow += value_set_contains(set, number); });
+            break;
+        default:
+            fprintf(stderr, "Invalid operator");
+            break;
+    }
+
+    return slow;
+}
+
+/**
+ * Mark rows in index that meet the predicate, flags[i] is set to 1 if index[i] meets it
+ * Flags already set are kept, so it can be called once for each predicate of an OR group
+ *
+ * @param set: numbers of IN, @nullable for other operators
+ */
+void mark_rows_given_predicate(const int *const columns,
+                               const int *const index,
+                               const int num_row,
+                               const struct_predicate *const predicate,
+                               const struct_value_set *const set,
+                               char *const flags) {
+    const int rhs = predicate->rhs;
+    const int rhs_high = predicate->rhs_high;
+
+    switch (predicate->op) {
+        case EQUAL:
+            FOR_EACH_NUMBER(columns, index, num_row, flags[fast] |= number == rhs);
+            break;
+        case LESS_THAN:
+            FOR_EACH_NUMBER(columns, index, num_row, flags[fast] |= number < rhs);
+            break;
+        case GREATER_THAN:
+            FOR_EACH_NUMBER(columns, index, num_row, flags[fast] |= number > rhs);
+            break;
+        case BETWEEN:
+            if (rhs > rhs_high) {
+                break;
+            }
+            FOR_EACH_NUMBER(columns, index, num_row, flags[fast] |= IS_BETWEEN(number, rhs, rhs_high));
+            break;
+        case IN:
+            FOR_EACH_NUMBER(columns, index, num_row, flags[fast] |= value_set_contains(set, number));
+            break;
+        default:
+            fprintf(stderr, "Invalid operator");
+            break;
+    }
+}
+
+/**
+ * Keep rows in index that meet any predicate in the OR group
+ *
+ * @param columns: columns of the relation, by their ID, with every column of the group read
+ * @param sets: one for each predicate of the group, see select_rows_given_predicate
+ * @return number of rows kept
+ */
+int select_rows_given_disjuncts(const int *const *const columns,
+                                int *const index,
+                                const int num_row,
+                                const struct_predicate *const predicate,
+                                const struct_value_set *const sets) {
+    ASSERT(predicate->op == OR);
+
+    char *flags = (char *) calloc(num_row, sizeof(char));
+
+    for (int i = 0; i < predicate->num_disjuncts; i++) {
+        const struct_predicate *const disjunct = &predicate->disjuncts[i];
+        mark_rows_given_predicate(columns[disjunct->lhs.column], index, num_row, disjunct, &sets[i], flags);
+    }
+
+    int slow = 0;
+    for (int fast = 0; fast < num_row; fast++) {
+        index[slow] = index[fast];
+        slow += flags[fast];
+    }
+
+    free(flags);
+    return slow;
+}
+
+/**
+ * What an operator actually did, for EXPLAIN ANALYZE
+ */
+typedef struct {
+    // wall time, in microseconds
+    long time;
+
+    // rows going in, for a join the rows of its left side
+    long rows_in;
+    // for a join, rows of its right side
+    long rows_in_right;
+    long rows_out;
+
+    // bytes of column data read from disk
+    size_t bytes_read;
+} struct_operator_stats;
+
+// start measuring an operator, stats is @nullable
+static inline void begin_operator_stats(struct_operator_stats *const stats, const long rows_in) {
+    if (stats != NULL) {
+        stats->rows_in = rows_in;
+        stats->rows_in_right = 0;
+        stats->time = time_in_microseconds();
+        stats->bytes_read = count_bytes_read;
+    }
+}
+
+// stop measuring an operator, stats is @nullable
+static inline void end_operator_stats(struct_operator_stats *const stats, const long rows_out) {
+    if (stats != NULL) {
+        stats->time = time_in_microseconds() - stats->time;
+        stats->bytes_read = count_bytes_read - stats->bytes_read;
+        stats->rows_out = rows_out;
+    }
+}
+
+// number of rows of a relation checked at a time against all of its predicates
+#ifndef SIZE_SELECT_BLOCK
+#define SIZE_SELECT_BLOCK 4096
+#endif
+
+/**
+ * A column read from disk a block of rows at a time, see filter_data_given_predicates
+ */
+typedef struct {
+    // @nullable: the column file, NULL if the column is in the buffer of the relation
+    FILE *stream;
+
+    // numbers of the block of rows read last, SIZE_SELECT_BLOCK of them
+    int *numbers;
+    // first row of the block, -1 if none is read yet
+    int first_row;
+} struct_column_stream;
+
+void init_struct_column_stream(struct_column_stream *column_stream, const struct_file *const file, const int column) {
+    column_stream->stream = NULL;
+    column_stream->numbers = NULL;
+    column_stream->first_row = -1;
+
+    // buffer hit
+    if (file->column.column == column) {
+        return;
+    }
+
+    char path_file[LENGTH_FILE_NAME] = {'\0'};
+    get_name_file_column(file->relation, column, path_file);
+
+    column_stream->stream = fopen(path_file, "rb");
+    ASSERT(column_stream->stream != NULL);
+    setvbuf(column_stream->stream, NULL, _IONBF, 0);
+
+    column_stream->numbers = (int *) malloc(SIZE_SELECT_BLOCK * sizeof(int));
+}
+
+void free_struct_column_stream(struct_column_stream *column_stream) {
+    if (column_stream->stream != NULL) {
+        fclose(column_stream->stream);
+    }
+    free(column_stream->numbers);
+}
+
+/**
+ * Numbers of the column, indexed by row, valid for rows [first_row, first_row + SIZE_SELECT_BLOCK)
+ * The block is read from disk unless it is the block read last
+ */
+const int *column_stream_rows(struct_column_stream *const column_stream,
+                              const struct_file *const file,
+                              const int first_row) {
+    if (column_stream->stream == NULL) {
+        return file->column.columns;
+    }
+
+    if (column_stream->first_row != first_row) {
+        const size_t num_rows = std::min(SIZE_SELECT_BLOCK, file->num_row - first_row);
+
+        fseek(column_stream->stream, (long) first_row * sizeof(int), SEEK_SET);
+        size_t size_read = fread(column_stream->numbers, sizeof(int), num_rows, column_stream->stream);
+        assert(size_read == num_rows);
+        count_bytes_read += size_read * sizeof(int);
+
+        column_stream->first_row = first_row;
+    }
+
+    return column_stream->numbers - first_row;
+}
+
+/**
+ * Open a stream for every column of the predicates, and build the numbers of each IN
+ *
+ * @param file
+ * @param predicates: all on file
+ * @param num_predicates
+ * @param column_streams: by column ID, opened if is_used
+ * @param is_used: by column ID
+ * @param value_sets: numbers of each IN, of each predicate, or each predicate of its OR group
+ */
+void init_predicate_columns(const struct_file *const file,
+                            const struct_predicate *const predicates,
+                            const int num_predicates,
+                            std::vector<struct_column_stream> &column_streams,
+                            std::vector<bool> &is_used,
+                            std::vector<std::vector<struct_value_set>> &value_sets) {
+    for (int i = 0; i < num_predicates; i++) {
+        const struct_predicate *const predicate = &predicates[i];
+        ASSERT(file->relation == predicate->lhs.relation);
+
+        const int num_disjuncts = predicate->op == OR ? predicate->num_disjuncts : 1;
+        value_sets.push_back(std::vector<struct_value_set>(num_disjuncts, struct_value_set()));
+
+        for (int j = 0; j < num_disjuncts; j++) {
+            const struct_predicate *const disjunct = predicate->op == OR ? &predicate->disjuncts[j] : predicate;
+            const int column = disjunct->lhs.column;
+
+            if (disjunct->op == IN) {
+                init_struct_value_set(&value_sets.back()[j], disjunct);
+            }
+
+            if (!is_used[column]) {
+                init_struct_column_stream(&column_streams[column], file, column);
+                is_used[column] = true;
+            }
+        }
+    }
+}
+
+void free_predicate_columns(std::vector<struct_column_stream> &column_streams,
+                            const std::vector<bool> &is_used,
+                            std::vector<std::vector<struct_value_set>> &value_sets) {
+    for (int column = 0; column < column_streams.size(); column++) {
+        if (is_used[column]) {
+            free_struct_column_stream(&column_streams[column]);
+        }
+    }
+
+    for (auto &sets: value_sets) {
+        for (auto &set: sets) {
+            free_struct_value_set(&set);
+        }
+    }
+}
+
+/**
+ * Keep rows of a block that meet the predicate, with its columns read from their streams
+ *
+ * @param columns: by column ID, the numbers of the block of each column read
+ * @param sets: see init_predicate_columns
+ * @return number of rows kept
+ */
+static inline int select_block_given_predicate(const struct_file *const file,
+                                               const struct_predicate *const predicate,
+                                               const struct_value_set *const sets,
+                                               struct_column_stream *const column_streams,
+                                               const int **const columns,
+                                               const int first_row,
+                                               int *const block,
+                                               const int num_block) {
+    if (predicate->op == OR) {
+        for (int j = 0; j < predicate->num_disjuncts; j++) {
+            const int column = predicate->disjuncts[j].lhs.column;
+            columns[column] = column_stream_rows(&column_streams[column], file, first_row);
+        }
+
+        return select_rows_given_disjuncts(columns, block, num_block, predicate, sets);
+    }
+
+    const int column = predicate->lhs.column;
+    columns[column] = column_stream_rows(&column_streams[column], file, first_row);
+
+    return select_rows_given_predicate(columns[column], block, num_block, predicate, &sets[0]);
+}
+
+/**
+ * Filter data in the relation, given predicates like A.c3 < 7666, all on this relation
+ * And create filered index for input file
+ *
+ * All predicates are evaluated in one pass over the index, a block of SIZE_SELECT_BLOCK rows at a time:
+ * each predicate narrows the rows of the block left by the ones before it, and the rows left are moved down the index.
+ * A column is only read from disk for blocks that still have rows when its predicate is reached,
+ * so put the predicates that drop the most rows first, see order_predicates
+ *
+ * @param file
+ * @param predicates
+ * @param num_predicates
+ * @param stats: @nullable, one for each predicate
+ */
+void filter_data_given_predicates(struct_file *file,
+                                  const struct_predicate *const predicates,
+                                  const int num_predicates,
+                                  struct_operator_stats *const stats) {
+    if (stats != NULL) {
+        memset(stats, 0, num_predicates * sizeof(struct_operator_stats));
+    }
+
+    // empty file, do nothing
+    if (file->num_row == 0) {
+        return;
+    }
+
+    // if dataframe is NULL, every row is checked, and only rows kept are written to the index
+    const int is_all_rows = file->df == NULL;
+    if (is_all_rows) {
+        init_struct_data_frame_for_file_unfilled(file);
+    }
+
+    // empty data frame, do nothing
+    if (file->df->num_row == 0) {
+        return;
+    }
+
+    struct_data_frame *const df = file->df;
+    const int num_row = df->num_row;
+
+    // every column of the predicates, by its ID
+    std::vector<struct_column_stream> column_streams(file->num_col);
+    std::vector<const int *> columns(file->num_col, NULL);
+    std::vector<bool> is_used(file->num_col, false);
+
+    // numbers of each IN, of each predicate, or each predicate of its OR group
+    std::vector<std::vector<struct_value_set>> value_sets;
+
+    init_predicate_columns(file, predicates, num_predicates, column_streams, is_used, value_sets);
+
+    // rows of a block, when every row is checked
+    int rows[SIZE_SELECT_BLOCK];
+
+    // rows kept by the first predicate, it is the only one checked on every row of the relation
+    long num_kept_first = 0;
+
+    int slow = 0;
+    for (int fast = 0; fast < num_row;) {
+        int first_row, num_block;
+        int *block;
+
+        if (is_all_rows) {
+            first_row = fast;
+            num_block = std::min(SIZE_SELECT_BLOCK, num_row - fast);
+            block = rows;
+
+            for (int i = 0; i < num_block; i++) {
+                rows[i] = first_row + i;
+            }
+        } else {
+            // rows of the index in the same block, usually a run since the index is ascending
+            first_row = df->index[fast] / SIZE_SELECT_BLOCK * SIZE_SELECT_BLOCK;
+
+            int end = fast;
+            while (end < num_row && df->index[end] >= first_row && df->index[end] < first_row + SIZE_SELECT_BLOCK) {
+                end++;
+            }
+
+            num_block = end - fast;
+            block = df->index + fast;
+        }
+        fast += num_block;
+
+        for (int i = 0; i < num_predicates && num_block != 0; i++) {
+            const struct_predicate *const predicate = &predicates[i];
+
+            struct_operator_stats *const stats_predicate = stats == NULL ? NULL : &stats[i];
+            const long time_begin = stats_predicate == NULL ? 0 : time_in_microseconds();
+            const size_t bytes_begin = count_bytes_read;
+            const int num_in = num_block;
+
+            num_block = select_block_given_predicate(file, predicate, value_sets[i].data(), column_streams.data(),
+                                                     columns.data(), first_row, block, num_block);
+
+            if (stats_predicate != NULL) {
+                stats_predicate->time += time_in_microseconds() - time_begin;
+                stats_predicate->bytes_read += count_bytes_read - bytes_begin;
+                stats_predicate->rows_in += num_in;
+                stats_predicate->rows_out += num_block;
+            }
+            num_kept_first += i == 0 ? num_block : 0;
+        }
+
+        // rows kept never overtake rows checked, so the block is moved down in place
+        memmove(df->index + slow, block, num_block * sizeof(int));
+        slow += num_block;
+    }
+
+    free_predicate_columns(column_streams, is_used, value_sets);
+
+    if (is_all_rows && num_predicates != 0) {
+        record_predicate_feedback(predicates[0], file, num_row, num_kept_first);
+    }
+
+    df->num_row = slow;
+
+    // if no rows selected, empty the index
+    if (df->num_row == 0) {
+        free(df->index);
+        df->index = NULL;
+    } else {
+        // realloc memory for df->index
+        df->index = (int *) realloc(df->index, df->num_row * sizeof(int));
+    }
+}
+
+/**
+ * Filter data in the relation, given predicate like A.c3 < 7666, see filter_data_given_predicates
+ *
+ * @param file
+ * @param predicate
+ */
+void filter_data_given_predicate(struct_file *file, const struct_predicate *const predicate) {
+    filter_data_given_predicates(file, predicate, 1, NULL);
+}
+
+/**
+ * Join two data frames
+ *
+ * The intermediate is sorted by its column of the join, then for each row of right,
+ * the rows of intermediate that match are a range found by binary search:
+ * a run of equal numbers for =, a prefix for <, and a suffix for >.
+ * A band, such as A.c1 > B.c0 AND A.c1 < B.c2, is the intersection of the ranges of its two clauses.
+ *
+ * The result replaces intermediate, each of its rows is a row of intermediate followed by a row of right
+ *
+ * @param loaded_files
+ * @param intermediate
+ * @param right: a relation (its df), or the result of other joins
+ * @param join: lhs is in intermediate, rhs is in right
+ * @param band: @nullable, another clause with the same lhs as join, and the same rhs relation
+ */
+void sorted_nested_loop_join_data_frames(const struct_files *const loaded_files,
+                                         struct_data_frame *const intermediate,
+                                         const struct_data_frame *const right,
+                                         const struct_join *join,
+                                         const struct_join *band) {
+    ASSERT(loaded_files != NULL && intermediate != NULL && right != NULL && join != NULL);
+    ASSERT(band == NULL || (band->lhs.relation == join->lhs.relation && band->lhs.column == join->lhs.column
+                            && band->rhs.relation == join->rhs.relation));
+
+    ///////////////////////////////////
+    // The new relations after join //
+    //////////////////////////////////
+    // number of relations, or number of index per row, of each dataframe
+    int num_relations_before = strlen(intermediate->relations);
+    int num_relations_right = strlen(right->relations);
+
+    // make room for ending \0
+    size_t length_joined_relations = num_relations_before + num_relations_right + 1;
+    // the name of the new relations, remeber to free the one from inter and assign this to it
+    char *relations_joined = (char *) malloc(length_joined_relations * sizeof(char));
+    // assign value
+    memcpy(relations_joined, intermediate->relations, num_relations_before);
+    memcpy(relations_joined + num_relations_before, right->relations, num_relations_right);
+    relations_joined[length_joined_relations - 1] = '\0';
+
+    /////////////////////////////////////////
+    // Stack for temp storing join results //
+    ////////////////////////////////////////
+    // we use the stack again, to store join results (index of rows)
+    struct_parse_context c;
+    init_struct_parse_context(&c, NULL);
+
+    int offset_column_left = findIndexOf(intermediate->relations,
+                                         num_relations_before,
+                                         join->lhs.relation);
+    int offset_column_right = findIndexOf(right->relations,
+                                          num_relations_right,
+                                          join->rhs.relation);
+
+    //////////////////
+    // read columns //
+    //////////////////
+    struct_file *const file_left = loaded_files->files + (join->lhs.relation - 'A');
+    struct_file *const file_right = loaded_files->files + (join->rhs.relation - 'A');
+    const int *const column_left = select_column_from_file(file_left, join->lhs.column);
+    const int *const column_right = select_column_from_file(file_right, join->rhs.column);
+
+    // file only buffers one column, so keep a copy of the column of band
+    int *column_band = NULL;
+    if (band != NULL) {
+        column_band = (int *) malloc(file_right->num_row * sizeof(int));
+        read_column_from_file(file_right, band->rhs.column, column_band);
+    }
+
+    ///////////////////////////
+    // Buffer for outer loop //
+    ///////////////////////////
+    // todo: mem full: since a entire column can always fit in memeory, we read them in and sort
+    // buffer numbers in a column as a pair (number, row), sort buffer by number
+    int length_buffer_outer_loop = intermediate->num_row;
+    struct_number_row *buffer_outer_loop = (struct_number_row *) malloc(
+            length_buffer_outer_loop * sizeof(struct_number_row));
+
+    // fill buffer with (number, index in df.index)
+    for (int i = 0; i < length_buffer_outer_loop; i++) {
+        buffer_outer_loop[i].row = i;
+        buffer_outer_loop[i].number = column_left[
+                intermediate->index[i * num_relations_before + offset_column_left]
+        ];
+    }
+
+    // qsort
+    qsort(buffer_outer_loop, length_buffer_outer_loop, sizeof(struct_number_row), cmp_struct_number_row_qsort);
+
+    // inner loop
+    // binary search the range of each number from the right in the left
+    for (int row_right = 0; row_right < right->num_row; row_right++) {
+        const int *const index_right = &right->index[row_right * num_relations_right];
+        const int row_file = index_right[offset_column_right];
+
+        int begin = 0, end = length_buffer_outer_loop;
+        narrow_range_of_join(buffer_outer_loop, length_buffer_outer_loop, join->op, column_right[row_file],
+                             &begin, &end);
+
+        if (band != NULL) {
+            narrow_range_of_join(buffer_outer_loop, length_buffer_outer_loop, band->op, column_band[row_file],
+                                 &begin, &end);
+        }
+
+        // loop through buffer
+        // i = index of elements that match the number of row_right
+        for (int i = begin; i < end; i++) {
+            // push this row (based on original file) into stack
+            // copy index[row_inter] from inter, and concat it with index[row_right]
+            size_t size_to_copy = num_relations_before * sizeof(int);
+
+            memcpy(context_push(&c, size_to_copy),
+                   &(intermediate->index[buffer_outer_loop[i].row * num_relations_before]),
+                   size_to_copy);
+
+            memcpy(context_push(&c, num_relations_right * sizeof(int)),
+                   index_right,
+                   num_relations_right * sizeof(int));
+        }
+    }
+
+    /////////////
+    // cleanup //
+    ////////////
+    free(intermediate->relations);
+    free(intermediate->index);
+
+    intermediate->relations = relations_joined;
+
+    // copy index
+    // size of index, in bytes
+    size_t top = c.top;
+
+    if (top == 0) {
+        intermediate->index = NULL;
+        intermediate->num_row = 0;
+        free_struct_parse_context(&c);
+    } else {
+        // directly use the stack's memory, without creating new space and copying
+        int *tmp_index = (int *) context_pop(&c, top);
+        // manually empty c
+        c.top = 0;
+        c.size = 0;
+        c.stack = NULL;
+
+        intermediate->index = (int *) realloc(tmp_index, top);
+
+        // bytes / sizeof int / number per row = num of row
+        intermediate->num_row = top / strlen(intermediate->relations) / sizeof(int);
+    }
+
+    // don't free struct_parser
+    free(buffer_outer_loop);
+    free(column_band);
+}
+
+/**
+ * (Left deep) join an intermediate with a relation, see sorted_nested_loop_join_data_frames
+ *
+ * @param loaded_files
+ * @param intermediate
+ * @param relation
+ * @param join: lhs is in intermediate, rhs is in relation
+ * @param band: @nullable, another clause with the same lhs as join, and rhs in relation
+ */
+void sorted_nested_loop_join(const struct_files *const loaded_files,
+                             struct_data_frame *const intermediate,
+                             struct_file *const relation,
+                             const struct_join *join,
+                             const struct_join *band) {
+    ASSERT(relation != NULL);
+
+    if (relation->df == NULL) {
+        init_struct_data_frame_for_file(relation);
+    }
+
+    sorted_nested_loop_join_data_frames(loaded_files, intermediate, relation->df, join, band);
+}
+
+void sorted_nested_loop_join_both_joined_before(const struct_files *const loaded_files,
+                                                struct_data_frame *const intermediate,
+                                                const struct_join *join) {
+    ASSERT(loaded_files != NULL && intermediate != NULL && join != NULL);
+
+    // we use the stack again
+    struct_parse_context c;
+    init_struct_parse_context(&c, NULL);
+
+    int num_relations = strlen(intermediate->relations);
+
+    int offset_lhs = findIndexOf(intermediate->relations,
+                                 num_relations,
+                                 join->lhs.relation);
+    int offset_rhs = findIndexOf(intermediate->relations,
+                                 num_relations,
+                                 join->rhs.relation);
+
+    struct_file *const file_left = loaded_files->files + (join->lhs.relation - 'A');
+    struct_file *const file_right = loaded_files->files + (join->rhs.relation - 'A');
+    const int *const column_left = select_column_from_file(file_left, join->lhs.column);
+    const int *const column_right = select_column_from_file(file_right, join->rhs.column);
+
+
+    // for each row in inter
+    for (int i = 0; i < intermediate->num_row; i++) {
+        const int *const row_index = &intermediate->index[i * num_relations];
+
+        int number_left = column_left[row_index[offset_lhs]];
+        int number_right = column_right[row_index[offset_rhs]];
+
+        if (satisfy_join(number_left, join->op, number_right)) {
+            size_t size_row = num_relations * sizeof(int);
+
+            memcpy(context_push(&c, size_row),
+                   row_index,
+                   size_row);
+        }
+    }
+
+    // re-assign index
+    free(intermediate->index);
+
+    // copy index
+    // size of index, in bytes
+    size_t top = c.top;
+    if (top == 0) {
+        intermediate->index = NULL;
+        intermediate->num_row = 0;
+    } else {
+        // memcpy
+        int *tmp_index = (int *) context_pop(&c, top);
+        intermediate->index = (int *) malloc(top);
+        memcpy(intermediate->index, tmp_index, top);
+
+        // bytes / sizeof int / number per row = num of row
+        intermediate->num_row = top / num_relations / sizeof(int);
+    }
+
+    free_struct_parse_context(&c);
+}
+
+// key of a column in infer_predicates
+static inline int key_of_relation_column(const struct_relation_column &rc) {
+    return (rc.relation - 'A') << 16 | rc.column;
+}
+
+// root of the equivalence class of key, see infer_predicates
+static int find_equivalence_class(std::unordered_map<int, int> &parent, const int key) {
+    auto it = parent.find(key);
+    if (it == parent.end() || it->second == key) {
+        return key;
+    }
+
+    return it->second = find_equivalence_class(parent, it->second);
+}
+
+// if the two predicates are the same, in the same order for lists and OR groups
+static bool is_same_predicate(const struct_predicate &a, const struct_predicate &b) {
+    if (a.lhs.relation != b.lhs.relation || a.lhs.column != b.lhs.column || a.op != b.op) {
+        return false;
+    }
+
+    switch (a.op) {
+        case IN:
+            return a.num_values == b.num_values && memcmp(a.values, b.values, a.num_values * sizeof(int)) == 0;
+        case BETWEEN:
+            return a.rhs == b.rhs && a.rhs_high == b.rhs_high;
+        case OR: {
+            bool is_same = a.num_disjuncts == b.num_disjuncts;
+            for (int i = 0; i < a.num_disjuncts && is_same; i++) {
+                is_same = is_same_predicate(a.disjuncts[i], b.disjuncts[i]);
+            }
+            return is_same;
+        }
+        default:
+            return a.rhs == b.rhs;
+    }
+}
+
+/**
+ * Infer predicates through = joins, and add them to the fourth line of the query
+ *
+ * Columns joined by = are in the same equivalence class, they have the same number in every row of the result.
+ * So a predicate on a column, a constant, a range, a list or an OR group of the same column,
+ * also holds on every other column of its class, which filters that relation before the joins.
+ *
+ * @param query
+ * @param arena: where the new predicates are allocated, it has to live as long as the query is executed
+ */
+void infer_predicates(struct_query *const query, struct_arena *const arena) {
+    const struct_third_line *const tl = &query->third;
+    struct_fourth_line *const fl = &query->fourth;
+
+    // union find over columns joined by =
+    std::unordered_map<int, int> parent;
+    for (int i = 0; i < tl->length; i++) {
+        const struct_join &join = tl->joins[i];
+
+        if (join.op == EQUAL) {
+            const int lhs = find_equivalence_class(parent, key_of_relation_column(join.lhs));
+            const int rhs = find_equivalence_class(parent, key_of_relation_column(join.rhs));
+            parent[lhs] = lhs;
+            parent[rhs] = lhs;
+        }
+    }
+
+    if (parent.empty()) {
+        return;
+    }
+
+    // members of each class
+    std::unordered_map<int, std::vector<struct_relation_column>> classes;
+    for (int i = 0; i < tl->length; i++) {
+        const struct_join &join = tl->joins[i];
+
+        if (join.op == EQUAL) {
+            for (const auto &rc: {join.lhs, join.rhs}) {
+                auto &members = classes[find_equivalence_class(parent, key_of_relation_column(rc))];
+
+                bool is_member = false;
+                for (const auto &member: members) {
+                    is_member |= member.relation == rc.relation && member.column == rc.column;
+                }
+
+                if (!is_member) {
+                    members.push_back(rc);
+                }
+            }
+        }
+    }
+
+    std::vector<struct_predicate> predicates(fl->predicates, fl->predicates + fl->length);
+    for (int i = 0; i < fl->length; i++) {
+        const struct_predicate &predicate = fl->predicates[i];
+
+        // an OR group is only moved as a whole, if it is on one column
+        bool is_one_column = true;
+        for (int j = 0; j < (predicate.op == OR ? predicate.num_disjuncts : 0); j++) {
+            is_one_column &= predicate.disjuncts[j].lhs.column == predicate.lhs.column;
+        }
+
+        auto it = classes.find(find_equivalence_class(parent, key_of_relation_column(predicate.lhs)));
+        if (!is_one_column || it == classes.end()) {
+            continue;
+        }
+
+        for (const auto &member: it->second) {
+            struct_predicate inferred = predicate;
+            inferred.lhs = member;
+
+            if (predicate.op == OR) {
+                inferred.disjuncts = (struct_predicate *) arena_alloc(
+                        arena, predicate.num_disjuncts * sizeof(struct_predicate));
+
+                for (int j = 0; j < predicate.num_disjuncts; j++) {
+                    inferred.disjuncts[j] = predicate.disjuncts[j];
+                    inferred.disjuncts[j].lhs = member;
+                }
+            }
+
+            bool is_known = false;
+            for (const auto &known: predicates) {
+                is_known |= is_same_predicate(known, inferred);
+            }
+
+            if (!is_known) {
+                predicates.push_back(inferred);
+            }
+        }
+    }
+
+    if (predicates.size() == fl->length) {
+        return;
+    }
+
+    fl->predicates = (struct_predicate *) arena_alloc(arena, predicates.size() * sizeof(struct_predicate));
+    memcpy(fl->predicates, predicates.data(), predicates.size() * sizeof(struct_predicate));
+    fl->length = predicates.size();
+}
+
+///////////////////
+// Row set cache //
+///////////////////
+
+// bytes of rows the cache holds, the least recently used row sets are evicted past it
+#ifndef ROW_SET_CACHE_BYTES
+#define ROW_SET_CACHE_BYTES (256 << 20)
+#endif
+
+/**
+ * Rows of a relation that meet a set of predicates, kept across queries and batches
+ */
+class CachedRowSet {
+public:
+    // key of each predicate, sorted, see predicate_key
+    std::vector<std::string> predicates;
+
+    // ascending
+    std::vector<int> rows;
+
+    // value of row_set_cache_clock when it was last used
+    long last_used;
+};
+
+/**
+ * key: relation - 'A'
+ * value: row sets of the relation
+ */
+static std::vector<CachedRowSet> row_set_cache[26];
+static size_t row_set_cache_bytes = 0;
+static long row_set_cache_clock = 0;
+
+// A.c3 = 7 => "3=7", A.c3 IN (2, 1) => "3IN1,2", (A.c3 < 7 OR A.c1 = 2) => "(1=2|3<7)"
+const std::string predicate_key(const struct_predicate &predicate) {
+    std::stringstream ss;
+
+    if (predicate.op == OR) {
+        std::vector<std::string> disjuncts;
+        for (int i = 0; i < predicate.num_disjuncts; i++) {
+            disjuncts.push_back(predicate_key(predicate.disjuncts[i]));
+        }
+        std::sort(disjuncts.begin(), disjuncts.end());
+
+        ss << '(';
+        for (int i = 0; i < disjuncts.size(); i++) {
+            ss << (i == 0 ? "" : "|") << disjuncts[i];
+        }
+        ss << ')';
+
+        return ss.str();
+    }
+
+    ss << predicate.lhs.column << NAME_OPERATOR[predicate.op];
+    if (predicate.op == IN) {
+        std::vector<int> values(predicate.values, predicate.values + predicate.num_values);
+        std::sort(values.begin(), values.end());
+
+        for (int i = 0; i < values.size(); i++) {
+            ss << (i == 0 ? "" : ",") << values[i];
+        }
+    } else {
+        ss << predicate.rhs;
+        if (predicate.op == BETWEEN) {
+            ss << ',' << predicate.rhs_high;
+        }
+    }
+
+    return ss.str();
+}
+
+// keys of the predicates, sorted, with no duplicates
+const std::vector<std::string> predicate_keys(const struct_predicate *const predicates, const int num_predicates) {
+    std::vector<std::string> keys;
+    for (int i = 0; i < num_predicates; i++) {
+        keys.push_back(predicate_key(predicates[i]));
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    return keys;
+}
+
+/**
+ * Drop the cached row sets of the relation, once its data is gone
+ *
+ * @param relation
+ */
+void forget_row_sets(const char relation) {
+    auto &row_sets = row_set_cache[relation - 'A'];
+    for (const auto &row_set: row_sets) {
+        row_set_cache_bytes -= row_set.rows.size() * sizeof(int);
+    }
+    row_sets.clear();
+}
+
+/**
+ * The cached row set of the relation with the fewest rows, among those whose predicates are a subset of keys
+ *
+ * @param relation
+ * @param keys: sorted, see predicate_keys
+ * @return @nullable
+ */
+const CachedRowSet *find_cached_row_set(const char relation, const std::vector<std::string> &keys) {
+    CachedRowSet *best = NULL;
+
+    for (auto &row_set: row_set_cache[relation - 'A']) {
+        if ((best == NULL || row_set.rows.size() < best->rows.size())
+            && std::includes(keys.begin(), keys.end(), row_set.predicates.begin(), row_set.predicates.end())) {
+            best = &row_set;
+        }
+    }
+
+    if (best != NULL) {
+        best->last_used = ++row_set_cache_clock;
+    }
+
+    return best;
+}
+
+/**
+ * Remember the rows of the relation that meet the predicates, and evict the least recently used row sets
+ * while the cache holds more than ROW_SET_CACHE_BYTES. A row set larger than a quarter of that is not kept
+ *
+ * @param relation
+ * @param keys: sorted, see predicate_keys
+ * @param index: ascending, @nullable if num_row is 0
+ * @param num_row
+ */
+void cache_row_set(const char relation,
+                   const std::vector<std::string> &keys,
+                   const int *const index,
+                   const int num_row) {
+    const size_t size = num_row * sizeof(int);
+    if (size > ROW_SET_CACHE_BYTES / 4) {
+        return;
+    }
+
+    auto &row_sets = row_set_cache[relation - 'A'];
+    for (const auto &row_set: row_sets) {
+        if (row_set.predicates == keys) {
+            return;
+        }
+    }
+
+    CachedRowSet row_set;
+    row_set.predicates = keys;
+    row_set.rows.assign(index, index + num_row);
+    row_set.last_used = ++row_set_cache_clock;
+
+    row_sets.push_back(std::move(row_set));
+    row_set_cache_bytes += size;
+
+    while (row_set_cache_bytes > ROW_SET_CACHE_BYTES) {
+        std::vector<CachedRowSet> *oldest = NULL;
+        int position = -1;
+
+        for (auto &sets: row_set_cache) {
+            for (int i = 0; i < sets.size(); i++) {
+                if (oldest == NULL || sets[i].last_used < (*oldest)[position].last_used) {
+                    oldest = &sets;
+                    position = i;
+                }
+            }
+        }
+
+        row_set_cache_bytes -= (*oldest)[position].rows.size() * sizeof(int);
+        oldest->erase(oldest->begin() + position);
+    }
+}
+
+/**
+ * Select rows of the relation that meet the predicates, starting from the cache
+ *
+ * The cached row set of a subset of the predicates with the fewest rows is the start, and only the rest of
+ * the predicates are run on it, see filter_data_given_predicates. The rows selected are cached in turn.
+ * With stats, each predicate the cached row set already met keeps all of its rows.
+ *
+ * @param file: has no data frame yet
+ * @param predicates: all on file
+ * @param num_predicates
+ * @param stats: @nullable, one for each predicate
+ * @param index: the rows selected, ascending, from malloc, @nullable if none is
+ * @param num_row
+ * @return if a cached row set is used, otherwise index is left alone
+ */
+bool select_rows_from_cache(struct_file *const file,
+                            const struct_predicate *const predicates,
+                            const int num_predicates,
+                            struct_operator_stats *const stats,
+                            int **index,
+                            int *num_row) {
+    ASSERT(file->df == NULL);
+
+    const auto keys = predicate_keys(predicates, num_predicates);
+    const CachedRowSet *const row_set = find_cached_row_set(file->relation, keys);
+    if (row_set == NULL || file->num_row == 0) {
+        return false;
+    }
+
+    const int num_cached = row_set->rows.size();
+    int *const cached = (int *) malloc(std::max(num_cached, 1) * sizeof(int));
+    std::copy(row_set->rows.begin(), row_set->rows.end(), cached);
+    init_struct_data_frame_for_file_given_index(file, cached, num_cached);
+
+    // predicates the row set does not meet yet, and where each is in predicates
+    std::vector<struct_predicate> rest;
+    std::vector<int> positions;
+    for (int i = 0; i < num_predicates; i++) {
+        if (std::binary_search(row_set->predicates.begin(), row_set->predicates.end(), predicate_key(predicates[i]))) {
+            begin_operator_stats(stats == NULL ? NULL : &stats[i], num_cached);
+            end_operator_stats(stats == NULL ? NULL : &stats[i], num_cached);
+        } else {
+            rest.push_back(predicates[i]);
+            positions.push_back(i);
+        }
+    }
+
+    if (!rest.empty()) {
+        std::vector<struct_operator_stats> stats_rest(rest.size());
+        filter_data_given_predicates(file, rest.data(), rest.size(), stats == NULL ? NULL : stats_rest.data());
+
+        for (int i = 0; stats != NULL && i < rest.size(); i++) {
+            stats[positions[i]] = stats_rest[i];
+        }
+
+        cache_row_set(file->relation, keys, file->df->index, file->df->num_row);
+    }
+
+    *num_row = file->df->num_row;
+    *index = *num_row == 0 ? NULL : file->df->index;
+    if (*num_row == 0) {
+        free(file->df->index);
+    }
+
+    // the rows are handed over, not freed with the data frame
+    file->df->index = NULL;
+    free_struct_data_frame_of_file(file);
+
+    return true;
+}
+
+/**
+ * Execute the fourth line of SQL query
+ *
+ * Predicates are put in the order they are executed, see order_predicates,
+ * then all predicates of each relation are evaluated together in one pass.
+ * A relation starts from the rows cached for a subset of its predicates, see select_rows_from_cache
+ *
+ * @param loaded_file
+ * @param fl
+ * @param stats: @nullable, one for each predicate, in the order they are executed
+ */
+void execute_selects(struct_files *const loaded_file,
+                     struct_fourth_line *const fl,
+                     struct_operator_stats *const stats) {
+    order_predicates(loaded_file, fl);
+
+    for (int begin = 0, end = 0; begin < fl->length; begin = end) {
+        const char relation = fl->predicates[begin].lhs.relation;
+        while (end < fl->length && fl->predicates[end].lhs.relation == relation) {
+            end++;
+        }
+
+        struct_file *const file = &loaded_file->files[relation - 'A'];
+        const struct_predicate *const predicates = &fl->predicates[begin];
+        struct_operator_stats *const stats_relation = stats == NULL ? NULL : &stats[begin];
+
+        int *index;
+        int num_row;
+        if (select_rows_from_cache(file, predicates, end - begin, stats_relation, &index, &num_row)) {
+            init_struct_data_frame_for_file_given_index(file, index, num_row);
+            continue;
+        }
+
+        filter_data_given_predicates(file, predicates, end - begin, stats_relation);
+        if (file->df != NULL) {
+            cache_row_set(relation, predicate_keys(predicates, end - begin), file->df->index, file->df->num_row);
+        }
+    }
+}
+
+//////////////////
+// Shared scans //
+//////////////////
+
+// queries of the batch whose selects are run together, see execute_queries
+#ifndef SHARED_SCAN_BATCH
+#define SHARED_SCAN_BATCH 16
+#endif
+
+/**
+ * Predicates of one query on a relation, and the rows that meet them
+ */
+typedef struct {
+    // in the order they are run, see order_predicates
+    const struct_predicate *predicates;
+    int num_predicates;
+
+    // selection vector, ascending, from malloc
+    // @nullable: if no row is selected
+    int *index;
+    int num_row;
+} struct_shared_select;
+
+/**
+ * Filter the relation for several queries in one scan, see filter_data_given_predicates
+ *
+ * The relation is read a block of SIZE_SELECT_BLOCK rows at a time, and each block of a column
+ * is read once for every query that needs it. The predicates of each query narrow the rows of the block
+ * as they do for one query, and the rows left are appended to the selection vector of that query.
+ *
+ * @param file
+ * @param selects: index of each is filled
+ * @param num_selects
+ */
+void filter_data_given_shared_selects(struct_file *file, struct_shared_select *const selects, const int num_selects) {
+    const int num_row = file->num_row;
+
+    std::vector<struct_column_stream> column_streams(file->num_col);
+    std::vector<const int *> columns(file->num_col, NULL);
+    std::vector<bool> is_used(file->num_col, false);
+
+    // of the predicates of every select, one after another
+    std::vector<std::vector<struct_value_set>> value_sets;
+    // where the predicates of each select begin in value_sets
+    std::vector<int> first_predicates(num_selects);
+
+    for (int k = 0; k < num_selects; k++) {
+        first_predicates[k] = value_sets.size();
+        init_predicate_columns(file, selects[k].predicates, selects[k].num_predicates,
+                               column_streams, is_used, value_sets);
+
+        // only pages written to are allocated, and it is shrunk after
+        selects[k].index = (int *) malloc(num_row * sizeof(int));
+        selects[k].num_row = 0;
+    }
+
+    // rows kept by the first predicate of each select, see filter_data_given_predicates
+    std::vector<long> num_kept_first(num_selects, 0);
+
+    for (int first_row = 0; first_row < num_row; first_row += SIZE_SELECT_BLOCK) {
+        const int num_rows = std::min(SIZE_SELECT_BLOCK, num_row - first_row);
+
+        for (int k = 0; k < num_selects; k++) {
+            struct_shared_select *const select = &selects[k];
+
+            // rows kept are at the end of the selection vector already
+            int *const block = select->index + select->num_row;
+            for (int i = 0; i < num_rows; i++) {
+                block[i] = first_row + i;
+            }
+
+            int num_block = num_rows;
+            for (int i = 0; i < select->num_predicates && num_block != 0; i++) {
+                const auto &sets = value_sets[first_predicates[k] + i];
+                num_block = select_block_given_predicate(file, &select->predicates[i], sets.data(),
+                                                         column_streams.data(), columns.data(), first_row,
+                                                         block, num_block);
+                num_kept_first[k] += i == 0 ? num_block : 0;
+            }
+
+            select->num_row += num_block;
+        }
+    }
+
+    free_predicate_columns(column_streams, is_used, value_sets);
+
+    for (int k = 0; k < num_selects; k++) {
+        if (selects[k].num_predicates != 0) {
+            record_predicate_feedback(selects[k].predicates[0], file, num_row, num_kept_first[k]);
+        }
+
+        if (selects[k].num_row == 0) {
+            free(selects[k].index);
+            selects[k].index = NULL;
+        } else {
+            selects[k].index = (int *) realloc(selects[k].index, selects[k].num_row * sizeof(int));
+        }
+    }
+}
+
+//////////////////////////
+// Runtime join filters //
+//////////////////////////
+
+// bits of the Bloom filter for each distinct number it holds
+#ifndef RUNTIME_FILTER_BITS_PER_KEY
+#define RUNTIME_FILTER_BITS_PER_KEY 8
+#endif
+
+/**
+ * Filter on a column of a relation, built at runtime from the numbers a data frame has on a join clause
+ *
+ * A row can only join the data frame if its number is in [min, max] for =, below max for <, above min for >.
+ * For =, the number must also be in the Bloom filter, which has false positives but no false negatives.
+ * Each number sets two bits in one word of the filter, so a lookup reads one word.
+ * If [min, max] has no more numbers than the filter has bits, it is a bitmap of them instead, with no false positives.
+ * Otherwise, a filter that must drop every row that cannot join also checks the numbers it lets through in a hash set
+ */
+typedef struct {
+    // of the relation filtered
+    struct_relation_column column;
+    enum_operator op;
+
+    int min;
+    int max;
+
+    // @nullable: NULL unless op is =
+    uint64_t *bloom;
+    // the word of a number is the top bits of its hash, 64 - shift of them
+    int shift;
+    // if bloom is a bitmap of [min, max]
+    int is_exact;
+    // @nullable: every number of the data frame, NULL unless bloom is not exact and the filter must be
+    std::unordered_set<int> *keys;
+} struct_runtime_filter;
+
+static inline uint64_t hash_runtime_filter(const int number) {
+    return (uint32_t) number * 0x9E3779B97F4A7C15ull;
+}
+
+static inline uint64_t bits_of_runtime_filter(const int shift, const uint64_t hash) {
+    return (uint64_t) 1 << ((hash >> (shift - 6)) & 63) | (uint64_t) 1 << ((hash >> (shift - 12)) & 63);
+}
+
+static inline int runtime_filter_contains(const struct_runtime_filter *const filter, const int number) {
+    if (filter->op == LESS_THAN) {
+        return number < filter->max;
+    } else if (filter->op == GREATER_THAN) {
+        return number > filter->min;
+    }
+
+    if (filter->min > filter->max || !IS_BETWEEN(number, filter->min, filter->max)) {
+        return 0;
+    }
+
+    if (filter->is_exact) {
+        const uint32_t bit = (uint32_t) number - (uint32_t) filter->min;
+        return (filter->bloom[bit >> 6] >> (bit & 63)) & 1;
+    }
+
+    const uint64_t hash = hash_runtime_filter(number);
+    const uint64_t bits = bits_of_runtime_filter(filter->shift, hash);
+
+    return (filter->bloom[hash >> filter->shift] & bits) == bits
+           && (filter->keys == NULL || filter->keys->count(number) != 0);
+}
+
+/**
+ * Build the filter of a join clause from the numbers of a data frame
+ *
+ * @param filter
+ * @param files
+ * @param df
+ * @param join: lhs is the column filtered, rhs is in df
+ * @param is_exact_required: if the filter must have no false positives
+ */
+void init_struct_runtime_filter(struct_runtime_filter *filter,
+                                struct_files *const files,
+                                const struct_data_frame *const df,
+                                const struct_join &join,
+                                const int is_exact_required) {
+    filter->column = join.lhs;
+    filter->op = join.op;
+    filter->min = INT32_MAX;
+    filter->max = INT32_MIN;
+    filter->bloom = NULL;
+    filter->shift = 64;
+    filter->is_exact = 0;
+    filter->keys = NULL;
+
+    struct_file *const file = &files->files[join.rhs.relation - 'A'];
+    const int *const columns = select_column_from_file(file, join.rhs.column);
+
+    const int num_relations = strlen(df->relations);
+    const int offset = findIndexOf(df->relations, num_relations, join.rhs.relation);
+
+    for (int i = 0; i < df->num_row; i++) {
+        const int number = columns[df->index[i * num_relations + offset]];
+        filter->min = std::min(filter->min, number);
+        filter->max = std::max(filter->max, number);
+    }
+
+    if (join.op != EQUAL || df->num_row == 0) {
+        return;
+    }
+
+    // rows of a join repeat numbers, so the filter is sized by the distinct numbers
+    const float num_keys = std::min((float) df->num_row, filtered_unique(file, join.rhs.column));
+
+    // at least 2^12 bits, so there are 12 bits of the hash under the word
+    int num_bits_word = 6;
+    while (num_bits_word < 52 && ((int64_t) 1 << num_bits_word) < num_keys * RUNTIME_FILTER_BITS_PER_KEY / 64) {
+        num_bits_word++;
+    }
+
+    filter->shift = 64 - num_bits_word;
+    filter->bloom = (uint64_t *) calloc((size_t) 1 << num_bits_word, sizeof(uint64_t));
+
+    if ((int64_t) filter->max - filter->min < (int64_t) 64 << num_bits_word) {
+        filter->is_exact = 1;
+
+        for (int i = 0; i < df->num_row; i++) {
+            const uint32_t bit = (uint32_t) columns[df->index[i * num_relations + offset]] - (uint32_t) filter->min;
+            filter->bloom[bit >> 6] |= (uint64_t) 1 << (bit & 63);
+        }
+        return;
+    }
+
+    for (int i = 0; i < df->num_row; i++) {
+        const uint64_t hash = hash_runtime_filter(columns[df->index[i * num_relations + offset]]);
+        filter->bloom[hash >> filter->shift] |= bits_of_runtime_filter(filter->shift, hash);
+    }
+
+    if (is_exact_required) {
+        filter->keys = new std::unordered_set<int>();
+        filter->keys->reserve(num_keys);
+        for (int i = 0; i < df->num_row; i++) {
+            filter->keys->insert(columns[df->index[i * num_relations + offset]]);
+        }
+    }
+}
+
+void free_struct_runtime_filter(struct_runtime_filter *filter) {
+    free(filter->bloom);
+    filter->bloom = NULL;
+
+    delete filter->keys;
+    filter->keys = NULL;
+}
+
+// keep the rows of the relation that pass the filter
+void filter_data_given_runtime_filter(struct_file *const file, const struct_runtime_filter *const filter) {
+    if (file->df == NULL) {
+        init_struct_data_frame_for_file(file);
+    }
+
+    if (file->df->num_row == 0) {
+        return;
+    }
+
+    // the join reads the whole column anyway
+    const int *const columns = select_column_from_file(file, filter->column.column);
+
+    int *const index = file->df->index;
+    int slow = 0;
+    FOR_EACH_NUMBER(columns, index, file->df->num_row, {
+        index[slow] = row;
+        slow += runtime_filter_contains(filter, number);
+    });
+
+    file->df->num_row = slow;
+}
+
+/**
+ * Sideways information passing: drop rows of relation that cannot join df, before relation is joined with anything
+ *
+ * df has to be joined with a side that has relation, which applies every clause between them, see execute_joins.
+ * So a filter is built from df for each of those clauses, and the rows of relation that fail one are dropped.
+ *
+ * @param files
+ * @param query
+ * @param df: a data frame waiting on the stack of execute_joins
+ * @param relation: filtered already
+ * @param is_exact_required: if every row that cannot join df on a clause must be dropped, see struct_runtime_filter
+ */
+void apply_runtime_filters(struct_files *const files,
+                           struct_query *const query,
+                           const struct_data_frame *const df,
+                           struct_file *const relation,
+                           const int is_exact_required) {
+    for (int i = 0; i < query->third.length; i++) {
+        struct_join join = query->third.joins[i];
+
+        if (join.rhs.relation == relation->relation) {
+            flip_join(&join);
+        }
+
+        if (join.lhs.relation != relation->relation || strchr(df->relations, join.rhs.relation) == NULL) {
+            continue;
+        }
+
+        struct_runtime_filter filter;
+        init_struct_runtime_filter(&filter, files, df, join, is_exact_required);
+        filter_data_given_runtime_filter(relation, &filter);
+        free_struct_runtime_filter(&filter);
+    }
+}
+
+////////////////////////
+// Predicate transfer //
+////////////////////////
+
+/**
+ * Drop rows of relations that cannot be in the result of the joins, before joining (predicate transfer)
+ *
+ * Relations are ordered breadth first over the join clauses, from the relation with the most rows.
+ * The forward pass goes from the last of this order to the first, and filters each relation by
+ * the runtime filters of its neighbors already passed, on every clause between them; the backward pass goes
+ * the other way. A relation passes on the reductions of all the relations passed before it,
+ * so each predicate of the query reaches every relation, over cycles of clauses too.
+ *
+ * For a tree of clauses this is the full reducer of Yannakakis, children before parents and then
+ * parents before children: every row left has a match in the result. So the filters of a tree must be exact,
+ * a Bloom filter that is not also checks a hash set of its numbers, and execute_joins runs no runtime filters on it.
+ *
+ * @param files: selects are already executed
+ * @param query
+ * @param stats: @nullable, rows of all relations before and after
+ */
+void transfer_predicates(struct_files *const files, struct_query *const query, struct_operator_stats *const stats) {
+    const int num_relations = query->second.length;
+    const char *const relations = query->second.relations;
+
+    // one clause for each pair of relations, see execute_joins
+    const int is_tree = query->third.length < num_relations;
+
+    long rows = 0;
+    char root = relations[0];
+    for (int i = 0; i < num_relations; i++) {
+        struct_file *const file = &files->files[relations[i] - 'A'];
+        rows += filtered_cardinality(file);
+
+        if (filtered_cardinality(file) > filtered_cardinality(&files->files[root - 'A'])) {
+            root = relations[i];
+        }
+
+        // runtime filters are built from data frames
+        if (file->df == NULL) {
+            init_struct_data_frame_for_file(file);
+        }
+    }
+    begin_operator_stats(stats, rows);
+
+    // relations breadth first, and the position of each
+    std::vector<char> order(1, root);
+    std::vector<int> position(26, -1);
+    position[root - 'A'] = 0;
+
+    for (int k = 0; k < order.size(); k++) {
+        for (int i = 0; i < query->third.length; i++) {
+            const struct_join &join = query->third.joins[i];
+
+            char neighbor = 0;
+            if (join.lhs.relation == order[k]) {
+                neighbor = join.rhs.relation;
+            } else if (join.rhs.relation == order[k]) {
+                neighbor = join.lhs.relation;
+            }
+
+            if (neighbor != 0 && position[neighbor - 'A'] == -1) {
+                position[neighbor - 'A'] = order.size();
+                order.push_back(neighbor);
+            }
+        }
+    }
+
+    // forward, each relation by its neighbors after it in order
+    for (int k = order.size() - 1; k >= 0; k--) {
+        for (int j = k + 1; j < order.size(); j++) {
+            apply_runtime_filters(files, query, files->files[order[j] - 'A'].df, &files->files[order[k] - 'A'],
+                                  is_tree);
+        }
+    }
+
+    // backward, each relation by its neighbors before it in order
+    for (int k = 1; k < order.size(); k++) {
+        for (int j = 0; j < k; j++) {
+            apply_runtime_filters(files, query, files->files[order[j] - 'A'].df, &files->files[order[k] - 'A'],
+                                  is_tree);
+        }
+    }
+
+    rows = 0;
+    for (int i = 0; i < num_relations; i++) {
+        rows += filtered_cardinality(&files->files[relations[i] - 'A']);
+    }
+    end_operator_stats(stats, rows);
+}
+
+// if lhs of the join clause is among the first num_left relations of left, and rhs is in right
+static inline int is_join_between(const struct_join *const join,
+                                  const char *const left,
+                                  const int num_left,
+                                  const char *const right) {
+    return findIndexOf(left, num_left, join->lhs.relation) != -1
+           && findIndexOf(right, strlen(right), join->rhs.relation) != -1;
+}
+
+/**
+ * Pick the join clauses to join two data frames with
+ *
+ * Every join clause between the two sides is flipped to have its lhs in left, and the first one is picked
+ * to join them. Another clause with the same lhs column and rhs relation, like A.c1 > B.c0 AND A.c1 < B.c2,
+ * is applied in the same pass as a band. The rest are filters on the result.
+ *
+ * @param tl
+ * @param left: relations of the left side
+ * @param right: relations of the right side
+ * @param join: NULL if there is no clause between the two sides
+ * @param band: @nullable
+ */
+void pick_join_clauses(const struct_third_line *const tl,
+                       const char *const left,
+                       const char *const right,
+                       struct_join **join,
+                       struct_join **band) {
+    const int num_left = strlen(left);
+
+    *join = NULL;
+    *band = NULL;
+    for (int i = 0; i < tl->length; i++) {
+        struct_join *clause = &tl->joins[i];
+
+        if (findIndexOf(left, num_left, clause->rhs.relation) != -1
+            && findIndexOf(right, strlen(right), clause->lhs.relation) != -1) {
+            flip_join(clause);
+        }
+
+        if (!is_join_between(clause, left, num_left, right)) {
+            continue;
+        }
+
+        if (*join == NULL) {
+            *join = clause;
+        } else if (*band == NULL && clause->lhs.relation == (*join)->lhs.relation
+                   && clause->lhs.column == (*join)->lhs.column && clause->rhs.relation == (*join)->rhs.relation) {
+            *band = clause;
+        }
+    }
+}
+
+// re-plan the rest of the joins when a join has this many times more, or fewer, rows than estimated
+#ifndef ADAPTIVE_REOPTIMIZE_RATIO
+#define ADAPTIVE_REOPTIMIZE_RATIO 8.0f
+#endif
+
+/**
+ * A data frame on the stack of execute_joins, with the part of the plan that made it
+ */
+class JoinStackEntry {
+public:
+    struct_data_frame *df;
+    // if df is the result of joins, which is freed after use, otherwise it is df of a relation
+    int is_owned;
+
+    Order order;
+    // one for each element of order
+    std::vector<struct_operator_stats> stats;
+};
+
+///////////////////////
+// Join result cache //
+///////////////////////
+
+// bytes of join results the cache holds, the least recently used join results are evicted past it
+#ifndef JOIN_RESULT_CACHE_BYTES
+#define JOIN_RESULT_CACHE_BYTES (256 << 20)
+#endif
+
+/**
+ * Result of joining some relations of a query, kept across queries and batches
+ *
+ * It is the join of the rows each relation had when it was joined, so it serves any query with the same join clauses
+ * between these relations, whose rows of each relation are among those, see restrict_cached_join_result
+ */
+class CachedJoinResult {
+public:
+    // the relations and the join clauses between them, see normalize_join_subgraph
+    std::string key;
+
+    // relations of the data frame, and its index, see struct_data_frame
+    std::string relations;
+    std::vector<int> index;
+
+    // for each of relations, the rows it was joined from, one bit for each row, and how many they are
+    std::vector<std::vector<uint64_t>> inputs;
+    std::vector<int> num_inputs;
+
+    // plan that joined it, and what each step of it did
+    Order order;
+    std::vector<struct_operator_stats> stats;
+
+    // bytes of memory it holds
+    size_t size;
+
+    // value of join_result_cache_clock when it was last used
+    long last_used;
+};
+
+static std::vector<CachedJoinResult> join_result_cache;
+static size_t join_result_cache_bytes = 0;
+static long join_result_cache_clock = 0;
+
+// one bit for each row of the relation, set for the rows of its data frame
+static void rows_of_file_to_bitmap(const struct_file *const file, std::vector<uint64_t> &bitmap) {
+    ASSERT(file->df != NULL);
+
+    bitmap.assign((file->num_row + 63) / 64, 0);
+    for (int i = 0; i < file->df->num_row; i++) {
+        const int row = file->df->index[i];
+        bitmap[row >> 6] |= (uint64_t) 1 << (row & 63);
+    }
+}
+
+static inline int bitmap_contains(const std::vector<uint64_t> &bitmap, const int row) {
+    return (bitmap[row >> 6] >> (row & 63)) & 1;
+}
+
+/**
+ * Drop the cached join results of the relation, once its data is gone
+ *
+ * @param relation
+ */
+void forget_join_results(const char relation) {
+    for (int i = 0; i < join_result_cache.size();) {
+        if (join_result_cache[i].relations.find(relation) != std::string::npos) {
+            join_result_cache_bytes -= join_result_cache[i].size;
+            join_result_cache.erase(join_result_cache.begin() + i);
+        } else {
+            i++;
+        }
+    }
+}
+
+// if every row each relation of the cached result has now is among the rows it was joined from
+bool is_cached_join_result_of_rows(const CachedJoinResult &cached, struct_files *const files) {
+    for (int i = 0; i < cached.relations.size(); i++) {
+        const struct_file *const file = &files->files[cached.relations[i] - 'A'];
+        if (file->df->num_row > cached.num_inputs[i]) {
+            return false;
+        }
+
+        for (int j = 0; j < file->df->num_row; j++) {
+            if (!bitmap_contains(cached.inputs[i], file->df->index[j])) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Remember the result of joins, with the rows each of its relations has now, and evict the least recently used
+ * join results while the cache holds more than JOIN_RESULT_CACHE_BYTES. A result larger than a quarter of that,
+ * or one that a cached result of the same joins from a superset of the rows already has, is not kept
+ *
+ * @param files: each relation of entry has the rows it was joined from
+ * @param query
+ * @param entry: result of joins, on the stack of execute_joins
+ */
+void cache_join_result(struct_files *const files, struct_query *const query, const JoinStackEntry &entry) {
+    const struct_data_frame *const df = entry.df;
+    const int width = strlen(df->relations);
+
+    size_t size = (size_t) df->num_row * width * sizeof(int);
+    for (int i = 0; i < width; i++) {
+        size += (files->files[df->relations[i] - 'A'].num_row + 63) / 64 * sizeof(uint64_t);
+    }
+
+    if (size > JOIN_RESULT_CACHE_BYTES / 4) {
+        return;
+    }
+
+    const auto key = normalize_join_subgraph(query, std::vector<char>(df->relations, df->relations + width));
+    for (const auto &cached: join_result_cache) {
+        if (cached.key == key && is_cached_join_result_of_rows(cached, files)) {
+            return;
+        }
+    }
+
+    CachedJoinResult result;
+    result.key = key;
+    result.relations = df->relations;
+    result.index.assign(df->index, df->index + (size_t) df->num_row * width);
+
+    result.inputs.resize(width);
+    for (int i = 0; i < width; i++) {
+        const struct_file *const file = &files->files[df->relations[i] - 'A'];
+
+        rows_of_file_to_bitmap(file, result.inputs[i]);
+        result.num_inputs.push_back(file->df->num_row);
+    }
+
+    result.order = entry.order;
+    result.stats = entry.stats;
+    result.size = size;
+    result.last_used = ++join_result_cache_clock;
+
+    join_result_cache.push_back(std::move(result));
+    join_result_cache_bytes += size;
+
+    while (join_result_cache_bytes > JOIN_RESULT_CACHE_BYTES) {
+        int oldest = 0;
+        for (int i = 1; i < join_result_cache.size(); i++) {
+            if (join_result_cache[i].last_used < join_result_cache[oldest].last_used) {
+                oldest = i;
+            }
+        }
+
+        join_result_cache_bytes -= join_result_cache[oldest].size;
+        join_result_cache.erase(join_result_cache.begin() + oldest);
+    }
+}
+
+/**
+ * Keep the rows of the cached join result made of rows each relation has now, which is the join of those rows,
+ * see is_cached_join_result_of_rows
+ *
+ * The steps of its plan are not run again, so their stats keep the rows they had but no time,
+ * except the last step, which measures this
+ *
+ * @param files
+ * @param cached
+ * @param unit: the result, with a data frame of its own
+ */
+void restrict_cached_join_result(struct_files *const files, const CachedJoinResult &cached, JoinStackEntry &unit) {
+    const int width = cached.relations.size();
+    const int num_cached = cached.index.size() / width;
+
+    unit.order = cached.order;
+    unit.stats = cached.stats;
+    for (int k = 0; k < unit.order.size(); k++) {
+        unit.stats[k].time = 0;
+        unit.stats[k].bytes_read = 0;
+
+        if (unit.order[k] != ORDER_JOIN) {
+            unit.stats[k].rows_out = filtered_cardinality(&files->files[unit.order[k] - 'A']);
+        }
+    }
+    begin_operator_stats(&unit.stats.back(), num_cached);
+
+    // relations with fewer rows now than the result was joined from, and their rows
+    std::vector<int> restricted;
+    std::vector<std::vector<uint64_t>> rows(width);
+    for (int i = 0; i < width; i++) {
+        const struct_file *const file = &files->files[cached.relations[i] - 'A'];
+
+        if (file->df->num_row < cached.num_inputs[i]) {
+            restricted.push_back(i);
+            rows_of_file_to_bitmap(file, rows[i]);
+        }
+    }
+
+    struct_data_frame *df = (struct_data_frame *) malloc(sizeof(struct_data_frame));
+    df->relations = strdup(cached.relations.c_str());
+    df->index = (int *) malloc(std::max(cached.index.size(), (size_t) 1) * sizeof(int));
+    df->num_row = 0;
+
+    for (int r = 0; r < num_cached; r++) {
+        const int *const row = &cached.index[(size_t) r * width];
+
+        int is_kept = 1;
+        for (const int i: restricted) {
+            if (!bitmap_contains(rows[i], row[i])) {
+                is_kept = 0;
+                break;
+            }
+        }
+
+        if (is_kept) {
+            memcpy(&df->index[(size_t) df->num_row * width], row, width * sizeof(int));
+            df->num_row++;
+        }
+    }
+
+    unit.df = df;
+    unit.is_owned = 1;
+
+    end_operator_stats(&unit.stats.back(), df->num_row);
+}
+
+/**
+ * Plan the query with cached join results as units of their own, see init_join_graph_of_units.
+ * A unit costs no more than a relation of its size, so a cached sub-join is nearly free to the optimizer.
+ * Cached results of the most relations are picked first, none of them overlap
+ *
+ * The plan is kept if it costs less than plan. Then graph, plan and steps are replaced by it,
+ * and materialized has the data frame of each unit, by its first relation
+ *
+ * @param files: each relation has a data frame
+ * @param query
+ * @param graph: join graph of plan
+ * @param plan
+ * @param steps: estimates of plan, see estimate_order
+ * @param samples: of the relations of the query, taken if they are not yet, see init_query_samples
+ * @param materialized: empty
+ * @return if cached join results are used
+ */
+bool plan_with_cached_join_results(struct_files *const files,
+                                   struct_query *const query,
+                                   JoinGraph &graph,
+                                   Order &plan,
+                                   std::vector<PlanStep> &steps,
+                                   QuerySamples &samples,
+                                   std::unordered_map<char, JoinStackEntry> &materialized) {
+    const std::string relations(query->second.relations, query->second.length);
+
+    std::vector<CachedJoinResult *> candidates;
+    for (auto &cached: join_result_cache) {
+        if (cached.relations.find_first_not_of(relations) == std::string::npos
+            && cached.key == normalize_join_subgraph(
+                    query, std::vector<char>(cached.relations.begin(), cached.relations.end()))) {
+            candidates.push_back(&cached);
+        }
+    }
+
+    if (candidates.empty()) {
+        return false;
+    }
+
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     [](const CachedJoinResult *const a, const CachedJoinResult *const b) {
+                         return a->relations.size() > b->relations.size()
+                                || (a->relations.size() == b->relations.size() && a->index.size() < b->index.size());
+                     });
+
+    std::string covered;
+    std::vector<JoinStackEntry> units;
+    for (const auto cached: candidates) {
+        if (cached->relations.find_first_of(covered) != std::string::npos
+            || !is_cached_join_result_of_rows(*cached, files)) {
+            continue;
+        }
+
+        JoinStackEntry unit;
+        restrict_cached_join_result(files, *cached, unit);
+        units.push_back(std::move(unit));
+
+        cached->last_used = ++join_result_cache_clock;
+        covered += cached->relations;
+    }
+
+    if (units.empty()) {
+        return false;
+    }
+
+    std::vector<std::string> names;
+    std::vector<float> cardinalities;
+    for (const auto &unit: units) {
+        names.push_back(unit.df->relations);
+        cardinalities.push_back(unit.df->num_row);
+    }
+    for (const char relation: relations) {
+        if (covered.find(relation) == std::string::npos) {
+            names.push_back(std::string(1, relation));
+            cardinalities.push_back(filtered_cardinality(&files->files[relation - 'A']));
+        }
+    }
+
+    init_query_samples(samples, files, query);
+
+    JoinGraph graph_units;
+    init_join_graph_of_units(graph_units, files, query, samples, names, cardinalities);
+
+    Order plan_units;
+    plan_join_graph(graph_units, plan_units);
+
+    std::vector<PlanStep> steps_units;
+    estimate_order(graph_units, plan_units, steps_units);
+
+    if (steps_units.back().cost >= steps.back().cost) {
+        for (auto &unit: units) {
+            free_struct_data_frame(unit.df);
+            free(unit.df);
+        }
+        return false;
+    }
+
+    graph = graph_units;
+    plan = plan_units;
+    steps = steps_units;
+    for (auto &unit: units) {
+        materialized[unit.df->relations[0]] = std::move(unit);
+    }
+
+    return true;
+}
+
+/**
+ * Execute the join plan, and assign the result to *result
+ *
+ * The plan is run as a stack of data frames, see Order. A relation on the stack is its own df,
+ * which is only copied when it is the left side of a join, since the left side is replaced by the result.
+ *
+ * When two data frames are joined, the first join clause between them joins them (with a band if there is one),
+ * the rest are filters on the result.
+ *
+ * After each join, its number of rows is checked against the estimate. If it is off by more than
+ * ADAPTIVE_REOPTIMIZE_RATIO, the rest of the joins are planned again, with the data frames joined so far
+ * as units of their actual size, see init_join_graph_of_units. A unit is named by its first relation in the new plan.
+ *
+ * Before a relation is pushed, the data frames waiting on the stack are the left sides of the joins above it,
+ * so it is filtered by the numbers each of them has on the clauses between them, see apply_runtime_filters.
+ *
+ * The result of each join is cached. Joins cached before are not run again if using them is cheaper,
+ * see plan_with_cached_join_results. A join on one clause records how far off its estimate was,
+ * if no runtime filter ran, see record_join_feedback
+ *
+ * @param loaded_file
+ * @param query
+ * @param graph: join graph of order, see optimize_joins, replaced by the graph of the plan last executed
+ * @param order: plan computed by optimize_joins, replaced by the plan actually executed
+ * @param result
+ * @param stats: @nullable, one for each element of order
+ * @return number of times the plan is re-optimized
+ */
+int execute_joins(struct_files *const loaded_file,
+                  struct_query *const query,
+                  JoinGraph &graph,
+                  Order &order,
+                  struct_data_frame *result,
+                  struct_operator_stats *const stats) {
+    const struct_third_line *const tl = &query->third;
+    if (tl->length == 0 || order.empty()) {
+        ASSERT(0);
+        return 0;
+    }
+
+    std::vector<PlanStep> steps;
+    estimate_order(graph, order, steps);
+
+    Order plan = order;
+    int num_reoptimizations = 0;
+
+    // a tree of clauses, one for each pair of relations, is fully reduced by transfer_predicates,
+    // so runtime filters would drop nothing
+    const int use_runtime_filters = tl->length >= query->second.length;
+
+    std::vector<JoinStackEntry> stack;
+    // data frames set aside when re-optimizing, or cached, by the relation naming them in the new plan
+    std::unordered_map<char, JoinStackEntry> materialized;
+
+    for (int i = 0; i < query->second.length; i++) {
+        struct_file *file = &loaded_file->files[query->second.relations[i] - 'A'];
+
+        if (file->df == NULL) {
+            init_struct_data_frame_for_file(file);
+        }
+    }
+    // relations are sampled once for the query, the first time a graph of units is built
+    QuerySamples samples;
+    plan_with_cached_join_results(loaded_file, query, graph, plan, steps, samples, materialized);
+
+    for (int k = 0; k < plan.size(); k++) {
+        if (plan[k] != ORDER_JOIN) {
+            auto it = materialized.find(plan[k]);
+            if (it != materialized.end()) {
+                stack.push_back(std::move(it->second));
+                materialized.erase(it);
+                continue;
+            }
+
+            struct_file *file = &loaded_file->files[plan[k] - 'A'];
+
+            JoinStackEntry entry;
+            entry.stats.assign(1, struct_operator_stats());
+
+            // a relation is already filtered, by its predicates and by runtime filters of the data frames it will join
+            begin_operator_stats(stats == NULL ? NULL : &entry.stats[0], file->num_row);
+            if (use_runtime_filters) {
+                for (const auto &waiting: stack) {
+                    apply_runtime_filters(loaded_file, query, waiting.df, file, 0);
+                }
+            }
+            end_operator_stats(stats == NULL ? NULL : &entry.stats[0], file->df->num_row);
+
+            entry.df = file->df;
+            entry.is_owned = 0;
+            entry.order.push_back(plan[k]);
+
+            stack.push_back(std::move(entry));
+            continue;
+        }
+
+        ASSERT(stack.size() >= 2);
+        JoinStackEntry right = std::move(stack.back());
+        stack.pop_back();
+        JoinStackEntry &left_entry = stack.back();
+
+        struct_operator_stats stats_join = struct_operator_stats();
+        struct_operator_stats *const p_stats_join = stats == NULL ? NULL : &stats_join;
+        begin_operator_stats(p_stats_join, left_entry.df->num_row);
+        if (p_stats_join != NULL) {
+            p_stats_join->rows_in_right = right.df->num_row;
+        }
+
+        // left side is replaced by the result, so it must be our own copy
+        if (!left_entry.is_owned) {
+            struct_data_frame *copy = (struct_data_frame *) malloc(sizeof(struct_data_frame));
+            copy_struct_data_frame(left_entry.df, copy);
+
+            left_entry.df = copy;
+            left_entry.is_owned = 1;
+        }
+        struct_data_frame *left = left_entry.df;
+
+        // relations of left before the join, the result keeps them as its prefix
+        const int num_left = strlen(left->relations);
+        const float rows_left = left->num_row;
+        const float rows_right = right.df->num_row;
+
+        struct_join *join = NULL;
+        struct_join *band = NULL;
+        pick_join_clauses(tl, left->relations, right.df->relations, &join, &band);
+
+        // plan only joins connected sides
+        ASSERT(join != NULL);
+
+        sorted_nested_loop_join_data_frames(loaded_file, left, right.df, join, band);
+
+        // the rest of clauses between the two sides
+        int num_clauses = band == NULL ? 1 : 2;
+        for (int i = 0; i < tl->length; i++) {
+            struct_join *clause = &tl->joins[i];
+
+            if (clause != join && clause != band
+                && is_join_between(clause, left->relations, num_left, right.df->relations)) {
+                sorted_nested_loop_join_both_joined_before(loaded_file, left, clause);
+                num_clauses++;
+            }
+        }
+
+        // a join on one clause alone tells how far off the estimate of the clause was, unless runtime filters
+        // already dropped rows of its sides that do not join, which the estimate was made without
+        const bool is_feedback = !use_runtime_filters && num_clauses == 1 && rows_left * rows_right > 0;
+        for (int c = 0; is_feedback && c < graph.joins.size(); c++) {
+            if (graph.joins[c] == join && graph.estimates[c] > 0) {
+                record_join_feedback(*join, std::max(left->num_row, 1) / (rows_left * rows_right), graph.estimates[c]);
+            }
+        }
+
+        if (right.is_owned) {
+            free_struct_data_frame(right.df);
+            free(right.df);
+        }
+
+        end_operator_stats(p_stats_join, left->num_row);
+
+        left_entry.order.insert(left_entry.order.end(), right.order.begin(), right.order.end());
+        left_entry.order.push_back(ORDER_JOIN);
+        left_entry.stats.insert(left_entry.stats.end(), right.stats.begin(), right.stats.end());
+        left_entry.stats.push_back(stats_join);
+
+        cache_join_result(loaded_file, query, left_entry);
+
+        // units left to join: data frames on the stack, and the rest of the plan
+        std::string remaining;
+        for (int j = k + 1; j < plan.size(); j++) {
+            if (plan[j] != ORDER_JOIN) {
+                remaining += plan[j];
+            }
+        }
+
+        const float estimate = steps[k].cardinality;
+        const float actual = left->num_row;
+        if (stack.size() + remaining.size() <= 2
+            || std::max(estimate, actual) <= ADAPTIVE_REOPTIMIZE_RATIO * std::max(std::min(estimate, actual), 1.0f)) {
+            continue;
+        }
+
+        std::vector<std::string> units;
+        std::vector<float> cardinalities;
+        for (auto &entry: stack) {
+            units.push_back(entry.df->relations);
+            cardinalities.push_back(entry.df->num_row);
+
+            materialized[entry.df->relations[0]] = std::move(entry);
+        }
+        stack.clear();
+
+        for (const char relation: remaining) {
+            auto it = materialized.find(relation);
+            if (it != materialized.end()) {
+                units.push_back(it->second.df->relations);
+                cardinalities.push_back(it->second.df->num_row);
+            } else {
+                units.push_back(std::string(1, relation));
+                cardinalities.push_back(filtered_cardinality(&loaded_file->files[relation - 'A']));
+            }
+        }
+
+        init_query_samples(samples, loaded_file, query);
+        init_join_graph_of_units(graph, loaded_file, query, samples, units, cardinalities);
+        plan_join_graph(graph, plan);
+        estimate_order(graph, plan, steps);
+
+        num_reoptimizations++;
+        k = -1;
+    }
+
+    ASSERT(stack.size() == 1 && materialized.empty());
+    auto &top = stack[0];
+
+    if (top.is_owned) {
+        *result = *top.df;
+        free(top.df);
+    } else {
+        copy_struct_data_frame(top.df, result);
+    }
+
+    order = top.order;
+    if (stats != NULL) {
+        std::copy(top.stats.begin(), top.stats.end(), stats);
+    }
+
+    return num_reoptimizations;
+}
+
+// number of rows of the intermediate gathered at a time when computing aggregates
+#ifndef SIZE_AGGREGATE_BLOCK
+#define SIZE_AGGREGATE_BLOCK 1024
+#endif
+
+/**
+ * Running state of an aggregate, enough to produce any of SUM, COUNT, MIN, MAX and AVG
+ *
+ * sum is 128-bit, so that a sum of products of two columns does not overflow
+ */
+typedef struct {
+    __int128 sum;
+    int64_t count;
+    int64_t min;
+    int64_t max;
+} struct_aggregate_state;
+
+void init_struct_aggregate_state(struct_aggregate_state *state) {
+    state->sum = 0;
+    state->count = 0;
+    state->min = INT64_MAX;
+    state->max = INT64_MIN;
+}
+
+/**
+ * Fold a block of numbers into the state of an aggregate
+ */
+void update_aggregate_state(struct_aggregate_state *const state,
+                            const enum_aggregate function,
+                            const int *const numbers,
+                            const int length) {
+    state->count += length;
+
+    switch (function) {
+        case AGGREGATE_SUM:
+        case AGGREGATE_AVG: {
+            int64_t sum = 0;
+            for (int i = 0; i < length; i++) {
+                sum += numbers[i];
+            }
+            state->sum += sum;
+            break;
+        }
+        case AGGREGATE_MIN:
+        case AGGREGATE_COLUMN: {
+            int min = INT32_MAX;
+            for (int i = 0; i < length; i++) {
+                min = numbers[i] < min ? numbers[i] : min;
+            }
+            state->min = std::min(state->min, (int64_t) min);
+            break;
+        }
+        case AGGREGATE_MAX: {
+            int max = INT32_MIN;
+            for (int i = 0; i < length; i++) {
+                max = numbers[i] > max ? numbers[i] : max;
+            }
+            state->max = std::max(state->max, (int64_t) max);
+            break;
+        }
+        case AGGREGATE_COUNT:
+            break;
+    }
+}
+
+/**
+ * Fold a block of 64-bit numbers, the results of an arithmetic, into the state of an aggregate
+ *
+ * A block of them may overflow 64-bit, but each is split into high and low 32 bits,
+ * and the two halves are summed up separately in 64-bit before they are combined into the 128-bit sum
+ */
+void update_aggregate_state_wide(struct_aggregate_state *const state,
+                                 const enum_aggregate function,
+                                 const int64_t *const numbers,
+                                 const int length) {
+    ASSERT(length <= SIZE_AGGREGATE_BLOCK);
+
+    state->count += length;
+
+    switch (function) {
+        case AGGREGATE_SUM:
+        case AGGREGATE_AVG: {
+            int64_t sum_high = 0;
+            int64_t sum_low = 0;
+            for (int i = 0; i < length; i++) {
+                sum_high += numbers[i] >> 32;
+                sum_low += numbers[i] & 0xFFFFFFFF;
+            }
+            state->sum += (__int128) sum_high * ((int64_t) 1 << 32) + sum_low;
+            break;
+        }
+        case AGGREGATE_MIN:
+        case AGGREGATE_COLUMN: {
+            int64_t min = state->min;
+            for (int i = 0; i < length; i++) {
+                min = numbers[i] < min ? numbers[i] : min;
+            }
+            state->min = min;
+            break;
+        }
+        case AGGREGATE_MAX: {
+            int64_t max = state->max;
+            for (int i = 0; i < length; i++) {
+                max = numbers[i] > max ? numbers[i] : max;
+            }
+            state->max = max;
+            break;
+        }
+        case AGGREGATE_COUNT:
+            break;
+    }
+}
+
+/**
+ * Compute (lhs arithmetic rhs) for a block of numbers, in 64-bit
+ */
+void evaluate_arithmetic_block(const enum_arithmetic arithmetic,
+                               const int *const lhs,
+                               const int *const rhs,
+                               int64_t *const numbers,
+                               const int length) {
+    switch (arithmetic) {
+        case ARITHMETIC_ADD:
+            for (int i = 0; i < length; i++) {
+                numbers[i] = (int64_t) lhs[i] + rhs[i];
+            }
+            break;
+        case ARITHMETIC_SUBTRACT:
+            for (int i = 0; i < length; i++) {
+                numbers[i] = (int64_t) lhs[i] - rhs[i];
+            }
+            break;
+        case ARITHMETIC_MULTIPLY:
+            for (int i = 0; i < length; i++) {
+                numbers[i] = (int64_t) lhs[i] * rhs[i];
+            }
+            break;
+        default:
+            ASSERT(0);
+    }
+}
+
+// (lhs arithmetic rhs) of a single row, in 64-bit
+static inline int64_t evaluate_arithmetic(const enum_arithmetic arithmetic, const int lhs, const int rhs) {
+    switch (arithmetic) {
+        case ARITHMETIC_ADD:
+            return (int64_t) lhs + rhs;
+        case ARITHMETIC_SUBTRACT:
+            return (int64_t) lhs - rhs;
+        case ARITHMETIC_MULTIPLY:
+            return (int64_t) lhs * rhs;
+        default:
+            return lhs;
+    }
+}
+
+/**
+ * Fold a single number into the state of an aggregate
+ */
+static inline void update_aggregate_state_with_number(struct_aggregate_state *const state, const int64_t number) {
+    state->sum += number;
+    state->count++;
+    state->min = number < state->min ? number : state->min;
+    state->max = number > state->max ? number : state->max;
+}
+
+/**
+ * Merge two partial states of the same aggregate into dst
+ */
+static inline void merge_aggregate_states(struct_aggregate_state *const dst, const struct_aggregate_state *const src) {
+    dst->sum += src->sum;
+    dst->count += src->count;
+    dst->min = src->min < dst->min ? src->min : dst->min;
+    dst->max = src->max > dst->max ? src->max : dst->max;
+}
+
+/**
+ * Write number in decimal into str, which should hold at least 41 chars
+ *
+ * @return str
+ */
+char *format_int128(__int128 number, char *const str) {
+    // digits are written backward from the end
+    char digits[40];
+    int top = sizeof(digits);
+
+    // negate digit by digit, so that the smallest number does not overflow
+    const bool is_negative = number < 0;
+    do {
+        int digit = (int) (number % 10);
+        digits[--top] = (char) ('0' + (digit < 0 ? -digit : digit));
+        number /= 10;
+    } while (number != 0);
+
+    char *p = str;
+    if (is_negative) {
+        *p++ = '-';
+    }
+    memcpy(p, digits + top, sizeof(digits) - top);
+    p[sizeof(digits) - top] = '\0';
+
+    return str;
+}
+
+/**
+ * Print the result of an aggregate, nothing is printed for an empty input except for COUNT
+ */
+void print_aggregate_state(const struct_aggregate_state *const state, const enum_aggregate function) {
+    if (state->count == 0 && function != AGGREGATE_COUNT) {
+        return;
+    }
+
+    char str[48];
+
+    switch (function) {
+        case AGGREGATE_SUM:
+            fputs(format_int128(state->sum, str), stdout);
+            break;
+        case AGGREGATE_COUNT:
+            printf("%" PRId64, state->count);
+            break;
+        case AGGREGATE_MIN:
+        case AGGREGATE_COLUMN:
+            printf("%" PRId64, state->min);
+            break;
+        case AGGREGATE_MAX:
+            printf("%" PRId64, state->max);
+            break;
+        case AGGREGATE_AVG:
+            printf("%.2f", (double) state->sum / state->count);
+            break;
+    }
+}
+
+// one line with the result of each aggregate, separated by ,
+void print_aggregate_states(const struct_first_line *const fl, const struct_aggregate_state *const states) {
+    for (int i = 0; i < fl->length; i++) {
+        print_aggregate_state(&states[i], fl->sums[i].function);
+
+        if (i != fl->length - 1) {
+            putc(',', stdout);
+        }
+    }
+    puts("");
+}
+
+/**
+ * Columns of an intermediate, gathered block by block
+ *
+ * Each column is read into memory once, and a block of SIZE_AGGREGATE_BLOCK numbers of each column is filled by gather_block
+ */
+typedef struct {
+    // the intermediate to gather from, and its number of relations
+    const struct_data_frame *df;
+    int num_relations;
+
+    // number of distinct columns added, and how many can be added
+    int length;
+    int capacity;
+
+    // column, offset of its relation in df, and the entire column
+    struct_relation_column *rcs;
+    int *offsets;
+    const int **columns;
+    // columns read into their own memory, because the buffer of their file is taken
+    int **columns_owned;
+
+    // SIZE_AGGREGATE_BLOCK numbers for each column
+    int *block;
+} struct_gather;
+
+void init_struct_gather(struct_gather *gather, const struct_data_frame *const df, const int capacity) {
+    gather->df = df;
+    gather->num_relations = strlen(df->relations);
+    gather->length = 0;
+    gather->capacity = capacity;
+
+    gather->rcs = (struct_relation_column *) malloc(capacity * sizeof(struct_relation_column));
+    gather->offsets = (int *) malloc(capacity * sizeof(int));
+    gather->columns = (const int **) malloc(capacity * sizeof(int *));
+    gather->columns_owned = (int **) malloc(capacity * sizeof(int *));
+    gather->block = (int *) malloc((capacity + 1) * SIZE_AGGREGATE_BLOCK * sizeof(int));
+}
+
+void free_struct_gather(struct_gather *gather) {
+    for (int i = 0; i < gather->length; i++) {
+        free(gather->columns_owned[i]);
+    }
+
+    free(gather->rcs);
+    free(gather->offsets);
+    free(gather->columns);
+    free(gather->columns_owned);
+    free(gather->block);
+    gather->length = gather->capacity = 0;
+}
+
+/**
+ * Add a column to gather, the same column is only added once
+ *
+ * @return slot of the column, its block is at gather_block_of(gather, slot)
+ */
+int add_column_to_gather(struct_gather *gather, struct_files *const loaded_file, const struct_relation_column *rc) {
+    for (int i = 0; i < gather->length; i++) {
+        if (gather->rcs[i].relation == rc->relation && gather->rcs[i].column == rc->column) {
+            return i;
+        }
+    }
+
+    ASSERT(gather->length < gather->capacity);
+
+    const int slot = gather->length;
+
+    // find the index of this relation in the df
+    gather->rcs[slot] = *rc;
+    gather->offsets[slot] = findIndexOf(gather->df->relations, gather->num_relations, rc->relation);
+    gather->columns_owned[slot] = NULL;
+    ASSERT(gather->offsets[slot] != -1);
+
+    // get the relation where this column in
+    struct_file *file = &loaded_file->files[rc->relation - 'A'];
+
+    // the first column of each relation uses the buffer of its file
+    bool is_buffer_taken = false;
+    for (int i = 0; i < slot; i++) {
+        is_buffer_taken = is_buffer_taken || gather->rcs[i].relation == rc->relation;
+    }
+
+    if (is_buffer_taken) {
+        gather->columns_owned[slot] = (int *) malloc(file->num_row * sizeof(int));
+        read_column_from_file(file, rc->column, gather->columns_owned[slot]);
+        gather->columns[slot] = gather->columns_owned[slot];
+    } else {
+        gather->columns[slot] = select_column_from_file(file, rc->column);
+    }
+
+    gather->length++;
+    return slot;
+}
+
+// numbers of the column at slot, in the current block
+#define gather_block_of(gather, slot) (&(gather)->block[(slot) * SIZE_AGGREGATE_BLOCK])
+
+/**
+ * Gather numbers of rows [begin, begin + length) of the intermediate, for each column
+ */
+void gather_block(struct_gather *gather, const int begin, const int length) {
+    ASSERT(length <= SIZE_AGGREGATE_BLOCK);
+
+    const int num_relations = gather->num_relations;
+    const int *const index = &gather->df->index[begin * num_relations];
+
+    for (int k = 0; k < gather->length; k++) {
+        int *const numbers = gather_block_of(gather, k);
+        const int *const column = gather->columns[k];
+        const int offset = gather->offsets[k];
+
+        for (int i = 0; i < length; i++) {
+            numbers[i] = column[index[i * num_relations + offset]];
+        }
+    }
+}
+
+/**
+ * Execute aggregates for each column
+ *
+ * All aggregates are computed in one pass over the intermediate: it is walked block by block,
+ * each column that is aggregated over is gathered once per block, and every aggregate on that column reads the block.
+ * An aggregate over an arithmetic of two columns evaluates it for the whole block first, in 64-bit.
+ *
+ * @param loaded_file
+ * @param fl
+ * @param result
+ * @param states: one state for each aggregate in fl
+ */
+void execute_sums(struct_files *const loaded_file,
+                  const struct_first_line *const fl,
+                  struct_data_frame *result,
+                  struct_aggregate_state *states) {
+    struct_gather gather;
+    init_struct_gather(&gather, result, 2 * fl->length);
+
+    // slot of each aggregate in gather, -1 for COUNT(*)
+    int *slots = (int *) arena_alloc(&loaded_file->arena, fl->length * sizeof(int));
+    // slot of rhs of the arithmetic of each aggregate, -1 if none
+    int *slots_rhs = (int *) arena_alloc(&loaded_file->arena, fl->length * sizeof(int));
+
+    for (int col = 0; col < fl->length; col++) {
+        ASSERT(fl->sums[col].function != AGGREGATE_COLUMN);
+
+        const struct_aggregate *aggregate = &fl->sums[col];
+        slots[col] = aggregate->rc.relation == '*' ? -1 : add_column_to_gather(&gather, loaded_file, &aggregate->rc);
+        slots_rhs[col] = aggregate->arithmetic == ARITHMETIC_NONE ? -1
+                                                                  : add_column_to_gather(&gather, loaded_file, &aggregate->rhs);
+    }
+
+    // results of an arithmetic, for one block
+    int64_t *wide = (int64_t *) arena_alloc(&loaded_file->arena, SIZE_AGGREGATE_BLOCK * sizeof(int64_t));
+
+    // one pass, block by block
+    for (int begin = 0; begin < result->num_row; begin += SIZE_AGGREGATE_BLOCK) {
+        const int length = std::min(SIZE_AGGREGATE_BLOCK, result->num_row - begin);
+
+        // gather each column once
+        gather_block(&gather, begin, length);
+
+        for (int col = 0; col < fl->length; col++) {
+            if (slots_rhs[col] != -1) {
+                evaluate_arithmetic_block(fl->sums[col].arithmetic,
+                                          gather_block_of(&gather, slots[col]),
+                                          gather_block_of(&gather, slots_rhs[col]),
+                                          wide,
+                                          length);
+                update_aggregate_state_wide(&states[col], fl->sums[col].function, wide, length);
+                continue;
+            }
+
+            // COUNT(*) only needs the length
+            const int *const numbers = slots[col] == -1 ? gather.block : gather_block_of(&gather, slots[col]);
+            update_aggregate_state(&states[col], fl->sums[col].function, numbers, length);
+        }
+    }
+
+    free_struct_gather(&gather);
+}
+
+//////////////
+// GROUP BY //
+//////////////
+
+// groups the pre-aggregation table holds before it spills into partitions, sized to stay in cache
+#ifndef GROUP_BY_CACHE_GROUPS
+#define GROUP_BY_CACHE_GROUPS (1 << 12)
+#endif
+
+// number of bits of hash used to partition groups once they outgrow the cache
+#ifndef GROUP_BY_RADIX_BITS
+#define GROUP_BY_RADIX_BITS 6
+#endif
+
+#define GROUP_BY_NUM_PARTITIONS (1 << GROUP_BY_RADIX_BITS)
+
+/**
+ * Open addressing hash table, from key of a group (one number for each column of GROUP BY)
+ * to the states of its aggregates
+ */
+typedef struct {
+    int num_keys;
+    int num_aggregates;
+
+    // number of slots, power of 2
+    int capacity;
+    // number of groups in the table
+    int size;
+    // table is full once it has this many groups
+    int max_size;
+
+    // num_keys numbers for each slot
+    int *keys;
+    // hash of the key in each slot, 0 if slot is empty
+    uint64_t *hashes;
+    // num_aggregates states for each slot
+    struct_aggregate_state *states;
+} struct_group_table;
+
+void init_struct_group_table(struct_group_table *table, int num_keys, int num_aggregates, int max_size) {
+    table->num_keys = num_keys;
+    table->num_aggregates = num_aggregates;
+    table->size = 0;
+    table->max_size = max_size;
+
+    // keep load factor at most 0.5
+    table->capacity = 1;
+    while (table->capacity < 2 * max_size) {
+        table->capacity <<= 1;
+    }
+
+    table->keys = (int *) malloc(table->capacity * num_keys * sizeof(int));
+    table->hashes = (uint64_t *) calloc(table->capacity, sizeof(uint64_t));
+    table->states = (struct_aggregate_state *) malloc(
+            table->capacity * num_aggregates * sizeof(struct_aggregate_state));
+}
+
+void free_struct_group_table(struct_group_table *table) {
+    free(table->keys);
+    free(table->hashes);
+    free(table->states);
+    table->keys = NULL;
+    table->hashes = NULL;
+    table->states = NULL;
+    table->size = table->capacity = 0;
+}
+
+void clear_struct_group_table(struct_group_table *table) {
+    memset(table->hashes, 0, table->capacity * sizeof(uint64_t));
+    table->size = 0;
+}
+
+/**
+ * Hash the key of a group, never returns 0 which marks an empty slot
+ */
+static inline uint64_t hash_group_key(const int *const key, const int num_keys) {
+    uint64_t hash = 0x9E3779B97F4A7C15ull;
+    for (int i = 0; i < num_keys; i++) {
+        hash = (hash ^ (uint32_t) key[i]) * 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 32;
+    }
+
+    return hash | 1;
+}
+
+/**
+ * Find the slot of the group, insert the group with initial states if not found
+ *
+ * @return index of the slot, or -1 if the group is not in the table and the table is full
+ */
+static inline int find_or_insert_group(struct_group_table *table, const int *const key, const uint64_t hash) {
+    const int mask = table->capacity - 1;
+    const int num_keys = table->num_keys;
+
+    // low bits pick the slot, high bits pick the partition
+    for (int slot = (int) (hash & mask);; slot = (slot + 1) & mask) {
+        if (table->hashes[slot] == 0) {
+            if (table->size == table->max_size) {
+                return -1;
+            }
+
+            table->hashes[slot] = hash;
+            memcpy(&table->keys[slot * num_keys], key, num_keys * sizeof(int));
+            for (int i = 0; i < table->num_aggregates; i++) {
+                init_struct_aggregate_state(&table->states[slot * table->num_aggregates + i]);
+            }
+
+            table->size++;
+            return slot;
+        }
+
+        if (table->hashes[slot] == hash && 0 == memcmp(&table->keys[slot * num_keys], key, num_keys * sizeof(int))) {
+            return slot;
+        }
+    }
+}
+
+/**
+ * Double the capacity of the table, keeping every group
+ */
+void grow_struct_group_table(struct_group_table *table) {
+    struct_group_table bigger;
+    init_struct_group_table(&bigger, table->num_keys, table->num_aggregates, table->max_size * 2);
+
+    for (int slot = 0; slot < table->capacity; slot++) {
+        if (table->hashes[slot] == 0) {
+            continue;
+        }
+
+        int dst = find_or_insert_group(&bigger, &table->keys[slot * table->num_keys], table->hashes[slot]);
+        memcpy(&bigger.states[dst * bigger.num_aggregates],
+               &table->states[slot * table->num_aggregates],
+               table->num_aggregates * sizeof(struct_aggregate_state));
+    }
+
+    free_struct_group_table(table);
+    *table = bigger;
+}
+
+/*
+ * Partial group spilled from the pre-aggregation table, stored in the stack of its partition:
+ * hash, then num_keys numbers, then num_aggregates states
+ */
+#define SIZE_GROUP_RECORD(num_keys, num_aggregates) \
+((sizeof(uint64_t) + (num_keys) * sizeof(int) + 15) / 16 * 16 + (num_aggregates) * sizeof(struct_aggregate_state))
+
+/**
+ * Push the group at slot of the table as a record, see SIZE_GROUP_RECORD
+ */
+void push_group_record(const struct_group_table *const table, const int slot, struct_parse_context *records) {
+    const size_t size_record = SIZE_GROUP_RECORD(table->num_keys, table->num_aggregates);
+    const size_t offset_states = size_record - table->num_aggregates * sizeof(struct_aggregate_state);
+
+    char *record = (char *) context_push(records, size_record);
+    memcpy(record, &table->hashes[slot], sizeof(uint64_t));
+    memcpy(record + sizeof(uint64_t), &table->keys[slot * table->num_keys], table->num_keys * sizeof(int));
+    memcpy(record + offset_states,
+           &table->states[slot * table->num_aggregates],
+           table->num_aggregates * sizeof(struct_aggregate_state));
+}
+
+/**
+ * Move every group of the pre-aggregation table into the partition given by the high bits of its hash,
+ * then empty the table
+ */
+void spill_group_table(struct_group_table *table, struct_parse_context *partitions) {
+    for (int slot = 0; slot < table->capacity; slot++) {
+        if (table->hashes[slot] != 0) {
+            push_group_record(table, slot, &partitions[table->hashes[slot] >> (64 - GROUP_BY_RADIX_BITS)]);
+        }
+    }
+
+    clear_struct_group_table(table);
+}
+
+/**
+ * Print one line for each group record, ordered by key
+ */
+void print_group_records(const struct_parse_context *const records,
+                         const struct_first_line *const fl,
+                         const int num_keys,
+                         const int *const slots_key) {
+    const size_t size_record = SIZE_GROUP_RECORD(num_keys, fl->length);
+    const size_t offset_states = size_record - fl->length * sizeof(struct_aggregate_state);
+
+    std::vector<const int *> keys;
+    for (size_t offset = 0; offset < records->top; offset += size_record) {
+        keys.push_back((const int *) (records->stack + offset + sizeof(uint64_t)));
+    }
+
+    std::sort(keys.begin(), keys.end(), [num_keys](const int *a, const int *b) {
+        return std::lexicographical_compare(a, a + num_keys, b, b + num_keys);
+    });
+
+    for (const auto &key: keys) {
+        const struct_aggregate_state *const states = (const struct_aggregate_state *) (
+                (const char *) key - sizeof(uint64_t) + offset_states);
+
+        for (int i = 0; i < fl->length; i++) {
+            if (fl->sums[i].function == AGGREGATE_COLUMN) {
+                printf("%d", key[slots_key[i]]);
+            } else {
+                print_aggregate_state(&states[i], fl->sums[i].function);
+            }
+
+            if (i != fl->length - 1) {
+                putc(',', stdout);
+            }
+        }
+        puts("");
+    }
+}
+
+/**
+ * Execute GROUP BY with hash aggregation, print one line for each group, ordered by the columns of GROUP BY
+ *
+ * Rows are pre-aggregated into a small table that fits in cache.
+ * If every group fits, that table is the result.
+ * Otherwise the table spills its partial groups into partitions by the high bits of their hash whenever it is full,
+ * and each partition is merged on its own afterwards, with a table that only holds the groups of that partition.
+ *
+ * @param loaded_file
  * @param query
+ * @param result: the intermediate after all joins
+ * @return number of groups
  */
-// todo
-void optimize_joins(struct_files *const files, struct_query *const query) {
-    // init rels
-    std::vector<char> rels(query->second.length);
-    for (int i = 0; i < query->second.length; i++) {
-        rels[i] = query->second.relations[i];
+int execute_group_by(struct_files *const loaded_file,
+                     const struct_query *const query,
+                     struct_data_frame *result) {
+    const struct_first_line *const fl = &query->first;
+    const struct_fourth_line *const groups = &query->fourth;
+    const int num_keys = groups->num_groups;
+    const int num_aggregates = fl->length;
+
+    struct_gather gather;
+    init_struct_gather(&gather, result, num_keys + 2 * num_aggregates);
+
+    // slot in gather of each column of GROUP BY
+    int *slots_group = (int *) arena_alloc(&loaded_file->arena, num_keys * sizeof(int));
+    for (int i = 0; i < num_keys; i++) {
+        slots_group[i] = add_column_to_gather(&gather, loaded_file, &groups->groups[i]);
     }
 
-    ////////////////////////////////////////////////////////
-    // init best and cost for each pair A, B in relations //
-    ////////////////////////////////////////////////////////
-    /**
-     * Key for best is sorted
-     */
-    Best best;
-
-    // compute best join order
-    auto best_join_order = compute_best(rels, best, files, query);
-
-//    std::cout << vector_to_string(best_join_order.order) << std::endl;
-
-//    for (const auto &pair: best) {
-//        if (pair.second.order.empty() || pair.second.order.size() == 1) {
-//            continue;
-//        }
-//
-//        std::cout << pair.first
-//                  << " >>> "
-//                  << vector_to_string(pair.second.order)
-//                  << " @ "
-//                  << pair.second.cost
-//                  << std::endl;
-//    }
-
-    // calculate new join order
-    // apply this order to query->third
-    const auto &order = best_join_order.order;
-    // this is what we actually want to modify
-    const auto &joins = query->third;
-
-    // new order of above joins
-    std::vector<int> new_order;
-
-    // set of index of above joins left
-    std::unordered_set<int> joins_index_left;
-
-    // set of already joined re
-    std::unordered_set<char> joined_re;
-
-    // init all index of joins
-    for (int i = 0; i < joins.length; i++) {
-        joins_index_left.insert(i);
-    }
-
-    // Each time we grow, try to find clause than lhs is inside joined, and rhs is new re
-
-    // first, find the join with [0] and [1]
-    char r = order[0];
-    char s = order[1];
-
-    // find the join clause that joins r s
-    for (auto it = joins_index_left.begin(); it != joins_index_left.end(); it++) {
-        if (join_clause_contains(&joins.joins[*it], r, s)) {
-            // found the clause
-            int index = *it;
-            // remove it from set
-            joins_index_left.erase(it);
-            // add it to new_order
-            new_order.push_back(index);
-            // add r s to joined re
-            joined_re.insert(r);
-            joined_re.insert(s);
+    // slot in gather of each aggregate, -1 for COUNT(*)
+    // slot of rhs of the arithmetic of each aggregate, -1 if none
+    // for plain columns, index of the column in GROUP BY
+    int *slots = (int *) arena_alloc(&loaded_file->arena, num_aggregates * sizeof(int));
+    int *slots_rhs = (int *) arena_alloc(&loaded_file->arena, num_aggregates * sizeof(int));
+    int *slots_key = (int *) arena_alloc(&loaded_file->arena, num_aggregates * sizeof(int));
+    for (int col = 0; col < num_aggregates; col++) {
+        const struct_aggregate *aggregate = &fl->sums[col];
+        slots[col] = aggregate->rc.relation == '*' ? -1 : add_column_to_gather(&gather, loaded_file, &aggregate->rc);
+        slots_rhs[col] = aggregate->arithmetic == ARITHMETIC_NONE ? -1
+                                                                  : add_column_to_gather(&gather, loaded_file, &aggregate->rhs);
+        slots_key[col] = -1;
+
+        if (fl->sums[col].function == AGGREGATE_COLUMN) {
+            for (int i = 0; i < num_keys; i++) {
+                if (slots_group[i] == slots[col]) {
+                    slots_key[col] = i;
+                }
+            }
 
-            break;
+            // plain column must be one of GROUP BY
+            ASSERT(slots_key[col] != -1);
         }
     }
 
-    for (int i = 2; i < order.size(); i++) {
-        char re = order[i];
-        // find all join clause that contains order[i] and any element in joined_re
-        std::unordered_set<int> new_joins_index_left(joins_index_left);
+    struct_group_table table;
+    init_struct_group_table(&table, num_keys, num_aggregates, GROUP_BY_CACHE_GROUPS);
 
-        for (auto &each: joins_index_left) {
-            const auto &join_clause = joins.joins[each];
+    // only used once groups outgrow the pre-aggregation table
+    struct_parse_context *partitions = NULL;
 
-            // check if this join contains re
-            if (!(join_clause.lhs.relation == re || join_clause.rhs.relation == re)) {
-                continue;
+    int *key = (int *) arena_alloc(&loaded_file->arena, num_keys * sizeof(int));
+
+    ///////////////////
+    // pre-aggregate //
+    ///////////////////
+    for (int begin = 0; begin < result->num_row; begin += SIZE_AGGREGATE_BLOCK) {
+        const int length = std::min(SIZE_AGGREGATE_BLOCK, result->num_row - begin);
+
+        gather_block(&gather, begin, length);
+
+        for (int i = 0; i < length; i++) {
+            for (int k = 0; k < num_keys; k++) {
+                key[k] = gather_block_of(&gather, slots_group[k])[i];
+            }
+
+            const uint64_t hash = hash_group_key(key, num_keys);
+            int slot = find_or_insert_group(&table, key, hash);
+
+            // groups outgrow the cache, switch to partitions
+            if (slot == -1) {
+                if (partitions == NULL) {
+                    partitions = (struct_parse_context *) arena_alloc(
+                            &loaded_file->arena, GROUP_BY_NUM_PARTITIONS * sizeof(struct_parse_context));
+                    for (int p = 0; p < GROUP_BY_NUM_PARTITIONS; p++) {
+                        init_struct_parse_context(&partitions[p], NULL);
+                    }
+                }
+
+                spill_group_table(&table, partitions);
+                slot = find_or_insert_group(&table, key, hash);
+            }
+
+            struct_aggregate_state *const states = &table.states[slot * num_aggregates];
+            for (int col = 0; col < num_aggregates; col++) {
+                if (slots[col] == -1) {
+                    states[col].count++;
+                } else if (slots_rhs[col] != -1) {
+                    update_aggregate_state_with_number(&states[col], evaluate_arithmetic(
+                            fl->sums[col].arithmetic,
+                            gather_block_of(&gather, slots[col])[i],
+                            gather_block_of(&gather, slots_rhs[col])[i]));
+                } else {
+                    update_aggregate_state_with_number(&states[col], gather_block_of(&gather, slots[col])[i]);
+                }
             }
+        }
+    }
 
-            char other_re = join_clause.lhs.relation == re ? join_clause.rhs.relation : join_clause.lhs.relation;
+    free_struct_gather(&gather);
 
-            // now check if other hand side in joined_re
-            if (joined_re.find(other_re) != joined_re.end()) {
-                // we found it
-                // remove it from new_joins_index_left
-                new_joins_index_left.erase(each);
+    // final groups, as records
+    struct_parse_context records;
+    init_struct_parse_context(&records, NULL);
 
-                // add it to joined_re
-                joined_re.insert(re);
-                // add it to new_order
-                new_order.push_back(each);
+    if (partitions == NULL) {
+        // every group fits in the pre-aggregation table
+        for (int slot = 0; slot < table.capacity; slot++) {
+            if (table.hashes[slot] != 0) {
+                push_group_record(&table, slot, &records);
             }
         }
+    } else {
+        /////////////////////////////////////
+        // merge each partition on its own //
+        /////////////////////////////////////
+        spill_group_table(&table, partitions);
+
+        const size_t size_record = SIZE_GROUP_RECORD(num_keys, num_aggregates);
+        const size_t offset_states = size_record - num_aggregates * sizeof(struct_aggregate_state);
+
+        struct_group_table partition;
+        init_struct_group_table(&partition, num_keys, num_aggregates, GROUP_BY_CACHE_GROUPS);
+
+        for (int p = 0; p < GROUP_BY_NUM_PARTITIONS; p++) {
+            for (size_t offset = 0; offset < partitions[p].top; offset += size_record) {
+                const char *record = partitions[p].stack + offset;
+                const int *const key_record = (const int *) (record + sizeof(uint64_t));
+                uint64_t hash;
+                memcpy(&hash, record, sizeof(uint64_t));
+
+                int slot = find_or_insert_group(&partition, key_record, hash);
+                if (slot == -1) {
+                    grow_struct_group_table(&partition);
+                    slot = find_or_insert_group(&partition, key_record, hash);
+                }
 
-        // swap set
-        joins_index_left = new_joins_index_left;
-    }
+                const struct_aggregate_state *const states = (const struct_aggregate_state *) (record + offset_states);
+                for (int col = 0; col < num_aggregates; col++) {
+                    merge_aggregate_states(&partition.states[slot * num_aggregates + col], &states[col]);
+                }
+            }
 
-    ASSERT(new_order.size() == joins.length);
+            free_struct_parse_context(&partitions[p]);
 
-//    for (auto each: new_order) {
-//        std::cout << each << " ";
-//    }
-//
-//    std::cout << std::endl;
+            for (int slot = 0; slot < partition.capacity; slot++) {
+                if (partition.hashes[slot] != 0) {
+                    push_group_record(&partition, slot, &records);
+                }
+            }
 
-    // apply new order to joins.joins
-    std::vector<struct_join> tmp_joins;
-    for (int i = 0; i < joins.length; i++) {
-        tmp_joins.push_back(joins.joins[i]);
-    }
+            clear_struct_group_table(&partition);
+        }
 
-    for (int i = 0; i < new_order.size(); i++) {
-        joins.joins[i] = tmp_joins[new_order[i]];
+        free_struct_group_table(&partition);
     }
+
+    print_group_records(&records, fl, num_keys, slots_key);
+
+    const int num_groups = records.top / SIZE_GROUP_RECORD(num_keys, num_aggregates);
+
+    free_struct_parse_context(&records);
+    free_struct_group_table(&table);
+
+    return num_groups;
 }
 
-/*
- ________                                            __      __                            ________                      __
-/        |                                          /  |    /  |                          /        |                    /  |
-$$$$$$$$/  __    __   ______    _______  __    __  _$$ |_   $$/   ______   _______        $$$$$$$$/  _______    ______  $$/  _______    ______
-$$ |__    /  \  /  | /      \  /       |/  |  /  |/ $$   |  /  | /      \ /       \       $$ |__    /       \  /      \ /  |/       \  /      \
-$$    |   $$  \/$$/ /$$$$$$  |/$$$$$$$/ $$ |  $$ |$$$$$$/   $$ |/$$$$$$  |$$$$$$$  |      $$    |   $$$$$$$  |/$$$$$$  |$$ |$$$$$$$  |/$$$$$$  |
-$$$$$/     $$  $$<  $$    $$ |$$ |      $$ |  $$ |  $$ | __ $$ |$$ |  $$ |$$ |  $$ |      $$$$$/    $$ |  $$ |$$ |  $$ |$$ |$$ |  $$ |$$    $$ |
-$$ |_____  /$$$$  \ $$$$$$$$/ $$ \_____ $$ \__$$ |  $$ |/  |$$ |$$ \__$$ |$$ |  $$ |      $$ |_____ $$ |  $$ |$$ \__$$ |$$ |$$ |  $$ |$$$$$$$$/
-$$       |/$$/ $$  |$$       |$$       |$$    $$/   $$  $$/ $$ |$$    $$/ $$ |  $$ |      $$       |$$ |  $$ |$$    $$ |$$ |$$ |  $$ |$$       |
-$$$$$$$$/ $$/   $$/  $$$$$$$/  $$$$$$$/  $$$$$$/     $$$$/  $$/  $$$$$$/  $$/   $$/       $$$$$$$$/ $$/   $$/  $$$$$$$ |$$/ $$/   $$/  $$$$$$$/
-                                                                                                              /  \__$$ |
-                                                                                                              $$    $$/
-                                                                                                               $$$$$$/
+//////////////////
+// Shared joins //
+//////////////////
+
+/**
+ * Set of queries of a batch, bit i is the i-th query of a shared join, see execute_shared_joins
  */
+typedef uint64_t QuerySet;
+
+#if SHARED_SCAN_BATCH > 64
+#error "SHARED_SCAN_BATCH has to fit in QuerySet"
+#endif
 
 /**
- * This struct is used to store number and the index of row they are in
+ * Queries of a batch that are joined once for all of them, see execute_shared_joins
  */
-typedef struct {
-    // the number at column
-    int number;
-    // the index or row in dataframe.index
-    int row;
-} struct_number_row;
+class SharedJoinGroup {
+public:
+    // position of each query in the batch, ascending
+    std::vector<int> members;
+    std::vector<struct_query *> queries;
 
-int cmp_struct_number_row_qsort(const void *p1, const void *p2) {
-    const struct_number_row *a = (const struct_number_row *) p1;
-    const struct_number_row *b = (const struct_number_row *) p2;
+    // of each query, its select on each relation, by relation - 'A', NULL if it has no predicate there
+    std::vector<std::vector<struct_shared_select *>> selects;
+};
 
-    if (a->number != b->number) {
-        if (a->number < b->number) {
-            return -1;
-        } else {
-            return 1;
+/**
+ * Estimated cost of planning and joining the query, with the given filtered cardinalities
+ * Each run of the joins also reads the column of each relation it joins on, which is counted as one per row
+ *
+ * @param files: relations have no data frame
+ * @param query
+ * @param cardinalities: by relation - 'A', -1 for every row of the relation
+ */
+float estimate_cost_of_joins(struct_files *const files, struct_query *const query, const std::vector<int> &cardinalities) {
+    // only the number of rows of a data frame is used to estimate
+    std::vector<struct_data_frame> dfs(files->length);
+
+    float cost = 0;
+    for (int i = 0; i < query->second.length; i++) {
+        struct_file *const file = &files->files[query->second.relations[i] - 'A'];
+        const int cardinality = cardinalities[file->relation - 'A'];
+
+        ASSERT(file->df == NULL);
+        if (cardinality != -1) {
+            dfs[file->relation - 'A'].num_row = cardinality;
+            file->df = &dfs[file->relation - 'A'];
         }
-    }
 
-    if (a->row < b->row) {
-        return -1;
-    } else if (a->row > b->row) {
-        return 1;
-    } else {
-        return 0;
+        cost += file->num_row;
     }
-}
 
-int cmp_struct_number_row_bsearch(const void *p1, const void *p2) {
-    const struct_number_row *a = (const struct_number_row *) p1;
-    const struct_number_row *b = (const struct_number_row *) p2;
+    JoinGraph graph;
+    init_join_graph(graph, files, query);
 
-    if (a->number < b->number) {
-        return -1;
-    } else if (a->number > b->number) {
-        return 1;
-    } else {
-        return 0;
-    }
-}
+    Order order;
+    plan_join_graph(graph, order);
 
-int findIndexOf(const char *const input, int length, char val) {
-    for (int i = 0; i < length; i++) {
-        if (input[i] == val) {
-            return i;
-        }
+    std::vector<PlanStep> steps;
+    estimate_order(graph, order, steps);
+    cost += steps.back().cost;
+
+    for (int i = 0; i < query->second.length; i++) {
+        files->files[query->second.relations[i] - 'A'].df = NULL;
     }
 
-    return -1;
+    return cost;
 }
 
 /**
- * Filter data in the relation, given predicate like A.c3 < 7666
- * And create filered index for input file
+ * If joining the queries once, with the rows any of them selected, is estimated to cost less than joining each of them
  *
- * @param file
- * @param predicate
+ * @param files: relations have no data frame
+ * @param queries: of the same join graph
+ * @param selects: of each query, its select on each relation, by relation - 'A', NULL if it has no predicate there
  */
-void filter_data_given_predicate(struct_file *file, const struct_predicate *const predicate) {
-    ASSERT(file->relation == predicate->lhs.relation);
+bool should_share_joins(struct_files *const files,
+                        const std::vector<struct_query *> &queries,
+                        const std::vector<std::vector<struct_shared_select *>> &selects) {
+    float cost_each = 0;
 
-    // empty file, do nothing
-    if (file->num_row == 0) {
-        return;
-    }
+    // rows of the relation selected by any query, at most the sum of them
+    std::vector<int> cardinalities_shared(files->length, 0);
 
-    // if dataframe is NULL, create dataframe
-    if (file->df == NULL) {
-        init_struct_data_frame_for_file(file);
-    }
+    for (int k = 0; k < queries.size(); k++) {
+        std::vector<int> cardinalities(files->length, -1);
 
-    // empty data frame, do nothing
-    if (file->df->num_row == 0) {
-        return;
+        for (int r = 0; r < files->length; r++) {
+            if (selects[k][r] != NULL) {
+                cardinalities[r] = selects[k][r]->num_row;
+            }
+
+            if (cardinalities_shared[r] != -1) {
+                cardinalities_shared[r] = cardinalities[r] == -1 ? -1 : std::min(
+                        cardinalities_shared[r] + cardinalities[r], files->files[r].num_row);
+            }
+        }
+
+        cost_each += estimate_cost_of_joins(files, queries[k], cardinalities);
     }
 
-    struct_data_frame *const df = file->df;
-    const int row = df->num_row;
+    return estimate_cost_of_joins(files, queries[0], cardinalities_shared) < cost_each;
+}
 
-    // pointer to file->df->index
-    size_t slow = 0;
-    // pointer to file->df->index
-    size_t fast = 0;
+/**
+ * Execute queries that have the same join graph, and no GROUP BY, by joining once
+ *
+ * Each relation is filtered to the rows that any query selected, and each row is tagged with the set of queries
+ * that selected it. The joins run once on these rows, and a row of the result belongs to the queries
+ * in the intersection of the sets of its rows. The aggregates of every query are computed in one pass
+ * over the result, see execute_sums: each block of a column is gathered once, and each query aggregates
+ * the rows of the block that belong to it.
+ *
+ * @param files: relations have no data frame
+ * @param queries: at most 64
+ * @param selects: of each query, its select on each relation, by relation - 'A', NULL if it has no predicate there.
+ *                 Their selection vectors are taken
+ * @param states: of each query, one state for each of its aggregates, filled
+ */
+void execute_shared_joins(struct_files *const files,
+                          const std::vector<struct_query *> &queries,
+                          const std::vector<std::vector<struct_shared_select *>> &selects,
+                          std::vector<std::vector<struct_aggregate_state>> &states) {
+    const int num_queries = queries.size();
+    ASSERT(num_queries <= 64);
 
-    // index of column
-    int column = predicate->lhs.column;
-    // the number @ given column
-    int number = 0;
-    int shouldKeep = 0;
+    const QuerySet all = num_queries == 64 ? ~(QuerySet) 0 : ((QuerySet) 1 << num_queries) - 1;
 
-    const int *const columns = select_column_from_file(file, column);
+    // queries that selected each row of each relation, empty if every query selected every row
+    std::vector<std::vector<QuerySet>> query_sets(files->length);
 
-    // for each row
-    for (; fast < row; fast++) {
-        shouldKeep = 0;
-        // get the number to be compared
-        number = columns[df->index[fast]];
+    struct_query *const query = queries[0];
+    for (int i = 0; i < query->second.length; i++) {
+        const int r = query->second.relations[i] - 'A';
+        struct_file *const file = &files->files[r];
 
-        switch (predicate->op) {
-            case EQUAL:
-                if (number == predicate->rhs) {
-                    shouldKeep = 1;
-                }
-                break;
-            case LESS_THAN:
-                if (number < predicate->rhs) {
-                    shouldKeep = 1;
-                }
-                break;
-            case GREATER_THAN:
-                if (number > predicate->rhs) {
-                    shouldKeep = 1;
-                }
-                break;
-            default:
-                fprintf(stderr, "Invalid operator");
-                break;
+        QuerySet selected_all = 0;
+        for (int k = 0; k < num_queries; k++) {
+            selected_all |= selects[k][r] == NULL ? (QuerySet) 1 << k : 0;
         }
 
-        // if met, copy row @ fast to row @ slow, slow++
-        if (shouldKeep == 0) {
+        // an empty relation has no data frame, as after filter_data_given_predicates
+        if (selected_all == all || file->num_row == 0) {
             continue;
         }
 
-        // copy index of row
-        df->index[slow] = df->index[fast];
-        slow++;
-    }
-
-    // update row of df
-    df->num_row = slow;
-
-    // if no rows selected, empty the index
-    if (df->num_row == 0) {
-        free(df->index);
-        df->index = NULL;
-    } else {
-        // realloc memory for df->index
-        df->index = (int *) realloc(df->index, df->num_row * sizeof(int));
-    }
-}
-
-/**
- * (Left deep) join two columns(represented by data frame) from two relation
- *
- * @param loaded_files
- * @param intermediate
- * @param relation
- * @param join
- */
-void sorted_nested_loop_join(const struct_files *const loaded_files,
-                             struct_data_frame *const intermediate,
-                             struct_file *const relation,
-                             const struct_join *join) {
-    ASSERT(loaded_files != NULL && intermediate != NULL && relation != NULL && join != NULL);
+        auto &sets = query_sets[r];
+        sets.assign(file->num_row, selected_all);
 
-    ///////////////////////////////////
-    // The new relations after join //
-    //////////////////////////////////
-    // first 1: size of relation
-    // number of relations, or number of index per row, of intermediate dataframe
-    int num_relations_before = strlen(intermediate->relations);
+        for (int k = 0; k < num_queries; k++) {
+            if (selects[k][r] != NULL) {
+                for (int j = 0; j < selects[k][r]->num_row; j++) {
+                    sets[selects[k][r]->index[j]] |= (QuerySet) 1 << k;
+                }
+            }
+        }
 
-    // second 1: make room for ending \0
-    size_t length_joined_relations = num_relations_before + 1 + 1;
-    // the name of the new relations, remeber to free the one from inter and assign this to it
-    char *relations_joined = (char *) malloc(length_joined_relations * sizeof(char));
-    // assign value
-    memcpy(relations_joined, intermediate->relations, num_relations_before);
-    relations_joined[length_joined_relations - 2] = relation->relation;
-    relations_joined[length_joined_relations - 1] = '\0';
+        int *index = (int *) malloc(file->num_row * sizeof(int));
+        int num_row = 0;
+        for (int row = 0; row < file->num_row; row++) {
+            index[num_row] = row;
+            num_row += sets[row] != 0;
+        }
 
-    // check if one of the df is empty, and don't init if isn't empty
-    // Init df for right hand side file
-    int is_right_df_null = 0;
-    if (relation->df == NULL) {
-        is_right_df_null = 1;
+        if (num_row == 0) {
+            free(index);
+            index = NULL;
+        } else {
+            index = (int *) realloc(index, num_row * sizeof(int));
+        }
+        init_struct_data_frame_for_file_given_index(file, index, num_row);
     }
 
-    /////////////////////////////////////////
-    // Stack for temp storing join results //
-    ////////////////////////////////////////
-    // we use the stack again, to store join results (index of rows)
-    struct_parse_context c;
-    init_struct_parse_context(&c, NULL);
+    for (int k = 0; k < num_queries; k++) {
+        for (int r = 0; r < files->length; r++) {
+            if (selects[k][r] != NULL) {
+                free(selects[k][r]->index);
+                selects[k][r]->index = NULL;
+            }
+        }
+    }
 
-    int offset_column_left = findIndexOf(intermediate->relations,
-                                         num_relations_before,
-                                         join->lhs.relation);
+    transfer_predicates(files, query, NULL);
 
-    //////////////////
-    // read columns //
-    //////////////////
-    struct_file *const file_left = loaded_files->files + (join->lhs.relation - 'A');
-    struct_file *const file_right = loaded_files->files + (join->rhs.relation - 'A');
-    const int *const column_left = select_column_from_file(file_left, join->lhs.column);
-    const int *const column_right = select_column_from_file(file_right, join->rhs.column);
+    JoinGraph graph;
+    init_join_graph(graph, files, query);
 
-    ///////////////////////////
-    // Buffer for outer loop //
-    ///////////////////////////
-    // todo: mem full: since a entire column can always fit in memeory, we read them in and sort
-    // buffer numbers in a column as a pair (number, row), sort buffer by number
-    int length_buffer_outer_loop = intermediate->num_row;
-    struct_number_row *buffer_outer_loop = (struct_number_row *) malloc(
-            length_buffer_outer_loop * sizeof(struct_number_row));
+    Order order;
+    plan_join_graph(graph, order);
 
-    // fill buffer with (number, index in df.index)
-    for (int i = 0; i < length_buffer_outer_loop; i++) {
-        buffer_outer_loop[i].row = i;
-        buffer_outer_loop[i].number = column_left[
-                intermediate->index[i * num_relations_before + offset_column_left]
-        ];
-    }
+    struct_data_frame result;
+    execute_joins(files, query, graph, order, &result, NULL);
 
-    // qsort
-    qsort(buffer_outer_loop, length_buffer_outer_loop, sizeof(struct_number_row), cmp_struct_number_row_qsort);
+    const int num_relations = strlen(result.relations);
 
-    // inner loop
-    // binary search the each number from the right relation in the left relation
-    for (int row_relation = 0;
-         row_relation < (is_right_df_null ? relation->num_row : relation->df->num_row);
-         row_relation++) {
-        const int number_right = is_right_df_null ? column_right[row_relation]
-                                                  : column_right[relation->df->index[row_relation]];
-
-        struct_number_row key;
-        key.number = number_right;
-
-        struct_number_row *res = (struct_number_row *) bsearch(
-                &key, buffer_outer_loop,
-                length_buffer_outer_loop,
-                sizeof(struct_number_row),
-                cmp_struct_number_row_bsearch);
-
-        if (res == NULL) {
-            continue;
-        }
+    int capacity = 0;
+    for (int k = 0; k < num_queries; k++) {
+        capacity += 2 * queries[k]->first.length;
+    }
 
-        int i = res - buffer_outer_loop;
+    struct_gather gather;
+    init_struct_gather(&gather, &result, capacity);
 
-        // todo: make this efficient
-        // move i to the first duplicate element
-        while (i > 0 && buffer_outer_loop[i].number == buffer_outer_loop[i - 1].number) {
-            i--;
-        }
+    // slot of each aggregate of each query, and of the rhs of its arithmetic, see execute_sums
+    std::vector<std::vector<int>> slots(num_queries);
+    std::vector<std::vector<int>> slots_rhs(num_queries);
 
-        // loop through buffer
-        // i = index of elements that number == number_right
-        for (; (i < length_buffer_outer_loop && buffer_outer_loop[i].number == number_right);
-               i++) {
-            // push this row (based on original file) into stack
-            // copy index[row_inter] from inter, and concat it with index[row_relation]
-            size_t size_to_copy = num_relations_before * sizeof(int);
+    for (int k = 0; k < num_queries; k++) {
+        const struct_first_line *const fl = &queries[k]->first;
+        states[k].assign(fl->length, struct_aggregate_state());
 
-            memcpy(context_push(&c, size_to_copy),
-                   &(intermediate->index[buffer_outer_loop[i].row * num_relations_before]),
-                   size_to_copy);
+        for (int col = 0; col < fl->length; col++) {
+            const struct_aggregate *aggregate = &fl->sums[col];
+            init_struct_aggregate_state(&states[k][col]);
 
-            *(int *) context_push(&c, sizeof(int)) = is_right_df_null ? row_relation
-                                                                      : relation->df->index[row_relation];
+            slots[k].push_back(aggregate->rc.relation == '*' ? -1 : add_column_to_gather(&gather, files, &aggregate->rc));
+            slots_rhs[k].push_back(aggregate->arithmetic == ARITHMETIC_NONE ? -1
+                                                                            : add_column_to_gather(&gather, files, &aggregate->rhs));
         }
     }
 
-    /////////////
-    // cleanup //
-    ////////////
-    free(intermediate->relations);
-    free(intermediate->index);
+    // queries of each row of the block, the rows of the block of one query, and its numbers of one aggregate
+    QuerySet sets_block[SIZE_AGGREGATE_BLOCK];
+    int rows[SIZE_AGGREGATE_BLOCK];
+    int numbers[SIZE_AGGREGATE_BLOCK];
+    int64_t wide[SIZE_AGGREGATE_BLOCK];
 
-    intermediate->relations = relations_joined;
+    for (int begin = 0; begin < result.num_row; begin += SIZE_AGGREGATE_BLOCK) {
+        const int length = std::min(SIZE_AGGREGATE_BLOCK, result.num_row - begin);
 
-    // copy index
-    // size of index, in bytes
-    size_t top = c.top;
+        gather_block(&gather, begin, length);
+
+        std::fill(sets_block, sets_block + length, all);
+        for (int j = 0; j < num_relations; j++) {
+            const auto &sets = query_sets[result.relations[j] - 'A'];
+            if (sets.empty()) {
+                continue;
+            }
+
+            const int *const index = &result.index[begin * num_relations + j];
+            for (int i = 0; i < length; i++) {
+                sets_block[i] &= sets[index[i * num_relations]];
+            }
+        }
 
-    if (top == 0) {
-        intermediate->index = NULL;
-        intermediate->num_row = 0;
-        free_struct_parse_context(&c);
-    } else {
-        // directly use the stack's memory, without creating new space and copying
-        int *tmp_index = (int *) context_pop(&c, top);
-        // manually empty c
-        c.top = 0;
-        c.size = 0;
-        c.stack = NULL;
+        for (int k = 0; k < num_queries; k++) {
+            int num_rows = 0;
+            for (int i = 0; i < length; i++) {
+                rows[num_rows] = i;
+                num_rows += (sets_block[i] >> k) & 1;
+            }
 
-        intermediate->index = (int *) realloc(tmp_index, top);
+            const struct_first_line *const fl = &queries[k]->first;
+            for (int col = 0; col < fl->length && num_rows != 0; col++) {
+                const int *const lhs = slots[k][col] == -1 ? NULL : gather_block_of(&gather, slots[k][col]);
+
+                if (slots_rhs[k][col] != -1) {
+                    const int *const rhs = gather_block_of(&gather, slots_rhs[k][col]);
+                    for (int i = 0; i < num_rows; i++) {
+                        wide[i] = evaluate_arithmetic(fl->sums[col].arithmetic, lhs[rows[i]], rhs[rows[i]]);
+                    }
+                    update_aggregate_state_wide(&states[k][col], fl->sums[col].function, wide, num_rows);
+                    continue;
+                }
 
-        // bytes / sizeof int / number per row = num of row
-        intermediate->num_row = top / strlen(intermediate->relations) / sizeof(int);
+                // COUNT(*) only needs the length
+                for (int i = 0; lhs != NULL && i < num_rows; i++) {
+                    numbers[i] = lhs[rows[i]];
+                }
+                update_aggregate_state(&states[k][col], fl->sums[col].function, numbers, num_rows);
+            }
+        }
     }
 
-    // don't free struct_parser
-    free(buffer_outer_loop);
+    free_struct_gather(&gather);
+    free_struct_data_frame(&result);
 }
 
-void sorted_nested_loop_join_both_joined_before(const struct_files *const loaded_files,
-                                                struct_data_frame *const intermediate,
-                                                const struct_join *join) {
-    ASSERT(loaded_files != NULL && intermediate != NULL && join != NULL);
+/////////////
+// Explain //
+/////////////
 
-    // we use the stack again
-    struct_parse_context c;
-    init_struct_parse_context(&c, NULL);
+/**
+ * What each operator of a query actually did, for EXPLAIN ANALYZE
+ */
+typedef struct {
+    // one for each predicate of the fourth line
+    struct_operator_stats *selects;
+    // one for each element of the join order
+    struct_operator_stats *joins;
+    struct_operator_stats aggregate;
+    // rows of all relations of the query, before and after transfer_predicates
+    struct_operator_stats predicate_transfer;
+
+    // in microseconds, time of optimize_joins, and of the rest of the query
+    long time_planning;
+    long time_execution;
+
+    // times execute_joins planned the rest of the joins again
+    int num_reoptimizations;
+} struct_query_stats;
+
+// A.c1
+const std::string format_relation_column(const struct_relation_column &rc) {
+    std::stringstream ss;
+    ss << rc.relation << ".c" << rc.column;
+    return ss.str();
+}
 
-    int num_relations = strlen(intermediate->relations);
+// SUM(A.c1 * B.c2), COUNT(*), A.c1
+const std::string format_aggregate(const struct_aggregate &aggregate) {
+    static const char *const NAME_ARITHMETIC[] = {"", " + ", " - ", " * "};
 
-    int offset_lhs = findIndexOf(intermediate->relations,
-                                 num_relations,
-                                 join->lhs.relation);
-    int offset_rhs = findIndexOf(intermediate->relations,
-                                 num_relations,
-                                 join->rhs.relation);
+    if (aggregate.function == AGGREGATE_COLUMN) {
+        return format_relation_column(aggregate.rc);
+    }
 
-    struct_file *const file_left = loaded_files->files + (join->lhs.relation - 'A');
-    struct_file *const file_right = loaded_files->files + (join->rhs.relation - 'A');
-    const int *const column_left = select_column_from_file(file_left, join->lhs.column);
-    const int *const column_right = select_column_from_file(file_right, join->rhs.column);
+    std::stringstream ss;
+    ss << NAME_AGGREGATE[aggregate.function];
+    if (aggregate.rc.relation == '*') {
+        ss << '*';
+    } else {
+        ss << format_relation_column(aggregate.rc);
+    }
 
+    if (aggregate.arithmetic != ARITHMETIC_NONE) {
+        ss << NAME_ARITHMETIC[aggregate.arithmetic] << format_relation_column(aggregate.rhs);
+    }
+    ss << ')';
 
-    // for each row in inter
-    for (int i = 0; i < intermediate->num_row; i++) {
-        const int *const row_index = &intermediate->index[i * num_relations];
+    return ss.str();
+}
 
-        int number_left = column_left[row_index[offset_lhs]];
-        int number_right = column_right[row_index[offset_rhs]];
+// A.c3 < 7, A.c3 BETWEEN 1 AND 5, A.c3 IN (1, 2), (A.c3 < 7 OR A.c1 = 2)
+const std::string format_predicate(const struct_predicate &predicate) {
+    std::stringstream ss;
 
-        if (number_left == number_right) {
-            size_t size_row = num_relations * sizeof(int);
+    switch (predicate.op) {
+        case OR:
+            ss << '(';
+            for (int i = 0; i < predicate.num_disjuncts; i++) {
+                ss << (i == 0 ? "" : " OR ") << format_predicate(predicate.disjuncts[i]);
+            }
+            ss << ')';
+            break;
+        case BETWEEN:
+            ss << format_relation_column(predicate.lhs) << " BETWEEN " << predicate.rhs << " AND "
+               << predicate.rhs_high;
+            break;
+        case IN:
+            ss << format_relation_column(predicate.lhs) << " IN (";
+            for (int i = 0; i < predicate.num_values; i++) {
+                ss << (i == 0 ? "" : ", ") << predicate.values[i];
+            }
+            ss << ')';
+            break;
+        default:
+            ss << format_relation_column(predicate.lhs) << ' ' << NAME_OPERATOR[predicate.op] << ' ' << predicate.rhs;
+    }
 
-            memcpy(context_push(&c, size_row),
-                   row_index,
-                   size_row);
+    return ss.str();
+}
+
+// A.c1 < B.c0
+const std::string format_join(const struct_join &join) {
+    return format_relation_column(join.lhs) + " " + NAME_OPERATOR[join.op] + " " + format_relation_column(join.rhs);
+}
+
+// relations of set, in the order of FROM
+const std::string relations_of_set(const JoinGraph &graph, const RelationSet set) {
+    std::string relations;
+    for (int i = 0; i < graph.relations.size(); i++) {
+        if (set & ((RelationSet) 1 << i)) {
+            relations += graph.relations[i];
         }
     }
 
-    // re-assign index
-    free(intermediate->index);
+    return relations;
+}
 
-    // copy index
-    // size of index, in bytes
-    size_t top = c.top;
-    if (top == 0) {
-        intermediate->index = NULL;
-        intermediate->num_row = 0;
-    } else {
-        // memcpy
-        int *tmp_index = (int *) context_pop(&c, top);
-        intermediate->index = (int *) malloc(top);
-        memcpy(intermediate->index, tmp_index, top);
+// " (actual rows=10 time=0.012ms read=4000B)", with the rows going in if there are any
+void print_operator_stats(const struct_operator_stats *const stats, const int has_rows_in) {
+    printf(" (actual rows=%ld", stats->rows_out);
 
-        // bytes / sizeof int / number per row = num of row
-        intermediate->num_row = top / num_relations / sizeof(int);
+    if (has_rows_in) {
+        printf(" in=%ld", stats->rows_in);
+        if (stats->rows_in_right != 0) {
+            printf("x%ld", stats->rows_in_right);
+        }
     }
 
-    free_struct_parse_context(&c);
+    printf(" time=%.3fms read=%zuB)", stats->time / 1000.0, stats->bytes_read);
 }
 
 /**
- * Execute the fourth line of SQL query
+ * Print step k of the plan and the steps below it, one line each, indented by depth
  *
- * @param loaded_file
- * @param fl
+ * A relation is a scan with the predicates pushed down to it, a join shows the clauses it joins on, see pick_join_clauses
+ * With stats, each line ends with what the step actually did, and each predicate has a line of its own under its scan
  */
-void execute_selects(struct_files *const loaded_file, const struct_fourth_line *const fl) {
-    for (int i = 0; i < fl->length; i++) {
-        const struct_predicate *const predicate = &fl->predicates[i];
-        char relation = predicate->lhs.relation;
+void explain_step(struct_query *const query,
+                  const JoinGraph &graph,
+                  const Order &order,
+                  const std::vector<PlanStep> &steps,
+                  const struct_query_stats *const stats,
+                  const int k,
+                  const int depth) {
+    const auto &step = steps[k];
+
+    printf("%*s-> ", depth * 3, "");
+
+    if (step.left == -1) {
+        printf("Scan %c", order[k]);
+
+        int num_filters = 0;
+        for (int i = 0; i < query->fourth.length; i++) {
+            const auto &predicate = query->fourth.predicates[i];
+
+            if (predicate.lhs.relation == order[k]) {
+                printf("%s%s", num_filters++ == 0 ? ", filter: " : " AND ",
+                       format_predicate(predicate).c_str());
+            }
+        }
+    } else {
+        const auto left = relations_of_set(graph, steps[step.left].relations);
+        const auto right = relations_of_set(graph, steps[step.right].relations);
+
+        struct_join *join = NULL;
+        struct_join *band = NULL;
+        pick_join_clauses(&query->third, left.c_str(), right.c_str(), &join, &band);
+        ASSERT(join != NULL);
+
+        printf("Sorted nested loop join: %s", format_join(*join).c_str());
+        if (band != NULL) {
+            printf(", band: %s", format_join(*band).c_str());
+        }
+
+        int num_filters = 0;
+        for (int i = 0; i < query->third.length; i++) {
+            const auto *clause = &query->third.joins[i];
+
+            if (clause != join && clause != band && is_join_between(clause, left.c_str(), left.length(), right.c_str())) {
+                printf("%s%s", num_filters++ == 0 ? ", filter: " : " AND ", format_join(*clause).c_str());
+            }
+        }
+    }
 
-        filter_data_given_predicate(&loaded_file->files[relation - 'A'], predicate);
+    printf(" (rows=%.0f cost=%.0f)", step.cardinality, step.cost);
+    if (stats != NULL && step.left != -1) {
+        print_operator_stats(&stats->joins[k], 1);
+    } else if (stats != NULL) {
+        // filters of the scan have lines of their own
+        printf(" (actual rows=%ld)", stats->joins[k].rows_out);
     }
-}
+    puts("");
 
+    if (step.left != -1) {
+        explain_step(query, graph, order, steps, stats, step.left, depth + 1);
+        explain_step(query, graph, order, steps, stats, step.right, depth + 1);
+    } else if (stats != NULL) {
+        // predicates in the order they are executed
+        for (int i = 0; i < query->fourth.length; i++) {
+            const auto &predicate = query->fourth.predicates[i];
+
+            if (predicate.lhs.relation == order[k]) {
+                printf("%*s-> Filter %s", (depth + 1) * 3, "", format_predicate(predicate).c_str());
+                print_operator_stats(&stats->selects[i], 1);
+                puts("");
+            }
+        }
+    }
+}
 
 /**
- * Execute all the joins, and assign the result to *result
+ * Print the plan of the query: the aggregate on top, then each join with the clauses it is done on,
+ * down to the scan of each relation with its predicates. Each step has its estimated number of rows and
+ * cost, the cost of a step includes the steps below it
  *
- * @param loaded_file
- * @param tl
- * @param result
+ * @param files: selects are already executed
+ * @param query
+ * @param order: plan computed by optimize_joins
+ * @param stats: @nullable, for EXPLAIN ANALYZE, what each operator actually did
  */
-void execute_joins(struct_files *const loaded_file, const struct_third_line *const tl, struct_data_frame *inter) {
-    if (tl->length == 0) {
-        ASSERT(0);
-        return;
+void explain_plan(struct_files *const files,
+                  struct_query *const query,
+                  const Order &order,
+                  const struct_query_stats *const stats) {
+    std::vector<std::string> aggregates;
+    for (int i = 0; i < query->first.length; i++) {
+        aggregates.push_back(format_aggregate(query->first.sums[i]));
     }
 
-    char first_relation = tl->joins[0].lhs.relation;
-    struct_file *first_file = &loaded_file->files[first_relation - 'A'];
-
-    if (first_file->df == NULL) {
-        init_struct_data_frame_for_file(first_file);
+    printf("%s: ", query->fourth.num_groups != 0 ? "Hash aggregate" : "Aggregate");
+    for (int i = 0; i < aggregates.size(); i++) {
+        printf("%s%s", i == 0 ? "" : ", ", aggregates[i].c_str());
     }
 
-    copy_struct_data_frame(first_file->df, inter);
+    for (int i = 0; i < query->fourth.num_groups; i++) {
+        printf("%s%s", i == 0 ? ", group by: " : ", ", format_relation_column(query->fourth.groups[i]).c_str());
+    }
 
-    // check if join valid
-    for (int i = 0; i < tl->length; i++) {
-        struct_join *join = &tl->joins[i];
+    if (stats != NULL) {
+        print_operator_stats(&stats->aggregate, 1);
+    }
+    puts("");
 
-        const int index_left = findIndexOf(inter->relations, strlen(inter->relations), join->lhs.relation);
-        const int index_right = findIndexOf(inter->relations, strlen(inter->relations), join->rhs.relation);
+    JoinGraph graph;
+    init_join_graph(graph, files, query);
 
-        // if both joined before
-        if (-1 != index_left && -1 != index_right) {
+    std::vector<PlanStep> steps;
+    estimate_order(graph, order, steps);
 
-            sorted_nested_loop_join_both_joined_before(loaded_file, inter, join);
-            continue;
-        }
+    explain_step(query, graph, order, steps, stats, order.size() - 1, 0);
 
-        // else if one of them is not joined before
-        // we swap the order of join to make sure the lhs one is joined before
-        if (-1 == index_left) {
-            // swap join lhs and rhs
-            struct_relation_column tmp = join->lhs;
-            join->lhs = join->rhs;
-            join->rhs = tmp;
-        }
+    if (stats != NULL) {
+        printf("Predicate transfer:");
+        print_operator_stats(&stats->predicate_transfer, 1);
+        puts("");
+    }
 
-        struct_file *rhs_file = &loaded_file->files[join->rhs.relation - 'A'];
+    if (stats != NULL && stats->num_reoptimizations != 0) {
+        printf("Re-optimized: %d times\n", stats->num_reoptimizations);
+    }
 
-        sorted_nested_loop_join(loaded_file, inter, rhs_file, join);
+    if (stats != NULL) {
+        printf("Planning time: %.3fms\n", stats->time_planning / 1000.0);
+        printf("Execution time: %.3fms\n", stats->time_execution / 1000.0);
     }
 }
 
 /**
- * Execute sums for each column
+ * Execute the rest of the query, once the selects are executed
  *
  * @param loaded_file
- * @param fl
- * @param result
- * @param ans
+ * @param query
+ * @param stats: @nullable, for EXPLAIN ANALYZE, with the selects filled
+ * @param time_begin: when the query began, in microseconds
  */
-void execute_sums(struct_files *const loaded_file,
-                  const struct_first_line *const fl,
-                  struct_data_frame *result,
-                  int64_t *ans) {
-    int num_relations = strlen(result->relations);
+void execute_selected(struct_files *const loaded_file,
+                      struct_query *const query,
+                      struct_query_stats *const stats,
+                      const long time_begin) {
+    // drop rows that no join can match
+    transfer_predicates(loaded_file, query, stats == NULL ? NULL : &stats->predicate_transfer);
 
-    for (int col = 0; col < fl->length; col++) {
-        // the sum query
-        struct_relation_column *rc = &fl->sums[col];
-        char relation = rc->relation;
+    struct_data_frame result;
+
+    // optimize join order
+    const long time_planning = time_in_microseconds();
+    JoinGraph graph;
+    Order order = optimize_joins(loaded_file, query, graph);
+
+    if (query->explain == EXPLAIN_PLAN) {
+        explain_plan(loaded_file, query, order, NULL);
+        return;
+    }
+
+    if (stats != NULL) {
+        stats->time_planning = time_in_microseconds() - time_planning;
+        stats->joins = (struct_operator_stats *) arena_alloc(
+                &loaded_file->arena, order.size() * sizeof(struct_operator_stats));
+    }
 
-        // find the index of this relation in the df
-        int offset = findIndexOf(result->relations, num_relations, relation);
+    // join, order becomes the plan actually executed
+    const int num_reoptimizations = execute_joins(loaded_file, query, graph, order, &result,
+                                                  stats == NULL ? NULL : stats->joins);
+    if (stats != NULL) {
+        stats->num_reoptimizations = num_reoptimizations;
+    }
 
-        // get the relation where this column in
-        struct_file *file = &loaded_file->files[relation - 'A'];
+    struct_operator_stats *const stats_aggregate = stats == NULL ? NULL : &stats->aggregate;
+    begin_operator_stats(stats_aggregate, result.num_row);
 
-        const int *const columns = select_column_from_file(file, rc->column);
+    if (query->fourth.num_groups != 0) {
+        // one line for each group
+        const int num_groups = execute_group_by(loaded_file, query, &result);
 
-        for (int i = 0; i < result->num_row; i++) {
-            ans[col] += columns[result->index[i * num_relations + offset]];
+        end_operator_stats(stats_aggregate, num_groups);
+    } else {
+        struct_aggregate_state *ans = (struct_aggregate_state *) arena_alloc(
+                &loaded_file->arena, query->first.length * sizeof(struct_aggregate_state));
+        for (int i = 0; i < query->first.length; i++) {
+            init_struct_aggregate_state(&ans[i]);
         }
+
+        // sum
+        execute_sums(loaded_file, &query->first, &result, ans);
+
+        // output result
+        print_aggregate_states(&query->first, ans);
+
+        end_operator_stats(stats_aggregate, 1);
+    }
+
+    if (stats != NULL) {
+        stats->time_execution = time_in_microseconds() - time_begin - stats->time_planning;
+        explain_plan(loaded_file, query, order, stats);
     }
+
+    // clean up
+    free_struct_data_frame(&result);
+
+#ifdef DEBUG_PROFILING
+    time_query = time_in_microseconds() - time_begin;
+    time_total += time_query;
+
+    fprintf(stderr,
+            "                 Query     Total\nTime        %10ld%10ld\nBuffer miss %10ld%10ld\nBuffer      %10ld%10ld\n\n",
+            time_query,
+            time_total,
+            count_buffer_total_query - count_buffer_hit_query,
+            count_buffer_total - count_buffer_hit_total,
+            count_buffer_total_query,
+            count_buffer_total);
+#endif
 }
 
 /**
@@ -2443,6 +7557,9 @@ void execute_sums(struct_files *const loaded_file,
  * 2. then join
  * 3. then SUM
  *
+ * Memory that lives only during this query comes from loaded_file->arena,
+ * which is released by free_only_struct_data_frames after the query
+ *
  * @param query
  */
 void execute(struct_files *const loaded_file, struct_query *const query) {
@@ -2451,49 +7568,208 @@ void execute(struct_files *const loaded_file, struct_query *const query) {
     count_buffer_hit_query = 0;
     count_buffer_total_query = 0;
 #endif
+    const long time_begin = time_in_microseconds();
+
+    // predicates implied by = joins, before the selects
+    infer_predicates(query, &loaded_file->arena);
+
+    // only measured for EXPLAIN ANALYZE
+    struct_query_stats *stats = NULL;
+    if (query->explain == EXPLAIN_ANALYZE) {
+        stats = (struct_query_stats *) arena_alloc(&loaded_file->arena, sizeof(struct_query_stats));
+        stats->selects = (struct_operator_stats *) arena_alloc(
+                &loaded_file->arena, query->fourth.length * sizeof(struct_operator_stats));
+    }
+
     // select
-    execute_selects(loaded_file, &query->fourth);
+    execute_selects(loaded_file, &query->fourth, stats == NULL ? NULL : stats->selects);
 
-    struct_data_frame result;
+    execute_selected(loaded_file, query, stats, time_begin);
+}
 
-    // optimize join order
-    optimize_joins(loaded_file, query);
+/**
+ * Execute every query of the batch, in order, each one cleaned up after it is done
+ *
+ * The selects of SHARED_SCAN_BATCH queries at a time are run together, one scan of each relation for all of them,
+ * see filter_data_given_shared_selects, unless the cache has their rows, see select_rows_from_cache.
+ * Each query keeps its selection vectors until it is executed.
+ * EXPLAIN ANALYZE measures each predicate on its own, so those queries run their selects themselves.
+ *
+ * Among those queries, the ones with the same join graph and no GROUP BY are joined once for all of them,
+ * if that is estimated to cost less, see execute_shared_joins. Their results are printed in order all the same.
+ *
+ * @param loaded_file
+ * @param queries
+ */
+void execute_queries(struct_files *const loaded_file, struct_queries *const queries) {
+    // predicates inferred for the queries of a batch, which live until the last of them is executed
+    struct_arena arena;
+    init_struct_arena(&arena);
 
-    // join
-    execute_joins(loaded_file, &query->third, &result);
+    for (int begin = 0; begin < queries->length; begin += SHARED_SCAN_BATCH) {
+        const int end = std::min(begin + SHARED_SCAN_BATCH, (int) queries->length);
 
-    size_t size_ans = query->first.length * sizeof(int64_t);
-    int64_t *ans = (int64_t *) malloc(size_ans);
-    memset(ans, 0, size_ans);
+        // selects of each relation, and the query of each
+        std::vector<std::vector<struct_shared_select>> selects(loaded_file->length);
+        std::vector<std::vector<int>> queries_of_selects(loaded_file->length);
 
-    // sum
-    execute_sums(loaded_file, &query->first, &result, ans);
+        for (int i = begin; i < end; i++) {
+            struct_query *const query = &queries->queries[i];
+            if (query->explain == EXPLAIN_ANALYZE) {
+                continue;
+            }
 
-    // output result
-    for (int i = 0; i < query->first.length; i++) {
-        if (result.num_row != 0) {
-            printf("%" PRId64, ans[i]);
+            infer_predicates(query, &arena);
+            order_predicates(loaded_file, &query->fourth);
+
+            // predicates are grouped by relation
+            const struct_fourth_line *const fl = &query->fourth;
+            for (int first = 0, last = 0; first < fl->length; first = last) {
+                const char relation = fl->predicates[first].lhs.relation;
+                while (last < fl->length && fl->predicates[last].lhs.relation == relation) {
+                    last++;
+                }
+
+                struct_shared_select select;
+                select.predicates = &fl->predicates[first];
+                select.num_predicates = last - first;
+                select.index = NULL;
+                select.num_row = 0;
+
+                selects[relation - 'A'].push_back(select);
+                queries_of_selects[relation - 'A'].push_back(i);
+            }
         }
-        if (i != query->first.length - 1) {
-            putc(',', stdout);
+
+        for (int relation = 0; relation < loaded_file->length; relation++) {
+            struct_file *const file = &loaded_file->files[relation];
+            if (file->num_row == 0) {
+                continue;
+            }
+
+            // selects the cache can not serve are scanned
+            std::vector<struct_shared_select> scans;
+            std::vector<int> positions;
+
+            for (int k = 0; k < selects[relation].size(); k++) {
+                auto &select = selects[relation][k];
+                if (!select_rows_from_cache(file, select.predicates, select.num_predicates, NULL,
+                                            &select.index, &select.num_row)) {
+                    scans.push_back(select);
+                    positions.push_back(k);
+                }
+            }
+
+            if (scans.empty()) {
+                continue;
+            }
+
+            filter_data_given_shared_selects(file, scans.data(), scans.size());
+
+            for (int k = 0; k < scans.size(); k++) {
+                selects[relation][positions[k]] = scans[k];
+                cache_row_set(file->relation, predicate_keys(scans[k].predicates, scans[k].num_predicates),
+                              scans[k].index, scans[k].num_row);
+            }
         }
-    }
-    puts("");
 
-    // clean up
-    free_struct_data_frame(&result);
-    free(ans);
+        // select of each query on each relation, NULL if it has no predicate there
+        std::vector<std::vector<struct_shared_select *>> selects_of_queries(
+                end - begin, std::vector<struct_shared_select *>(loaded_file->length, NULL));
+
+        for (int relation = 0; relation < loaded_file->length; relation++) {
+            for (int k = 0; k < selects[relation].size(); k++) {
+                selects_of_queries[queries_of_selects[relation][k] - begin][relation] = &selects[relation][k];
+            }
+        }
+
+        // queries of each join graph
+        std::unordered_map<std::string, std::vector<int>> join_graphs;
+        for (int i = begin; i < end; i++) {
+            if (queries->queries[i].explain == EXPLAIN_NONE && queries->queries[i].fourth.num_groups == 0) {
+                join_graphs[normalize_join_graph(&queries->queries[i])].push_back(i);
+            }
+        }
+
+        // queries that share joins, and the group each query is in, -1 if none
+        std::vector<SharedJoinGroup> groups;
+        std::vector<int> group_of(end - begin, -1);
+
+        for (const auto &join_graph: join_graphs) {
+            if (join_graph.second.size() < 2) {
+                continue;
+            }
+
+            SharedJoinGroup group;
+            group.members = join_graph.second;
+            for (const int i: group.members) {
+                group.queries.push_back(&queries->queries[i]);
+                group.selects.push_back(selects_of_queries[i - begin]);
+            }
+
+            if (!should_share_joins(loaded_file, group.queries, group.selects)) {
+                continue;
+            }
+
+            for (const int i: group.members) {
+                group_of[i - begin] = groups.size();
+            }
+            groups.push_back(std::move(group));
+        }
+
+        // results of the queries of a group, when the first of them is reached
+        std::vector<std::vector<struct_aggregate_state>> states(end - begin);
+
+        for (int i = begin; i < end; i++) {
+            struct_query *const query = &queries->queries[i];
+            if (query->explain == EXPLAIN_ANALYZE) {
+                execute(loaded_file, query);
+                free_only_struct_data_frames(loaded_file);
+                continue;
+            }
+
+            if (group_of[i - begin] != -1) {
+                const auto &group = groups[group_of[i - begin]];
+
+                if (group.members[0] == i) {
+                    std::vector<std::vector<struct_aggregate_state>> group_states(group.members.size());
+                    execute_shared_joins(loaded_file, group.queries, group.selects, group_states);
+                    free_only_struct_data_frames(loaded_file);
+
+                    for (int k = 0; k < group.members.size(); k++) {
+                        states[group.members[k] - begin] = std::move(group_states[k]);
+                    }
+                }
+
+                print_aggregate_states(&query->first, states[i - begin].data());
+                continue;
+            }
 
 #ifdef DEBUG_PROFILING
-    fprintf(stderr,
-            "                 Query     Total\nTime        %10ld%10ld\nBuffer miss %10ld%10ld\nBuffer      %10ld%10ld\n\n",
-            time_query,
-            time_total,
-            count_buffer_total_query - count_buffer_hit_query,
-            count_buffer_total - count_buffer_hit_total,
-            count_buffer_total_query,
-            count_buffer_total);
+            time_query = 0;
+            count_buffer_hit_query = 0;
+            count_buffer_total_query = 0;
 #endif
+            const long time_begin = time_in_microseconds();
+
+            for (int relation = 0; relation < loaded_file->length; relation++) {
+                const struct_shared_select *const select = selects_of_queries[i - begin][relation];
+                struct_file *const file = &loaded_file->files[relation];
+
+                // an empty relation has no data frame, as after filter_data_given_predicates
+                if (select != NULL && file->num_row != 0) {
+                    init_struct_data_frame_for_file_given_index(file, select->index, select->num_row);
+                }
+            }
+
+            execute_selected(loaded_file, query, NULL, time_begin);
+            free_only_struct_data_frames(loaded_file);
+        }
+
+        reset_struct_arena(&arena);
+    }
+
+    free_struct_arena(&arena);
 }
 
 #endif //LITE_DB_LITEDB_C
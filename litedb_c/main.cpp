@@ -34,13 +34,8 @@ int main() {
     free(second_part);
     free_struct_input_files(&files);
 
-    // execute each query
-    for (int i = 0; i < queries.length; i++) {
-        execute(&loaded_files, &queries.queries[i]);
-
-        // clean up df after each query
-        free_only_struct_data_frames(&loaded_files);
-    }
+    // execute each query, and clean up df after each query
+    execute_queries(&loaded_files, &queries);
 
     // free this at the end
     free_struct_queries(&queries);
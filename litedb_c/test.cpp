@@ -212,9 +212,9 @@ static void test_parse_first_line() {
     // check content size
     EXPECT_EQ_INT(3, (int) first_line.length);
     // check content
-    EXPECT_RELATION_COLUMN(&first_line.sums[0], 'D', 0);
-    EXPECT_RELATION_COLUMN(&first_line.sums[1], 'D', 4);
-    EXPECT_RELATION_COLUMN(&first_line.sums[2], 'C', 1);
+    EXPECT_RELATION_COLUMN(&first_line.sums[0].rc, 'D', 0);
+    EXPECT_RELATION_COLUMN(&first_line.sums[1].rc, 'D', 4);
+    EXPECT_RELATION_COLUMN(&first_line.sums[2].rc, 'C', 1);
 
     free_struct_parse_context(&c);
     free_struct_first_line(&first_line);
@@ -237,12 +237,13 @@ static void test_parse_sum() {
     struct_parse_context c;
     init_struct_parse_context(&c, "SUM(D.c0)\n");
 
-    struct_relation_column rc;
+    struct_aggregate aggregate;
 
     // run
-    parse_first_line_sum(&c, &rc);
+    parse_first_line_sum(&c, &aggregate);
 
-    EXPECT_RELATION_COLUMN(&rc, 'D', 0);
+    EXPECT_EQ_INT(AGGREGATE_SUM, aggregate.function);
+    EXPECT_RELATION_COLUMN(&aggregate.rc, 'D', 0);
 
     free_struct_parse_context(&c);
 }
@@ -258,10 +259,61 @@ static void test_parse_sums() {
 
     EXPECT_EQ_INT(4, (int) first.length);
 
-    EXPECT_RELATION_COLUMN(&first.sums[0], 'A', 1);
-    EXPECT_RELATION_COLUMN(&first.sums[1], 'C', 0);
-    EXPECT_RELATION_COLUMN(&first.sums[2], 'C', 3);
-    EXPECT_RELATION_COLUMN(&first.sums[3], 'C', 4);
+    EXPECT_RELATION_COLUMN(&first.sums[0].rc, 'A', 1);
+    EXPECT_RELATION_COLUMN(&first.sums[1].rc, 'C', 0);
+    EXPECT_RELATION_COLUMN(&first.sums[2].rc, 'C', 3);
+    EXPECT_RELATION_COLUMN(&first.sums[3].rc, 'C', 4);
+
+    free_struct_parse_context(&c);
+    free_struct_first_line(&first);
+}
+
+static void test_parse_aggregates() {
+    struct_parse_context c;
+    init_struct_parse_context(&c, "COUNT(*), MIN(A.c1), MAX(C.c0), AVG(C.c3), COUNT(B.c2)\n");
+
+    struct_first_line first;
+
+    parse_first_line_sums(&c, &first);
+
+    EXPECT_EQ_INT(5, (int) first.length);
+
+    EXPECT_EQ_INT(AGGREGATE_COUNT, first.sums[0].function);
+    EXPECT_EQ_CHAR('*', first.sums[0].rc.relation);
+    EXPECT_EQ_INT(AGGREGATE_MIN, first.sums[1].function);
+    EXPECT_RELATION_COLUMN(&first.sums[1].rc, 'A', 1);
+    EXPECT_EQ_INT(AGGREGATE_MAX, first.sums[2].function);
+    EXPECT_RELATION_COLUMN(&first.sums[2].rc, 'C', 0);
+    EXPECT_EQ_INT(AGGREGATE_AVG, first.sums[3].function);
+    EXPECT_RELATION_COLUMN(&first.sums[3].rc, 'C', 3);
+    EXPECT_EQ_INT(AGGREGATE_COUNT, first.sums[4].function);
+    EXPECT_RELATION_COLUMN(&first.sums[4].rc, 'B', 2);
+
+    free_struct_parse_context(&c);
+    free_struct_first_line(&first);
+}
+
+static void test_parse_arithmetic() {
+    struct_parse_context c;
+    init_struct_parse_context(&c, "SUM(A.c1 * B.c2), AVG(A.c3 + C.c0), MIN(B.c1-A.c0), SUM(A.c1)\n");
+
+    struct_first_line first;
+
+    parse_first_line_sums(&c, &first);
+
+    EXPECT_EQ_INT(4, (int) first.length);
+
+    EXPECT_EQ_INT(AGGREGATE_SUM, first.sums[0].function);
+    EXPECT_EQ_INT(ARITHMETIC_MULTIPLY, first.sums[0].arithmetic);
+    EXPECT_RELATION_COLUMN(&first.sums[0].rc, 'A', 1);
+    EXPECT_RELATION_COLUMN(&first.sums[0].rhs, 'B', 2);
+    EXPECT_EQ_INT(AGGREGATE_AVG, first.sums[1].function);
+    EXPECT_EQ_INT(ARITHMETIC_ADD, first.sums[1].arithmetic);
+    EXPECT_RELATION_COLUMN(&first.sums[1].rhs, 'C', 0);
+    EXPECT_EQ_INT(ARITHMETIC_SUBTRACT, first.sums[2].arithmetic);
+    EXPECT_RELATION_COLUMN(&first.sums[2].rc, 'B', 1);
+    EXPECT_RELATION_COLUMN(&first.sums[2].rhs, 'A', 0);
+    EXPECT_EQ_INT(ARITHMETIC_NONE, first.sums[3].arithmetic);
 
     free_struct_parse_context(&c);
     free_struct_first_line(&first);
@@ -280,10 +332,10 @@ static void test_parse_query() {
 
     EXPECT_EQ_INT(4, (int) first.length);
 
-    EXPECT_RELATION_COLUMN(&first.sums[0], 'A', 1);
-    EXPECT_RELATION_COLUMN(&first.sums[1], 'C', 0);
-    EXPECT_RELATION_COLUMN(&first.sums[2], 'C', 3);
-    EXPECT_RELATION_COLUMN(&first.sums[3], 'C', 4);
+    EXPECT_RELATION_COLUMN(&first.sums[0].rc, 'A', 1);
+    EXPECT_RELATION_COLUMN(&first.sums[1].rc, 'C', 0);
+    EXPECT_RELATION_COLUMN(&first.sums[2].rc, 'C', 3);
+    EXPECT_RELATION_COLUMN(&first.sums[3].rc, 'C', 4);
 
     // check second line
     struct_second_line second = query.second;
@@ -375,8 +427,24 @@ static void test_parse_third_line_join() {
 
     EXPECT_RELATION_COLUMN(&join.lhs, 'A', 2);
     EXPECT_RELATION_COLUMN(&join.rhs, 'C', 0);
+    EXPECT_EQ_INT(EQUAL, join.op);
+
+    free_struct_parse_context(&c);
+
+    // inequality
+    init_struct_parse_context(&c, "A.c2 < C.c0 AND B.c1 > A.c0\n");
+
+    struct_third_line tl;
+    parse_third_line_joins(&c, &tl);
+
+    EXPECT_EQ_INT(2, (int) tl.length);
+    EXPECT_EQ_INT(LESS_THAN, tl.joins[0].op);
+    EXPECT_RELATION_COLUMN(&tl.joins[1].lhs, 'B', 1);
+    EXPECT_EQ_INT(GREATER_THAN, tl.joins[1].op);
+    EXPECT_RELATION_COLUMN(&tl.joins[1].rhs, 'A', 0);
 
     free_struct_parse_context(&c);
+    free_struct_third_line(&tl);
 }
 
 static void test_parse_third_line_joins() {
@@ -479,6 +547,150 @@ static void test_parse_fourth_line() {
     free_struct_fourth_line(&fl);
 }
 
+static void test_parse_fourth_line_between() {
+    struct_parse_context c;
+    init_struct_parse_context(&c, "AND C.c2 BETWEEN -10 AND 25 AND A.c0 < -47;");
+
+    struct_fourth_line fl;
+    parse_fourth_line(&c, &fl);
+
+    EXPECT_EQ_INT(2, (int) fl.length);
+
+    EXPECT_RELATION_COLUMN(&fl.predicates[0].lhs, 'C', 2);
+    EXPECT_EQ_INT(BETWEEN, fl.predicates[0].op);
+    EXPECT_EQ_INT(-10, fl.predicates[0].rhs);
+    EXPECT_EQ_INT(25, fl.predicates[0].rhs_high);
+
+    EXPECT_RELATION_COLUMN(&fl.predicates[1].lhs, 'A', 0);
+    EXPECT_EQ_INT(LESS_THAN, fl.predicates[1].op);
+
+    free_struct_parse_context(&c);
+    free_struct_fourth_line(&fl);
+}
+
+static void test_parse_fourth_line_in() {
+    struct_parse_context c;
+    init_struct_parse_context(&c, "C.c2 IN (3, -4,5);");
+
+    struct_predicate p;
+    parse_fourth_line_predicate(&c, &p);
+
+    EXPECT_RELATION_COLUMN(&p.lhs, 'C', 2);
+    EXPECT_EQ_INT(IN, p.op);
+    EXPECT_EQ_INT(3, (int) p.num_values);
+    EXPECT_EQ_INT(3, p.values[0]);
+    EXPECT_EQ_INT(-4, p.values[1]);
+    EXPECT_EQ_INT(5, p.values[2]);
+    EXPECT_EQ_CHAR(';', c.input[0]);
+
+    free_struct_parse_context(&c);
+    free_struct_predicate(&p);
+}
+
+static void test_parse_fourth_line_or() {
+    struct_parse_context c;
+    init_struct_parse_context(&c, "AND (B.c1 = 3 OR B.c0 IN (1, 2) OR B.c1 BETWEEN 7 AND 9) AND A.c0 > 1;");
+
+    struct_fourth_line fl;
+    parse_fourth_line(&c, &fl);
+
+    EXPECT_EQ_INT(2, (int) fl.length);
+
+    const struct_predicate *p = &fl.predicates[0];
+    EXPECT_EQ_INT(OR, p->op);
+    EXPECT_RELATION_COLUMN(&p->lhs, 'B', 1);
+    EXPECT_EQ_INT(3, (int) p->num_disjuncts);
+
+    EXPECT_EQ_INT(EQUAL, p->disjuncts[0].op);
+    EXPECT_EQ_INT(3, p->disjuncts[0].rhs);
+    EXPECT_EQ_INT(IN, p->disjuncts[1].op);
+    EXPECT_RELATION_COLUMN(&p->disjuncts[1].lhs, 'B', 0);
+    EXPECT_EQ_INT(2, (int) p->disjuncts[1].num_values);
+    EXPECT_EQ_INT(BETWEEN, p->disjuncts[2].op);
+    EXPECT_EQ_INT(9, p->disjuncts[2].rhs_high);
+
+    EXPECT_RELATION_COLUMN(&fl.predicates[1].lhs, 'A', 0);
+    EXPECT_EQ_INT(GREATER_THAN, fl.predicates[1].op);
+
+    free_struct_parse_context(&c);
+    free_struct_fourth_line(&fl);
+}
+
+static void test_parse_fourth_line_group_by() {
+    struct_parse_context c;
+    init_struct_parse_context(&c, "AND C.c2 = -2247 AND A.c0 < -47 GROUP BY A.c1, C.c0;");
+
+    struct_fourth_line fl;
+    parse_fourth_line(&c, &fl);
+
+    EXPECT_EQ_INT(2, (int) fl.length);
+    EXPECT_RELATION_COLUMN(&fl.predicates[1].lhs, 'A', 0);
+
+    EXPECT_EQ_INT(2, (int) fl.num_groups);
+    EXPECT_RELATION_COLUMN(&fl.groups[0], 'A', 1);
+    EXPECT_RELATION_COLUMN(&fl.groups[1], 'C', 0);
+
+    free_struct_parse_context(&c);
+    free_struct_fourth_line(&fl);
+
+    // without predicates
+    init_struct_parse_context(&c, "GROUP BY B.c3;");
+    parse_fourth_line(&c, &fl);
+
+    EXPECT_EQ_INT(0, (int) fl.length);
+    EXPECT_EQ_INT(1, (int) fl.num_groups);
+    EXPECT_RELATION_COLUMN(&fl.groups[0], 'B', 3);
+
+    free_struct_parse_context(&c);
+    free_struct_fourth_line(&fl);
+}
+
+static void test_parse_query_group_by() {
+    struct_parse_context c;
+    init_struct_parse_context(&c,
+                              "SELECT A.c1, SUM(C.c0)\nFROM A, C\nWHERE A.c2 = C.c0\nAND GROUP BY A.c1;");
+
+    struct_query query;
+    parse_query(&c, &query);
+
+    EXPECT_EQ_INT(2, (int) query.first.length);
+    EXPECT_EQ_INT(AGGREGATE_COLUMN, query.first.sums[0].function);
+    EXPECT_RELATION_COLUMN(&query.first.sums[0].rc, 'A', 1);
+    EXPECT_EQ_INT(AGGREGATE_SUM, query.first.sums[1].function);
+
+    EXPECT_EQ_INT(0, (int) query.fourth.length);
+    EXPECT_EQ_INT(1, (int) query.fourth.num_groups);
+    EXPECT_RELATION_COLUMN(&query.fourth.groups[0], 'A', 1);
+
+    free_struct_parse_context(&c);
+    free_struct_query(&query);
+}
+
+static void test_arena() {
+    struct_arena arena;
+    init_struct_arena(&arena);
+
+    // aligned, and does not overlap
+    char *a = (char *) arena_alloc(&arena, 3);
+    char *b = (char *) arena_alloc(&arena, 5);
+    EXPECT_EQ_INT(0, (int) ((uintptr_t) a % ARENA_ALIGNMENT));
+    EXPECT_EQ_INT(0, (int) ((uintptr_t) b % ARENA_ALIGNMENT));
+    EXPECT_EQ_INT(1, b >= a + 3);
+
+    // larger than a block
+    int *large = (int *) arena_alloc(&arena, ARENA_BLOCK_SIZE * 2);
+    large[ARENA_BLOCK_SIZE / 2 - 1] = 7;
+    EXPECT_EQ_INT(7, large[ARENA_BLOCK_SIZE / 2 - 1]);
+
+    // reset keeps only the newest block, and hands it out from the start
+    reset_struct_arena(&arena);
+    EXPECT_EQ_INT(1, arena.head->prev == NULL);
+    EXPECT_EQ_INT(1, (int *) arena_alloc(&arena, sizeof(int)) == large);
+
+    free_struct_arena(&arena);
+    EXPECT_EQ_INT(1, arena.head == NULL);
+}
+
 static void test_parse_queries() {
     const char path[] = "./test_input/queries.txt";
 
@@ -615,6 +827,30 @@ static void test_parse_full(char *path) {
     free_struct_queries(&queries);
 }
 
+static void test_parse_explain() {
+    struct_parse_context c;
+    init_struct_parse_context(&c,
+                              "EXPLAIN SELECT SUM(A.C1)\nFROM A, B\nWHERE A.C1 = B.C0\nAND B.C2 IN (1, 2);\n\n"
+                              "SELECT SUM(B.C2)\nFROM A, B\nWHERE A.C1 = B.C0\n;\n\n"
+                              "EXPLAIN ANALYZE SELECT SUM(B.C2)\nFROM A, B\nWHERE A.C1 = B.C0\n;");
+
+    struct_queries queries;
+    parse_queries(&c, &queries);
+
+    EXPECT_EQ_INT(3, (int) queries.length);
+    EXPECT_EQ_INT(EXPLAIN_PLAN, queries.queries[0].explain);
+    EXPECT_EQ_INT(EXPLAIN_NONE, queries.queries[1].explain);
+    EXPECT_EQ_INT(EXPLAIN_ANALYZE, queries.queries[2].explain);
+    EXPECT_RELATION_COLUMN(&queries.queries[2].first.sums[0].rc, 'B', 2);
+    EXPECT_RELATION_COLUMN(&queries.queries[0].first.sums[0].rc, 'A', 1);
+
+    const std::string predicate = format_predicate(queries.queries[0].fourth.predicates[0]);
+    EXPECT_EQ_STRING("B.c2 IN (1, 2)", predicate.c_str(), predicate.length());
+
+    free_struct_parse_context(&c);
+    free_struct_queries(&queries);
+}
+
 static void test_parse() {
     // test parser first part
     test_parse_first_part();
@@ -654,6 +890,19 @@ static void test_parse() {
     test_parse_full("./test_input/full_l2.txt");
 }
 
+// tests of the parser that need no ../data, test_parse is left out of main
+static void test_parse_standalone() {
+    test_parse_fourth_line_between();
+    test_parse_fourth_line_in();
+    test_parse_fourth_line_or();
+    test_parse_aggregates();
+    test_parse_fourth_line_group_by();
+    test_parse_query_group_by();
+    test_arena();
+    test_parse_arithmetic();
+    test_parse_explain();
+}
+
 // test A.c0 = 4422
 static void test_predicate_simple_1() {
     struct_file file;
@@ -737,6 +986,173 @@ WHERE C.c2 > 3854137 AND C.c4 < -3262;
     free_struct_file(&file);
 }
 
+static void test_predicate_fused() {
+    struct_files files;
+    init_struct_files(&files, 1);
+
+    // 1,2,3
+    // 4,5,6
+    struct_file *const file = &files.files[0];
+    char path[] = "./test_input/join/A.csv";
+    load_csv_file('A', path, file);
+
+    // a predicate that keeps every row is put first
+    struct_predicate predicates[3];
+    predicates[0].lhs.relation = 'A';
+    predicates[0].lhs.column = 0;
+    predicates[0].op = LESS_THAN;
+    predicates[0].rhs = INT32_MAX;
+
+    predicates[1] = predicates[0];
+    predicates[1].lhs.column = 1;
+    predicates[1].op = GREATER_THAN;
+    predicates[1].rhs = 2;
+
+    predicates[2] = predicates[1];
+    predicates[2].lhs.column = 2;
+    predicates[2].rhs = 4;
+
+    struct_fourth_line fl;
+    fl.predicates = predicates;
+    fl.length = 3;
+    fl.num_groups = 0;
+
+    order_predicates(&files, &fl);
+    EXPECT_EQ_INT(0, predicates[2].lhs.column);
+
+    struct_operator_stats stats[3];
+    filter_data_given_predicates(file, predicates, 3, stats);
+
+    EXPECT_EQ_INT(1, file->df->num_row);
+    EXPECT_EQ_INT(1, file->df->index[0]);
+
+    // every row is checked by the first predicate, the last one only sees rows left by the others
+    EXPECT_EQ_INT(2, (int) stats[0].rows_in);
+    EXPECT_EQ_INT(1, (int) stats[2].rows_in);
+    EXPECT_EQ_INT(1, (int) stats[2].rows_out);
+
+    free_struct_files(&files);
+}
+
+static void test_predicate_shared() {
+    struct_files files;
+    init_struct_files(&files, 1);
+
+    // 1,2,3
+    // 4,5,6
+    struct_file *const file = &files.files[0];
+    char path[] = "./test_input/join/A.csv";
+    load_csv_file('A', path, file);
+
+    struct_predicate predicates[3];
+    predicates[0].lhs.relation = 'A';
+    predicates[0].lhs.column = 1;
+    predicates[0].op = GREATER_THAN;
+    predicates[0].rhs = 2;
+
+    predicates[1] = predicates[0];
+    predicates[1].op = LESS_THAN;
+    predicates[1].rhs = 0;
+
+    predicates[2] = predicates[0];
+    predicates[2].lhs.column = 0;
+    predicates[2].op = LESS_THAN;
+    predicates[2].rhs = 5;
+
+    // A.c1 > 2, A.c1 < 0 AND A.c0 < 5, A.c0 < 5
+    struct_shared_select selects[3];
+    selects[0].predicates = &predicates[0];
+    selects[0].num_predicates = 1;
+    selects[1].predicates = &predicates[1];
+    selects[1].num_predicates = 2;
+    selects[2].predicates = &predicates[2];
+    selects[2].num_predicates = 1;
+
+    filter_data_given_shared_selects(file, selects, 3);
+
+    EXPECT_EQ_INT(1, selects[0].num_row);
+    EXPECT_EQ_INT(1, selects[0].index[0]);
+    EXPECT_EQ_INT(0, selects[1].num_row);
+    EXPECT_EQ_INT(1, selects[1].index == NULL);
+    EXPECT_EQ_INT(2, selects[2].num_row);
+    EXPECT_EQ_INT(0, selects[2].index[0]);
+    EXPECT_EQ_INT(1, selects[2].index[1]);
+
+    // the relation itself is not filtered
+    EXPECT_EQ_INT(1, file->df == NULL);
+
+    for (int k = 0; k < 3; k++) {
+        free(selects[k].index);
+    }
+    free_struct_files(&files);
+}
+
+static void test_predicate_cached() {
+    struct_files files;
+    init_struct_files(&files, 1);
+
+    // 1,2,3
+    // 4,5,6
+    struct_file *const file = &files.files[0];
+    char path[] = "./test_input/join/A.csv";
+    load_csv_file('A', path, file);
+
+    struct_predicate predicates[2];
+    predicates[0].lhs.relation = 'A';
+    predicates[0].lhs.column = 1;
+    predicates[0].op = GREATER_THAN;
+    predicates[0].rhs = 0;
+
+    predicates[1] = predicates[0];
+    predicates[1].lhs.column = 2;
+    predicates[1].rhs = 3;
+
+    struct_operator_stats stats[2];
+    int *index = NULL;
+    int num_row = 0;
+
+    // nothing is cached yet
+    EXPECT_EQ_INT(0, select_rows_from_cache(file, predicates, 2, stats, &index, &num_row));
+
+    // A.c1 > 0
+    filter_data_given_predicates(file, predicates, 1, NULL);
+    cache_row_set('A', predicate_keys(predicates, 1), file->df->index, file->df->num_row);
+    free_struct_data_frame_of_file(file);
+
+    // A.c1 > 0 AND A.c2 > 3 starts from the rows of A.c1 > 0
+    EXPECT_EQ_INT(1, select_rows_from_cache(file, predicates, 2, stats, &index, &num_row));
+    EXPECT_EQ_INT(1, num_row);
+    EXPECT_EQ_INT(1, index[0]);
+    EXPECT_EQ_INT(2, (int) stats[0].rows_in);
+    EXPECT_EQ_INT(2, (int) stats[0].rows_out);
+    EXPECT_EQ_INT(2, (int) stats[1].rows_in);
+    EXPECT_EQ_INT(1, (int) stats[1].rows_out);
+    EXPECT_EQ_INT(1, file->df == NULL);
+    free(index);
+
+    // and is cached in turn, with no predicate left to run
+    EXPECT_EQ_INT(1, select_rows_from_cache(file, predicates, 2, stats, &index, &num_row));
+    EXPECT_EQ_INT(1, num_row);
+    EXPECT_EQ_INT(1, (int) stats[1].rows_in);
+    free(index);
+
+    // A.c1 > 100 meets no row, which is cached too
+    struct_predicate none = predicates[0];
+    none.rhs = 100;
+    filter_data_given_predicates(file, &none, 1, NULL);
+    EXPECT_EQ_INT(0, file->df->num_row);
+    cache_row_set('A', predicate_keys(&none, 1), file->df->index, file->df->num_row);
+    free_struct_data_frame_of_file(file);
+
+    EXPECT_EQ_INT(1, select_rows_from_cache(file, &none, 1, NULL, &index, &num_row));
+    EXPECT_EQ_INT(0, num_row);
+    EXPECT_EQ_INT(1, index == NULL);
+
+    // the cache is dropped with the data
+    free_struct_files(&files);
+    EXPECT_EQ_INT(1, row_set_cache['A' - 'A'].empty());
+}
+
 static void test_predicate_xxs_1() {
     struct_file file;
     init_struct_file(&file);
@@ -779,6 +1195,55 @@ static void test_predicate_m_1() {
     free_struct_file(&file);
 }
 
+static void test_predicate_between_in_or() {
+    struct_file file;
+    init_struct_file(&file);
+
+    // 1,2,3
+    // 4,5,6
+    char path[] = "./test_input/join/A.csv";
+    load_csv_file('A', path, &file);
+
+    struct_predicate between;
+    between.lhs.relation = 'A';
+    between.lhs.column = 0;
+    between.op = BETWEEN;
+    between.rhs = 0;
+    between.rhs_high = 4;
+
+    filter_data_given_predicate(&file, &between);
+    EXPECT_EQ_INT(2, file.df->num_row);
+
+    int values[] = {2000000000, 5};
+    struct_predicate in;
+    in.lhs.relation = 'A';
+    in.lhs.column = 1;
+    in.op = IN;
+    in.values = values;
+    in.num_values = 2;
+
+    struct_predicate disjuncts[] = {in, between};
+    disjuncts[1].lhs.column = 2;
+    disjuncts[1].rhs = 3;
+    disjuncts[1].rhs_high = 3;
+
+    struct_predicate any;
+    any.lhs.relation = 'A';
+    any.lhs.column = 1;
+    any.op = OR;
+    any.disjuncts = disjuncts;
+    any.num_disjuncts = 2;
+
+    filter_data_given_predicate(&file, &any);
+    EXPECT_EQ_INT(2, file.df->num_row);
+
+    filter_data_given_predicate(&file, &in);
+    EXPECT_EQ_INT(1, file.df->num_row);
+    EXPECT_EQ_INT(1, file.df->index[0]);
+
+    free_struct_file(&file);
+}
+
 static void test_predicates() {
     test_predicate_simple_1();
     test_predicate_simple_2();
@@ -790,6 +1255,13 @@ static void test_predicates() {
 #endif
 }
 
+// tests of predicates that need no ../data, test_predicates is left out of main
+static void test_predicates_standalone() {
+    test_predicate_between_in_or();
+    test_predicate_fused();
+    test_predicate_shared();
+}
+
 /**
  * 1. load path from stdin
  * 2. load files given path
@@ -820,6 +1292,7 @@ static void test_join_manual() {
     join.lhs.column = 2;
     join.rhs.relation = 'B';
     join.rhs.column = 0;
+    join.op = EQUAL;
 
     // create intermediate data frame
     // free!
@@ -838,7 +1311,7 @@ static void test_join_manual() {
     init_struct_data_frame_for_file(&loaded_files.files[0]);
     init_struct_data_frame_for_file(&loaded_files.files[1]);
 
-    sorted_nested_loop_join(&loaded_files, &df, &loaded_files.files[1], &join);
+    sorted_nested_loop_join(&loaded_files, &df, &loaded_files.files[1], &join, NULL);
 
     // check result
     // index = 0001
@@ -855,47 +1328,873 @@ static void test_join_manual() {
     free_struct_data_frame(&df);
 }
 
-static void test_join() {
-    test_join_manual();
+static void test_join_band() {
+    freopen("./test_input/join_manual.txt", "r", stdin);
+
+    char *input = NULL;
+    read_first_part_from_stdin(&input);
+
+    struct_input_files inputs;
+    init_struct_input_files(&inputs);
+
+    parse_first_part(&inputs, input);
+
+    struct_files loaded_files;
+    load_csv_files(&inputs, &loaded_files);
+
+    // A.c1 > B.c0 AND A.c1 < B.c1
+    struct_join join;
+    join.lhs.relation = 'A';
+    join.lhs.column = 1;
+    join.rhs.relation = 'B';
+    join.rhs.column = 0;
+    join.op = GREATER_THAN;
+
+    struct_join band = join;
+    band.rhs.column = 1;
+    band.op = LESS_THAN;
+
+    init_struct_data_frame_for_file(&loaded_files.files[0]);
+
+    struct_data_frame df;
+    copy_struct_data_frame(loaded_files.files[0].df, &df);
+
+    sorted_nested_loop_join(&loaded_files, &df, &loaded_files.files[1], &join, &band);
+
+    // only the second row of A is in (3, 10) and (3, 12)
+    // index = 1011
+    EXPECT_EQ_INT(2, df.num_row);
+    EXPECT_EQ_INT(1, df.index[0]);
+    EXPECT_EQ_INT(0, df.index[1]);
+    EXPECT_EQ_INT(1, df.index[2]);
+    EXPECT_EQ_INT(1, df.index[3]);
+
+    free(input);
+    free_struct_input_files(&inputs);
+    free_struct_files(&loaded_files);
+    free_struct_data_frame(&df);
 }
 
-static void test_main() {
-    freopen("./test_input/full_xs.txt", "r", stdin);
+static void test_join_data_frames() {
+    freopen("./test_input/join_bushy.txt", "r", stdin);
 
-    char *first_part = NULL;
-    read_first_part_from_stdin(&first_part);
+    char *input = NULL;
+    read_first_part_from_stdin(&input);
 
-    char *second_part = NULL;
-    read_second_part_from_stdin(&second_part);
+    struct_input_files inputs;
+    init_struct_input_files(&inputs);
 
-    // handle path to files
-    struct_input_files files;
-    init_struct_input_files(&files);
+    parse_first_part(&inputs, input);
 
-    // parse first part
-    parse_first_part(&files, first_part);
+    struct_files loaded_files;
+    load_csv_files(&inputs, &loaded_files);
 
-    // parse queries
-    struct_queries queries;
-    parse_second_part(&queries, second_part);
+    // (A join B on A.c2 = B.c0) join (C join D on C.c1 = D.c0) on B.c1 = C.c0
+    struct_join join_AB;
+    join_AB.lhs.relation = 'A';
+    join_AB.lhs.column = 2;
+    join_AB.rhs.relation = 'B';
+    join_AB.rhs.column = 0;
+    join_AB.op = EQUAL;
+
+    struct_join join_CD = join_AB;
+    join_CD.lhs.relation = 'C';
+    join_CD.lhs.column = 1;
+    join_CD.rhs.relation = 'D';
+    join_CD.rhs.column = 0;
+
+    struct_join join_BC = join_AB;
+    join_BC.lhs.relation = 'B';
+    join_BC.lhs.column = 1;
+    join_BC.rhs.relation = 'C';
+    join_BC.rhs.column = 0;
+
+    init_struct_data_frame_for_file(&loaded_files.files[0]);
+    init_struct_data_frame_for_file(&loaded_files.files[2]);
+
+    struct_data_frame df_AB, df_CD;
+    copy_struct_data_frame(loaded_files.files[0].df, &df_AB);
+    copy_struct_data_frame(loaded_files.files[2].df, &df_CD);
+
+    sorted_nested_loop_join(&loaded_files, &df_AB, &loaded_files.files[1], &join_AB, NULL);
+    sorted_nested_loop_join(&loaded_files, &df_CD, &loaded_files.files[3], &join_CD, NULL);
+    EXPECT_EQ_INT(2, df_AB.num_row);
+    EXPECT_EQ_INT(3, df_CD.num_row);
+
+    sorted_nested_loop_join_data_frames(&loaded_files, &df_AB, &df_CD, &join_BC, NULL);
+
+    // rows of right are in the order of D: (C1, D0), (C2, D0), (C0, D1), and C2 has no match
+    // index = 0110 0001
+    EXPECT_EQ_STRING("ABCD", df_AB.relations, 4);
+    EXPECT_EQ_INT(2, df_AB.num_row);
+
+    const int expected[] = {0, 1, 1, 0, 0, 0, 0, 1};
+    for (int i = 0; i < 8; i++) {
+        EXPECT_EQ_INT(expected[i], df_AB.index[i]);
+    }
+
+    free(input);
+    free_struct_input_files(&inputs);
+    free_struct_files(&loaded_files);
+    free_struct_data_frame(&df_AB);
+    free_struct_data_frame(&df_CD);
+}
+
+static void test_transfer_predicates() {
+    freopen("./test_input/join_bushy.txt", "r", stdin);
+
+    char *input = NULL;
+    read_first_part_from_stdin(&input);
+
+    struct_input_files inputs;
+    init_struct_input_files(&inputs);
+
+    parse_first_part(&inputs, input);
 
     struct_files loaded_files;
+    load_csv_files(&inputs, &loaded_files);
 
-    // convert csv files into binary representation
-    load_csv_files(&files, &loaded_files);
+    struct_parse_context c;
+    init_struct_parse_context(&c, "SELECT SUM(A.c0)\nFROM A, B, C, D\nWHERE A.c2 = B.c0 AND B.c1 = C.c0 AND C.c1 = D.c0\n"
+                                  "AND D.c1 = 7;");
 
-    // free data that we don't need
-    free(first_part);
-    free(second_part);
-    free_struct_input_files(&files);
+    struct_queries queries;
+    parse_queries(&c, &queries);
 
-    // execute each query
-    for (int i = 0; i < queries.length; i++) {
-        execute(&loaded_files, &queries.queries[i]);
+    struct_query *const query = &queries.queries[0];
+    execute_selects(&loaded_files, &query->fourth, NULL);
 
-        // clean up df after each query
-        free_only_struct_data_frames(&loaded_files);
+    struct_operator_stats stats;
+    transfer_predicates(&loaded_files, query, &stats);
+
+    // D (4, 7) only joins C (12, 4), which only joins B (3, 12), which only joins A (1, 2, 3)
+    EXPECT_EQ_INT(8, (int) stats.rows_in);
+    EXPECT_EQ_INT(4, (int) stats.rows_out);
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQ_INT(1, loaded_files.files[i].df->num_row);
     }
+    EXPECT_EQ_INT(0, loaded_files.files[0].df->index[0]);
+    EXPECT_EQ_INT(1, loaded_files.files[1].df->index[0]);
+    EXPECT_EQ_INT(1, loaded_files.files[2].df->index[0]);
+
+    free(input);
+    free_struct_input_files(&inputs);
+    free_struct_files(&loaded_files);
+    free_struct_parse_context(&c);
+    free_struct_queries(&queries);
+}
+
+static void test_transfer_predicates_wide() {
+    freopen("./test_input/join_wide.txt", "r", stdin);
+
+    char *input = NULL;
+    read_first_part_from_stdin(&input);
+
+    struct_input_files inputs;
+    init_struct_input_files(&inputs);
+
+    parse_first_part(&inputs, input);
+
+    struct_files loaded_files;
+    load_csv_files(&inputs, &loaded_files);
+
+    struct_parse_context c;
+    init_struct_parse_context(&c, "SELECT SUM(A.c1)\nFROM A, B\nWHERE A.c0 = B.c0\n;");
+
+    struct_queries queries;
+    parse_queries(&c, &queries);
+
+    struct_query *const query = &queries.queries[0];
+    execute_selects(&loaded_files, &query->fourth, NULL);
+    transfer_predicates(&loaded_files, query, NULL);
+
+    // numbers of A (0, 1000000) are too far apart for a bitmap, and 2783 of B is a false positive of their
+    // Bloom filter, yet a tree is left with only rows that join
+    EXPECT_EQ_INT(1, loaded_files.files[0].df->num_row);
+    EXPECT_EQ_INT(1, loaded_files.files[0].df->index[0]);
+    EXPECT_EQ_INT(1, loaded_files.files[1].df->num_row);
+    EXPECT_EQ_INT(1, loaded_files.files[1].df->index[0]);
+
+    free(input);
+    free_struct_input_files(&inputs);
+    free_struct_files(&loaded_files);
+    free_struct_parse_context(&c);
+    free_struct_queries(&queries);
+}
+
+static void test_apply_runtime_filters() {
+    freopen("./test_input/join_bushy.txt", "r", stdin);
+
+    char *input = NULL;
+    read_first_part_from_stdin(&input);
+
+    struct_input_files inputs;
+    init_struct_input_files(&inputs);
+
+    parse_first_part(&inputs, input);
+
+    struct_files loaded_files;
+    load_csv_files(&inputs, &loaded_files);
+
+    struct_parse_context c;
+    init_struct_parse_context(&c, "SELECT SUM(A.c0)\nFROM A, C, D\nWHERE C.c1 = A.c0 AND A.c1 > D.c0\n;");
+
+    struct_queries queries;
+    parse_queries(&c, &queries);
+
+    // only (1, 2, 3) is left of A
+    struct_file *const a = &loaded_files.files[0];
+    init_struct_data_frame_for_file(a);
+    a->df->num_row = 1;
+
+    struct_file *const relation_c = &loaded_files.files[2];
+    apply_runtime_filters(&loaded_files, &queries.queries[0], a->df, relation_c, 0);
+    EXPECT_EQ_INT(1, relation_c->df->num_row);
+    EXPECT_EQ_INT(0, relation_c->df->index[0]);
+
+    struct_file *const d = &loaded_files.files[3];
+    apply_runtime_filters(&loaded_files, &queries.queries[0], a->df, d, 0);
+    EXPECT_EQ_INT(1, d->df->num_row);
+    EXPECT_EQ_INT(1, d->df->index[0]);
+
+    // an empty data frame matches nothing
+    a->df->num_row = 0;
+    apply_runtime_filters(&loaded_files, &queries.queries[0], a->df, relation_c, 0);
+    EXPECT_EQ_INT(0, relation_c->df->num_row);
+
+    free(input);
+    free_struct_input_files(&inputs);
+    free_struct_files(&loaded_files);
+    free_struct_parse_context(&c);
+    free_struct_queries(&queries);
+}
+
+static void test_execute_shared_joins() {
+    freopen("./test_input/join_bushy.txt", "r", stdin);
+
+    char *input = NULL;
+    read_first_part_from_stdin(&input);
+
+    struct_input_files inputs;
+    init_struct_input_files(&inputs);
+
+    parse_first_part(&inputs, input);
+
+    struct_files loaded_files;
+    load_csv_files(&inputs, &loaded_files);
+
+    struct_parse_context c;
+    init_struct_parse_context(&c, "SELECT SUM(A.c0), COUNT(*)\nFROM A, B\nWHERE A.c2 = B.c0\n;\n\n"
+                                  "SELECT SUM(B.c1)\nFROM B, A\nWHERE B.c0 = A.c2\nAND B.c1 > 10;");
+
+    struct_queries queries;
+    parse_queries(&c, &queries);
+    EXPECT_EQ_INT(2, (int) queries.length);
+
+    struct_shared_select select;
+    select.predicates = queries.queries[1].fourth.predicates;
+    select.num_predicates = 1;
+    filter_data_given_shared_selects(&loaded_files.files[1], &select, 1);
+
+    std::vector<struct_query *> shared_queries = {&queries.queries[0], &queries.queries[1]};
+    std::vector<std::vector<struct_shared_select *>> selects(2, std::vector<struct_shared_select *>(4, NULL));
+    selects[1][1] = &select;
+
+    EXPECT_EQ_INT(1, should_share_joins(&loaded_files, shared_queries, selects));
+
+    std::vector<std::vector<struct_aggregate_state>> states(2);
+    execute_shared_joins(&loaded_files, shared_queries, selects, states);
+
+    // (1, 2, 3) joins both rows of B, only (3, 12) is in the second query
+    EXPECT_EQ_INT(2, (int) states[0][0].sum);
+    EXPECT_EQ_INT(2, (int) states[0][1].count);
+    EXPECT_EQ_INT(12, (int) states[1][0].sum);
+    EXPECT_EQ_INT(1, (int) states[1][0].count);
+
+    free(input);
+    free_struct_input_files(&inputs);
+    free_only_struct_data_frames(&loaded_files);
+    free_struct_files(&loaded_files);
+    free_struct_parse_context(&c);
+    free_struct_queries(&queries);
+}
+
+static void test_cached_join_result() {
+    freopen("./test_input/join_bushy.txt", "r", stdin);
+
+    char *input = NULL;
+    read_first_part_from_stdin(&input);
+
+    struct_input_files inputs;
+    init_struct_input_files(&inputs);
+
+    parse_first_part(&inputs, input);
+
+    struct_files loaded_files;
+    load_csv_files(&inputs, &loaded_files);
+
+    struct_parse_context c;
+    init_struct_parse_context(&c, "SELECT COUNT(*)\nFROM A, B\nWHERE A.c2 = B.c0\nAND A.c0 < 2;\n\n"
+                                  "SELECT COUNT(*)\nFROM B, A\nWHERE B.c0 = A.c2\nAND A.c0 < 2 AND B.c1 > 10;\n\n"
+                                  "SELECT COUNT(*)\nFROM A, B\nWHERE A.c2 = B.c0\nAND B.c1 > 10;");
+
+    struct_queries queries;
+    parse_queries(&c, &queries);
+    EXPECT_EQ_INT(3, (int) queries.length);
+
+    for (int q = 0; q < 3; q++) {
+        struct_query *const query = &queries.queries[q];
+        for (int i = 0; i < query->fourth.length; i++) {
+            const auto &predicate = query->fourth.predicates[i];
+            filter_data_given_predicates(&loaded_files.files[predicate.lhs.relation - 'A'], &predicate, 1, NULL);
+        }
+        for (int i = 0; i < 2; i++) {
+            if (loaded_files.files[i].df == NULL) {
+                init_struct_data_frame_for_file(&loaded_files.files[i]);
+            }
+        }
+
+        JoinGraph graph;
+        Order plan = optimize_joins(&loaded_files, query, graph);
+        std::vector<PlanStep> steps;
+        estimate_order(graph, plan, steps);
+
+        QuerySamples samples;
+        std::unordered_map<char, JoinStackEntry> materialized;
+        const bool is_cached = plan_with_cached_join_results(&loaded_files, query, graph, plan, steps, samples,
+                                                             materialized);
+
+        if (q == 0) {
+            // (1, 2, 3) joins both rows of B, and is cached
+            EXPECT_EQ_INT(0, is_cached);
+
+            struct_data_frame result;
+            execute_joins(&loaded_files, query, graph, plan, &result, NULL);
+            EXPECT_EQ_INT(2, result.num_row);
+            EXPECT_EQ_INT(1, (int) join_result_cache.size());
+
+            free_struct_data_frame(&result);
+        } else if (q == 1) {
+            // rows of A and B are among those joined before, only (3, 12) of B is left
+            EXPECT_EQ_INT(1, is_cached);
+            EXPECT_EQ_INT(1, (int) plan.size());
+            EXPECT_EQ_INT(1, (int) materialized.size());
+
+            const struct_data_frame *const df = materialized.begin()->second.df;
+            EXPECT_EQ_INT(1, df->num_row);
+            EXPECT_EQ_INT(1, df->index[strchr(df->relations, 'B') - df->relations]);
+
+            free_struct_data_frame(materialized.begin()->second.df);
+            free(materialized.begin()->second.df);
+        } else {
+            // (4, 5, 6) of A was not joined before
+            EXPECT_EQ_INT(0, is_cached);
+        }
+
+        free_only_struct_data_frames(&loaded_files);
+    }
+
+    free(input);
+    free_struct_input_files(&inputs);
+    free_struct_files(&loaded_files);
+    free_struct_parse_context(&c);
+    free_struct_queries(&queries);
+
+    // the cache is dropped with the data
+    EXPECT_EQ_INT(1, join_result_cache.empty());
+}
+
+static void test_join() {
+    test_join_manual();
+}
+
+// tests of joins that need no ../data, test_join is left out of main
+static void test_join_standalone() {
+    test_join_band();
+    test_join_data_frames();
+    test_apply_runtime_filters();
+    test_transfer_predicates();
+    test_transfer_predicates_wide();
+    test_execute_shared_joins();
+}
+
+// caches kept across queries
+static void test_caches() {
+    test_predicate_cached();
+    test_cached_join_result();
+}
+
+///////////////
+// Optimizer //
+///////////////
+
+static void test_normalize_query_shape() {
+    struct_parse_context c;
+    init_struct_parse_context(&c,
+                              "SELECT SUM(A.c1)\nFROM C, A, B\nWHERE B.c0 = A.c1 AND A.c3 = C.c0\nAND B.c2 < 7 AND B.c2 < -3;\n\n"
+                              "SELECT SUM(C.c2)\nFROM A, B, C\nWHERE A.c3 = C.c0 AND A.c1 = B.c0\nAND B.c2 < 12;");
+
+    struct_queries queries;
+    parse_queries(&c, &queries);
+
+    const std::string shape = normalize_query_shape(&queries.queries[0]);
+
+    EXPECT_EQ_STRING("ABC|A1=B0,A3=C0|B2<", shape.c_str(), shape.length());
+    EXPECT_EQ_INT(1, shape == normalize_query_shape(&queries.queries[1]));
+
+    free_struct_parse_context(&c);
+    free_struct_queries(&queries);
+}
+
+static void test_plan_cache() {
+    freopen("./test_input/join_bushy.txt", "r", stdin);
+
+    char *input = NULL;
+    read_first_part_from_stdin(&input);
+
+    struct_input_files inputs;
+    init_struct_input_files(&inputs);
+
+    parse_first_part(&inputs, input);
+
+    struct_files loaded_files;
+    load_csv_files(&inputs, &loaded_files);
+
+    struct_parse_context c;
+    init_struct_parse_context(&c, "SELECT SUM(A.c0)\nFROM A, B\nWHERE A.c2 = B.c0\nAND A.c0 < 2;\n\n"
+                                  "SELECT SUM(B.c1)\nFROM B, A\nWHERE B.c0 = A.c2\nAND A.c0 < 5;");
+
+    struct_queries queries;
+    parse_queries(&c, &queries);
+
+    struct_query *const query = &queries.queries[0];
+    const std::string key = normalize_query_shape(query);
+
+    // a full cache of shapes used before, the one used least recently is evicted for a new shape
+    for (int i = 0; i < PLAN_CACHE_MAX_ENTRIES; i++) {
+        plan_cache["Z|" + std::to_string(i)].last_used = ++plan_cache_clock;
+    }
+    plan_cache["Z|0"].last_used = ++plan_cache_clock;
+
+    JoinGraph graph;
+    optimize_joins(&loaded_files, query, graph);
+    EXPECT_EQ_INT(PLAN_CACHE_MAX_ENTRIES, (int) plan_cache.size());
+    EXPECT_EQ_INT(1, (int) plan_cache.count(key));
+    EXPECT_EQ_INT(1, (int) plan_cache.count("Z|0"));
+    EXPECT_EQ_INT(0, (int) plan_cache.count("Z|1"));
+
+    forget_plans('Z');
+    EXPECT_EQ_INT(1, (int) plan_cache.size());
+
+    // the same shape reuses the graph, with the clause of its own query and the rows left now
+    struct_file *const a = &loaded_files.files[0];
+    init_struct_data_frame_for_file(a);
+    a->df->num_row = 1;
+
+    struct_query *const other = &queries.queries[1];
+    JoinGraph graph_other;
+    optimize_joins(&loaded_files, other, graph_other);
+    EXPECT_EQ_INT(1, graph_other.joins[0] == &other->third.joins[0]);
+    EXPECT_EQ_INT(1, graph_other.selectivities == graph.selectivities);
+    EXPECT_EQ_INT(1, graph_other.cardinalities[0] == 1);
+
+    free(input);
+    free_struct_input_files(&inputs);
+    free_struct_files(&loaded_files);
+    free_struct_parse_context(&c);
+    free_struct_queries(&queries);
+
+    // plans are dropped with the data they were costed on
+    EXPECT_EQ_INT(0, (int) plan_cache.size());
+}
+
+static void test_join_selectivity() {
+    // A.c0 is uniform over [0, 99], B.c0 over [50, 149]
+    struct_meta_column meta_A, meta_B;
+    meta_A.min = 0;
+    meta_A.max = 99;
+    meta_B.min = 50;
+    meta_B.max = 149;
+    meta_A.unique = meta_B.unique = 100;
+    for (int k = 0; k < NUM_BUCKETS_HISTOGRAM; k++) {
+        meta_A.histogram[k] = meta_B.histogram[k] = 1000 / NUM_BUCKETS_HISTOGRAM;
+    }
+
+    struct_files files;
+    init_struct_files(&files, 2);
+    files.files[0].relation = 'A';
+    files.files[1].relation = 'B';
+    files.files[0].num_row = files.files[1].num_row = NUM_BUCKETS_HISTOGRAM * (1000 / NUM_BUCKETS_HISTOGRAM);
+    files.files[0].meta = &meta_A;
+    files.files[1].meta = &meta_B;
+
+    struct_join join;
+    join.lhs.relation = 'A';
+    join.lhs.column = 0;
+    join.rhs.relation = 'B';
+    join.rhs.column = 0;
+
+    // only half of each side overlaps, with 50 distinct numbers: 1/2 * 1/2 * 1/50
+    join.op = EQUAL;
+    float selectivity = join_selectivity(join, &files);
+    EXPECT_EQ_INT(1, 0.004f < selectivity && selectivity < 0.006f);
+
+    // A.c0 < B.c0 unless both are in [50, 99]
+    join.op = LESS_THAN;
+    selectivity = join_selectivity(join, &files);
+    EXPECT_EQ_INT(1, 0.8f < selectivity && selectivity < 0.95f);
+
+    join.op = GREATER_THAN;
+    selectivity = join_selectivity(join, &files);
+    EXPECT_EQ_INT(1, 0.05f < selectivity && selectivity < 0.2f);
+
+    files.files[0].meta = files.files[1].meta = NULL;
+    free_struct_files(&files);
+}
+
+static void test_sample_join_selectivity() {
+    freopen("./test_input/join_bushy.txt", "r", stdin);
+
+    char *input = NULL;
+    read_first_part_from_stdin(&input);
+
+    struct_input_files inputs;
+    init_struct_input_files(&inputs);
+
+    parse_first_part(&inputs, input);
+
+    struct_files loaded_files;
+    load_csv_files(&inputs, &loaded_files);
+
+    // relations this small are sampled whole, so the estimate is exact
+    for (int i = 0; i < loaded_files.length; i++) {
+        EXPECT_EQ_INT(loaded_files.files[i].num_row, loaded_files.files[i].sample.num_row);
+    }
+
+    struct_join join;
+    join.lhs.relation = 'A';
+    join.lhs.column = 2;
+    join.rhs.relation = 'B';
+    join.rhs.column = 0;
+    join.op = EQUAL;
+
+    // (1, 2, 3) of A joins both rows of B, (4, 5, 6) none
+    EXPECT_EQ_INT(1, join_selectivity(join, &loaded_files) == 0.5f);
+
+    // only (1, 2, 3) is left in A
+    struct_predicate predicate;
+    predicate.lhs.relation = 'A';
+    predicate.lhs.column = 0;
+    predicate.op = LESS_THAN;
+    predicate.rhs = 2;
+    filter_data_given_predicates(&loaded_files.files[0], &predicate, 1, NULL);
+    EXPECT_EQ_INT(1, join_selectivity(join, &loaded_files) == 1.0f);
+
+    free_only_struct_data_frames(&loaded_files);
+    free(input);
+    free_struct_input_files(&inputs);
+    free_struct_files(&loaded_files);
+}
+
+static void test_enumerate_join_pairs() {
+    // A - B - C - D
+    JoinGraph chain;
+    chain.relations = {'A', 'B', 'C', 'D'};
+    chain.neighbors = {0x2, 0x5, 0xa, 0x4};
+
+    // A in the middle of B, C and D
+    JoinGraph star = chain;
+    star.neighbors = {0xe, 0x1, 0x1, 0x1};
+
+    // every pair of relations is joined
+    JoinGraph clique = chain;
+    clique.neighbors = {0xe, 0xd, 0xb, 0x7};
+
+    // each pair of connected sets joined by a clause, counted once: (n^3 - n) / 6, (n - 1) * 2^(n - 2),
+    // and (3^n - 2^(n + 1) + 1) / 2
+    std::vector<std::pair<RelationSet, RelationSet>> pairs;
+    enumerate_join_pairs(chain, pairs);
+    EXPECT_EQ_INT(10, (int) pairs.size());
+
+    pairs.clear();
+    enumerate_join_pairs(star, pairs);
+    EXPECT_EQ_INT(12, (int) pairs.size());
+
+    pairs.clear();
+    enumerate_join_pairs(clique, pairs);
+    EXPECT_EQ_INT(25, (int) pairs.size());
+
+    // halves do not overlap, and smaller pairs come first
+    for (const auto &pair: pairs) {
+        EXPECT_EQ_INT(0, (int) (pair.first & pair.second));
+    }
+    EXPECT_EQ_INT(2, __builtin_popcount(pairs.front().first | pairs.front().second));
+    EXPECT_EQ_INT(0xf, (int) (pairs.back().first | pairs.back().second));
+}
+
+static void test_compute_greedy() {
+    // A - B - C, A join B has 10 rows, B join C has 1000 rows
+    JoinGraph graph;
+    graph.relations = {'A', 'B', 'C'};
+    graph.cardinalities = {1000, 10, 1000};
+    graph.neighbors = {0x2, 0x5, 0x2};
+    graph.clauses = {0x3, 0x6};
+    graph.selectivities = {0.001f, 0.1f};
+
+    // A join B goes first, the smaller side is sorted
+    Order order;
+    BestPlan plan = compute_greedy(graph, order);
+    EXPECT_EQ_STRING("BA*C*", vector_to_string(order).c_str(), order.size());
+    EXPECT_EQ_INT(1000, (int) plan.cardinality);
+
+    // C is not joined with anything
+    graph.neighbors = {0x2, 0x1, 0x0};
+    graph.clauses = {0x3};
+    graph.selectivities = {0.001f};
+
+    compute_greedy(graph, order);
+    EXPECT_EQ_INT(0, (int) order.size());
+}
+
+static void test_init_join_graph_of_units() {
+    freopen("./test_input/join_bushy.txt", "r", stdin);
+
+    char *input = NULL;
+    read_first_part_from_stdin(&input);
+
+    struct_input_files inputs;
+    init_struct_input_files(&inputs);
+
+    parse_first_part(&inputs, input);
+
+    struct_files loaded_files;
+    load_csv_files(&inputs, &loaded_files);
+
+    struct_parse_context c;
+    init_struct_parse_context(&c, "SELECT SUM(A.c0)\nFROM A, B, C, D\nWHERE A.c2 = B.c0 AND C.c1 = D.c0 AND B.c1 = C.c0\n;");
+
+    struct_queries queries;
+    parse_queries(&c, &queries);
+
+    QuerySamples samples;
+    init_query_samples(samples, &loaded_files, &queries.queries[0]);
+
+    // A join B is done, it is named A
+    JoinGraph graph;
+    init_join_graph_of_units(graph, &loaded_files, &queries.queries[0], samples, {"AB", "C", "D"}, {2, 3, 2});
+
+    EXPECT_EQ_STRING("ACD", vector_to_string(graph.relations).c_str(), graph.relations.size());
+    EXPECT_EQ_INT(2, (int) graph.clauses.size());
+    EXPECT_EQ_INT(0x6, (int) graph.clauses[0]);
+    EXPECT_EQ_INT(0x3, (int) graph.clauses[1]);
+    EXPECT_EQ_INT(0x5, (int) graph.neighbors[1]);
+
+    Order order;
+    plan_join_graph(graph, order);
+    EXPECT_EQ_INT(5, (int) order.size());
+
+    // relations are sampled once for the query, a graph built after rows of A are dropped keeps them
+    struct_file *const a = &loaded_files.files[0];
+    init_struct_data_frame_for_file(a);
+    a->df->num_row = 1;
+
+    init_query_samples(samples, &loaded_files, &queries.queries[0]);
+    EXPECT_EQ_INT(2, (int) samples.rows[0].size());
+
+    free(input);
+    free_struct_input_files(&inputs);
+    free_struct_files(&loaded_files);
+    free_struct_parse_context(&c);
+    free_struct_queries(&queries);
+}
+
+static void test_feedback() {
+    freopen("./test_input/join_bushy.txt", "r", stdin);
+
+    char *input = NULL;
+    read_first_part_from_stdin(&input);
+
+    struct_input_files inputs;
+    init_struct_input_files(&inputs);
+
+    parse_first_part(&inputs, input);
+
+    struct_files loaded_files;
+    load_csv_files(&inputs, &loaded_files);
+
+    struct_parse_context c;
+    init_struct_parse_context(&c, "SELECT SUM(A.c0)\nFROM A, B\nWHERE A.c2 = B.c0\nAND A.c0 < 2;");
+
+    struct_queries queries;
+    parse_queries(&c, &queries);
+
+    struct_query *const query = &queries.queries[0];
+    const struct_join &join = query->third.joins[0];
+    const struct_predicate &predicate = query->fourth.predicates[0];
+
+    // a plan cached before the feedback
+    JoinGraph graph_cached;
+    optimize_joins(&loaded_files, query, graph_cached);
+    const auto &cached = plan_cache[normalize_query_shape(query)];
+    EXPECT_EQ_INT(0, should_recost_plan(cached, &loaded_files, query));
+
+    // B.c0 = A.c2 is the same clause, estimated 4 times too few both times
+    struct_join flipped = join;
+    flip_join(&flipped);
+    record_join_feedback(join, 0.4f, 0.1f);
+    record_join_feedback(flipped, 0.8f, 0.2f);
+    EXPECT_EQ_INT(1, fabsf(join_feedback_correction(join) - 4) < 0.01f);
+
+    // off by more than PLAN_CACHE_RECOST_RATIO, what is learned reaches the cached plan
+    record_join_feedback(join, 0.8f, 0.1f);
+    EXPECT_EQ_INT(1, should_recost_plan(cached, &loaded_files, query));
+    plan_cache.erase(normalize_query_shape(query));
+
+    // A and B are sampled whole, so their estimate is exact and not corrected
+    JoinGraph graph;
+    init_join_graph(graph, &loaded_files, query);
+    EXPECT_EQ_INT(1, graph.selectivities[0] == 0.5f);
+    EXPECT_EQ_INT(1, graph.estimates[0] == 0);
+
+    // A.c0 < 2 is observed to keep a quarter of the rows, A.c0 < 4 is another bucket
+    record_predicate_feedback(predicate, &loaded_files.files[0], FEEDBACK_MIN_ROWS, FEEDBACK_MIN_ROWS / 4);
+    EXPECT_EQ_INT(1, predicate_selectivity(predicate, &loaded_files.files[0]) == 0.25f);
+
+    struct_predicate other = predicate;
+    other.rhs = 4;
+    EXPECT_EQ_INT(1, predicate_selectivity(other, &loaded_files.files[0]) != 0.25f);
+
+    free(input);
+    free_struct_input_files(&inputs);
+    free_struct_files(&loaded_files);
+    free_struct_parse_context(&c);
+    free_struct_queries(&queries);
+
+    // feedback is dropped with the data
+    EXPECT_EQ_INT(1, join_feedback.empty() && predicate_feedback[0].empty());
+}
+
+static void test_infer_predicates() {
+    struct_parse_context c;
+    init_struct_parse_context(&c,
+                              "SELECT SUM(A.c0)\nFROM A, B, C\nWHERE A.c1 = B.c0 AND B.c0 = C.c2 AND A.c2 < C.c1\n"
+                              "AND B.c0 = 5 AND (A.c1 < 3 OR A.c1 > 9) AND C.c1 < 4;");
+
+    struct_queries queries;
+    parse_queries(&c, &queries);
+
+    struct_arena arena;
+    init_struct_arena(&arena);
+
+    struct_query *const query = &queries.queries[0];
+    infer_predicates(query, &arena);
+
+    // A.c1, B.c0 and C.c2 are one class, C.c1 is only joined by <
+    EXPECT_EQ_INT(7, (int) query->fourth.length);
+    EXPECT_RELATION_COLUMN(&query->fourth.predicates[3].lhs, 'A', 1);
+    EXPECT_EQ_INT(5, query->fourth.predicates[3].rhs);
+    EXPECT_RELATION_COLUMN(&query->fourth.predicates[4].lhs, 'C', 2);
+
+    const struct_predicate &any = query->fourth.predicates[5];
+    EXPECT_EQ_INT(OR, any.op);
+    EXPECT_RELATION_COLUMN(&any.lhs, 'B', 0);
+    EXPECT_RELATION_COLUMN(&any.disjuncts[1].lhs, 'B', 0);
+    EXPECT_EQ_INT(9, any.disjuncts[1].rhs);
+
+    // nothing new the second time
+    infer_predicates(query, &arena);
+    EXPECT_EQ_INT(7, (int) query->fourth.length);
+
+    free_struct_arena(&arena);
+    free_struct_parse_context(&c);
+    free_struct_queries(&queries);
+}
+
+static void test_optimizer() {
+    test_normalize_query_shape();
+    test_plan_cache();
+    test_join_selectivity();
+    test_sample_join_selectivity();
+    test_enumerate_join_pairs();
+    test_compute_greedy();
+    test_init_join_graph_of_units();
+    test_feedback();
+    test_infer_predicates();
+}
+
+//////////////////
+// Aggregation //
+/////////////////
+
+static void test_aggregate_int128() {
+    // products of the largest numbers, a block of them overflows 64-bit
+    int lhs[SIZE_AGGREGATE_BLOCK], rhs[SIZE_AGGREGATE_BLOCK];
+    for (int i = 0; i < SIZE_AGGREGATE_BLOCK; i++) {
+        lhs[i] = i % 2 == 0 ? INT32_MIN : INT32_MAX;
+        rhs[i] = INT32_MIN;
+    }
+
+    int64_t numbers[SIZE_AGGREGATE_BLOCK];
+    evaluate_arithmetic_block(ARITHMETIC_MULTIPLY, lhs, rhs, numbers, SIZE_AGGREGATE_BLOCK);
+
+    struct_aggregate_state state;
+    init_struct_aggregate_state(&state);
+    update_aggregate_state_wide(&state, AGGREGATE_SUM, numbers, SIZE_AGGREGATE_BLOCK);
+    update_aggregate_state_wide(&state, AGGREGATE_SUM, numbers, SIZE_AGGREGATE_BLOCK);
+
+    __int128 expect = 0;
+    for (int i = 0; i < SIZE_AGGREGATE_BLOCK; i++) {
+        expect += 2 * (__int128) lhs[i] * rhs[i];
+    }
+
+    char str_expect[48], str_actual[48];
+    format_int128(expect, str_expect);
+    format_int128(state.sum, str_actual);
+    EXPECT_EQ_BASE(0 == strcmp(str_expect, str_actual), str_expect, str_actual, "%s");
+
+    char str[48];
+    format_int128(0, str);
+    EXPECT_EQ_STRING("0", str, strlen(str));
+    format_int128(-((__int128) 1 << 126) - ((__int128) 1 << 126), str);
+    EXPECT_EQ_STRING("-170141183460469231731687303715884105728", str, strlen(str));
+}
+
+static void test_aggregates() {
+    test_aggregate_int128();
+}
+
+static void test_main() {
+    freopen("./test_input/full_xs.txt", "r", stdin);
+
+    char *first_part = NULL;
+    read_first_part_from_stdin(&first_part);
+
+    char *second_part = NULL;
+    read_second_part_from_stdin(&second_part);
+
+    // handle path to files
+    struct_input_files files;
+    init_struct_input_files(&files);
+
+    // parse first part
+    parse_first_part(&files, first_part);
+
+    // parse queries
+    struct_queries queries;
+    parse_second_part(&queries, second_part);
+
+    struct_files loaded_files;
+
+    // convert csv files into binary representation
+    load_csv_files(&files, &loaded_files);
+
+    // free data that we don't need
+    free(first_part);
+    free(second_part);
+    free_struct_input_files(&files);
+
+    // execute each query, and clean up df after each query
+    execute_queries(&loaded_files, &queries);
 
     // free this at the end
     free_struct_queries(&queries);
@@ -909,6 +2208,12 @@ int main() {
 //    test_parse();
 //    test_predicates();
 //    test_join();
+    test_parse_standalone();
+    test_predicates_standalone();
+    test_join_standalone();
+    test_caches();
+    test_optimizer();
+    test_aggregates();
     test_main();
 
     printf("%d/%d (%3.2f%%) passed\n", test_pass, test_count, test_pass * 100.0 / test_count);